@@ -0,0 +1,60 @@
+#pragma once
+#include <Arduino.h>
+
+// 非同期ログ
+// 送信・受信の処理中は書式化せず、書式番号と引数だけをリングに積む
+// 低優先度のログタスクが取り出して Serial に書式化して出す（Serial 待ちで送信タイミングを崩さない）
+
+enum LogLevel : uint8_t {
+    LOG_ERROR = 0,
+    LOG_WARN,
+    LOG_INFO,
+    LOG_DEBUG
+};
+
+enum LogCategory : uint8_t {
+    LOG_CAT_SYS = 0, // 常に有効
+    LOG_CAT_TX,
+    LOG_CAT_RX,
+    LOG_CAT_ISOTP,
+    LOG_CAT_COUNT
+};
+
+// 書式番号。文字列は async_log.cpp の表にあり、引数は uint32_t を最大4つまで
+enum LogFormat : uint8_t {
+    LOG_FMT_TX_CHUNK = 0, // [offset]: + 16進ダンプ
+    LOG_FMT_TX_FAILED,
+    LOG_FMT_TX_END,
+    LOG_FMT_TX_ABORTED,   // jobId
+    LOG_FMT_BUS_OFF,      // 再送フレーム数
+    LOG_FMT_BUS_OFF_FAILED,
+    LOG_FMT_ISOTP_OVERFLOW,
+    LOG_FMT_ISOTP_TIMEOUT,
+    LOG_FMT_RX_FRAME,     // identifier + 16進ダンプ
+    LOG_FMT_COUNT
+};
+
+// 1レコードに載せる16進ダンプの最大長（長いデータは呼び出し側で分ける）
+static const size_t LOG_BLOB_MAX = 16;
+
+extern volatile uint8_t logMaxLevel;
+extern volatile uint32_t logCategoryMask;
+
+inline bool logEnabled(LogCategory cat, LogLevel level) {
+    return level <= logMaxLevel && (logCategoryMask & (1u << cat));
+}
+
+// 起動時に呼ぶ（ログタスクを起動する。それまでに積んだレコードも後から出る）
+void setupLog();
+
+// 実行中に出力レベルとカテゴリ (1 << LogCategory のビットマスク) を切り替える
+void logConfigure(LogLevel maxLevel, uint32_t categoryMask);
+
+// リングに積む。いっぱいなら捨てて数える（呼び出し側は待たない）
+void logWrite(LogCategory cat, LogLevel level, LogFormat fmt,
+              uint32_t a0 = 0, uint32_t a1 = 0, uint32_t a2 = 0, uint32_t a3 = 0);
+void logWriteHex(LogCategory cat, LogLevel level, LogFormat fmt, uint32_t a0,
+                 const uint8_t* data, size_t len);
+
+// リングがいっぱいで捨てたレコード数（累計）
+uint32_t logDropped();
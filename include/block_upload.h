@@ -0,0 +1,73 @@
+#pragma once
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "upload_writer.h"
+
+// ブロック単位の再開できるアップロード
+// 保存先ごとに /staging へ本体 (.part) と受信済みブロックのビットマップ (.map) を置き、
+// ブロックごとに CRC32 を確かめてから受信済みにする。接続が切れても受け取ったブロックは残るので
+// 足りないブロックだけ送り直せばよい（順番は問わない）
+// 全ブロックがそろったら commit で本来のパスへ置き換える。それまで元のファイルは消さない
+
+const char* const BLOCK_STAGING_DIR = "/staging";
+const uint32_t BLOCK_SIZE_MIN = 512;
+const uint32_t BLOCK_SIZE_MAX = 16384;
+const uint32_t BLOCK_COUNT_MAX = 8192; // ビットマップ 1KiB
+
+struct BlockSession {
+    uint32_t size;
+    uint32_t blockSize;
+    uint32_t blocks;
+    uint32_t received; // 受信済みブロック数
+};
+
+enum BlockResult : uint8_t {
+    BLOCK_OK = 0,
+    BLOCK_NO_SESSION,      // begin していない
+    BLOCK_BAD_PARAMS,      // サイズ・ブロック長が範囲外
+    BLOCK_BAD_INDEX,
+    BLOCK_BAD_LENGTH,      // ブロックの長さが合わない（最後のブロック以外は blockSize ちょうど）
+    BLOCK_CRC_MISMATCH,
+    BLOCK_INCOMPLETE,      // commit: 未受信のブロックがある
+    BLOCK_DIGEST_MISMATCH, // commit: ファイル全体の CRC32 が指定と違う
+    BLOCK_NO_SPACE,
+    BLOCK_IO_ERROR
+};
+
+const char* blockResultName(BlockResult result);
+
+// 起動時に呼ぶ（作業ディレクトリの作成）
+void setupBlockUpload();
+
+// セッションを開始する。同じ size と blockSize のセッションが残っていればそのまま再開する
+BlockResult blockUploadBegin(const char* path, uint32_t size, uint32_t blockSize, BlockSession* session);
+
+// セッションの状態を返す。missing に未受信のブロック番号を先頭から maxMissing 個まで入れる
+BlockResult blockUploadStatus(const char* path, BlockSession* session,
+                              uint32_t* missing, size_t maxMissing, size_t* missingCount);
+
+// 全ブロックがそろっていれば path に置き換えてダイジェストを保存する
+// expectedCrc が nullptr でなければファイル全体の CRC32 も確かめる（違えば置き換えない）
+BlockResult blockUploadCommit(const char* path, const uint32_t* expectedCrc, UploadDigest* digest);
+
+// セッションを破棄する（作業ファイルを消す）
+void blockUploadAbort(const char* path);
+
+// 1ブロック分の書き込み口（HTTPUpload のチャンクごとに write を呼ぶ）
+// データは受け取りながら .part の該当位置へ書き、finish で長さと CRC32 が合ったときだけ受信済みにする
+class BlockWriter {
+public:
+    BlockResult begin(const char* path, uint32_t index);
+    void write(const uint8_t* data, size_t len);
+    BlockResult finish(uint32_t expectedCrc);
+    void abort();
+
+private:
+    File file_;
+    char path_[UPLOAD_PATH_MAX];
+    uint32_t index_ = 0;
+    uint32_t expected_ = 0;
+    uint32_t received_ = 0;
+    uint32_t crc_ = 0;
+    BlockResult state_ = BLOCK_NO_SESSION;
+};
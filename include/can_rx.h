@@ -0,0 +1,72 @@
+#pragma once
+#include <Arduino.h>
+#include "driver/twai.h"
+
+const uint16_t CAN_STD_ID_COUNT = 2048; // 標準ID(11bit)の数
+
+// 受信フレーム（受信タスクでタイムスタンプを付けてリングに積む）
+struct RxFrame {
+    int64_t timestampUs; // esp_timer_get_time()
+    uint32_t identifier;
+    uint8_t flags;       // RX_FLAG_*
+    uint8_t dlc;
+    uint8_t data[8];
+};
+
+const uint8_t RX_FLAG_EXTD = 0x01;
+const uint8_t RX_FLAG_RTR = 0x02;
+
+// IDごとの受信統計（count〜maxGapUs は受信タスクだけが書く）
+struct RxIdStats {
+    uint32_t count;
+    uint32_t lastUs;   // 最終受信時刻 (esp_timer の下位32bit)
+    uint32_t minGapUs; // 受信間隔の最小・最大 (2回目の受信から有効)
+    uint32_t maxGapUs;
+    uint16_t rateFps;  // canRxUpdateRates() が1秒ごとに更新
+    uint16_t prevCount; // rateFps 計算用 (countの下位16bit)
+};
+
+// 受信フレームの取り出し先。消費者ごとに専用のリングを持つ
+enum RxConsumer : uint8_t {
+    RX_CONSUMER_MONITOR = 0, // loop() のシリアル表示
+    RX_CONSUMER_CAPTURE,     // LittleFS へのキャプチャ
+    RX_CONSUMER_LIVE,        // ブラウザへのライブ配信 (/live)
+    RX_CONSUMER_COUNT
+};
+
+// 消費者ごとのIDフィルタ（通したいIDのビットを立てる）
+struct RxIdFilter {
+    uint32_t stdIds[CAN_STD_ID_COUNT / 32];
+    bool extended;           // 拡張IDをすべて通す
+};
+
+// 受信全体のカウンタ
+struct RxCounters {
+    uint32_t frames;     // 受信タスクが取り出したフレーム数
+    uint32_t extended;   // 拡張IDフレーム数 (ID別統計の対象外)
+    uint32_t ringDrops[RX_CONSUMER_COUNT]; // リングが満杯で捨てたフレーム数 (統計には反映済み)
+};
+
+// 受信タスクの生成 (setupCAN() の後に呼ぶ)
+void setupCANRx();
+
+// リングから1フレーム取り出す（消費者ごとに取り出し側は1タスクだけにすること）
+bool canRxPop(RxConsumer consumer, RxFrame* out);
+
+// 消費者のリングへの投入を有効/無効にする（モニターは最初から有効）
+void canRxSetConsumerEnabled(RxConsumer consumer, bool enabled);
+
+// 消費者のリングに積むIDを絞る。nullptr なら全て通す
+// 受信タスク側で捨てるので、不要なフレームはリングにも積まれない
+void canRxSetConsumerFilter(RxConsumer consumer, const RxIdFilter* filter);
+
+// 標準IDの統計。拡張ID・範囲外は nullptr
+const RxIdStats* canRxStats(uint32_t id);
+
+// from 以上で1度でも受信した標準IDを返す。なければ -1
+int canRxNextActiveId(int from);
+
+// 受信レート(frame/s)を更新する。1秒ごとに呼ぶ
+void canRxUpdateRates();
+
+RxCounters canRxCounters();
@@ -0,0 +1,106 @@
+#pragma once
+#include <Arduino.h>
+#include "driver/twai.h"
+#include "chunk_framer.h"
+
+// 送信ジョブの状態
+enum TxJobState : uint8_t {
+    TX_IDLE = 0,   // ジョブ未実行
+    TX_QUEUED,     // キュー待ち
+    TX_RUNNING,    // 送信中
+    TX_DONE,       // 送信完了
+    TX_FAILED,     // ファイルが開けない等で中断
+    TX_CANCELLED   // /jobs/cancel で取り消した
+};
+
+// 送信方式
+enum TxTransport : uint8_t {
+    TRANSPORT_RAW = 0, // 16byteを2つのIDに分けて送る従来方式
+    TRANSPORT_ISOTP,   // ISO 15765-2 (FF/CF + Flow Control)
+    TRANSPORT_REPLAY   // 記録済みトレースを元のタイミングで再送
+};
+
+static const size_t TX_JOB_TABLE_LEN = 8;   // 待ち・実行中・終了済みを合わせて保持するジョブ数
+static const size_t TX_INTERLEAVE_MAX = 4;  // 同時に交互送信するジョブ数の上限
+static const uint8_t TX_PRIORITY_MAX = 7;
+static const uint64_t TX_JOB_BYTES_MAX = UINT32_MAX; // 進捗 (送信済みbyte数) は32bitで数えるので、ジョブ全体でこれまで
+
+// 送信ジョブ（キュー投入時点の設定をコピーして保持する）
+struct TxJob {
+    uint32_t jobId;
+    uint8_t slot;             // ジョブ表の位置 (enqueueTxJob が設定する)
+    uint8_t priority;         // 0-7: 大きいほど先に送る。交互送信では1周に (priority+1) チャンク
+    char path[48];
+    bool compressed;          // path は gzip。送信しながら展開する
+    TxTransport transport;
+    uint32_t packetGap;       // パケット間の待ち時間 (ms)
+    uint32_t chunkInterval;   // 16byteセット間の待ち時間 (ms)
+    uint32_t packetGapUs;     // packetGap に加算する µs 部分
+    uint32_t chunkIntervalUs; // chunkInterval に加算する µs 部分
+    uint8_t busLoadPct;       // 1-100: DLCとビットレートから間隔を自動計算 (0で無効)
+    bool adaptiveRate;        // バスの状態を見て送信間隔を自動調整する (packetGap は初期値)
+    bool loopback;            // 自己受信 (self=1) で送り、遅延と欠落を計測する (/selftest)
+    ChunkLayout layout;       // raw: チャンクサイズ・送信IDの割り付け
+    uint32_t isotpTxId;        // ISO-TP: 送信先ID
+    uint32_t isotpRxId;        // ISO-TP: Flow Controlを受け取るID
+    uint16_t isotpPayloadSize; // ISO-TP: 1メッセージあたりのbyte数 (最大4095)
+    uint16_t replaySpeedPct;   // リプレイ: 再生速度 (100 = 等倍, 0 = 最速)
+    uint16_t replayLoops;      // リプレイ: 繰り返し回数
+};
+
+// ジョブごとの状況（/jobs 用）
+struct TxJobInfo {
+    uint32_t jobId;
+    char path[48];
+    uint8_t priority;
+    TxJobState state;
+    size_t totalBytes;
+    size_t bytesSent;
+    uint32_t framesSent;
+    uint32_t framesFailed;
+};
+
+// 送信状況のスナップショット（/status や画面表示用）
+// 交互送信中は同時に送っているジョブ全体の合計
+
+struct TxStatus {
+    uint32_t jobId;        // 実行中または最後に実行したジョブ（交互送信では最初に始めたもの）
+    TxJobState state;
+    size_t totalBytes;
+    size_t bytesSent;
+    uint32_t framesSent;
+    uint32_t framesFailed;
+    uint32_t framesResent;     // バスオフ復帰後に送り直したフレーム数
+    uint32_t busOffRecoveries; // 起動からのバスオフ復帰回数
+    uint32_t rateGapUs;        // 閉ループ制御中の送信間隔 (0なら固定間隔)
+    uint32_t pendingJobs;  // キュー待ちのジョブ数
+    uint32_t pendingFrames; // フレームキューに溜まっているフレーム数
+};
+
+// 送信タスクとキューの生成 (setupCAN() の後に呼ぶ)
+void setupCANTx();
+
+// ジョブを投入し、採番したジョブIDを返す（ジョブ表に空きがなければ0）
+// 優先度の高いものから、同じ優先度なら投入順に送る
+uint32_t enqueueTxJob(TxJob job);
+
+// 待ち・実行中のジョブを取り消す。該当するジョブがなければ false
+bool cancelTxJob(uint32_t jobId);
+
+// ジョブ表の内容をID順に out へコピーし、件数を返す
+size_t listTxJobs(TxJobInfo* out, size_t maxJobs);
+
+// 交互送信の有効/無効（config.json の job_schedule）
+// 有効なら、待っている raw 方式・非圧縮のジョブをまとめてチャンク単位で交互に送る
+void canTxSetInterleave(bool interleave);
+
+// 送信状況を取得
+TxStatus getTxStatus();
+bool isTxBusy();
+const char* txStateName(TxJobState state);
+
+// 受信したフレームを送信側に渡す（ISO-TPのFlow Control待ち用）
+void canTxOnReceive(const twai_message_t& msg);
+
+// CAN送信処理 (8byteずつ送信) (ノーアック・モード対応)
+bool sendCAN(uint32_t id, const uint8_t* data, uint8_t len);
@@ -0,0 +1,55 @@
+#pragma once
+#include <Arduino.h>
+
+// 受信フレームのバイナリキャプチャ (LittleFS)
+// 24byte固定長レコードを /capture/capNNNN.bin に追記し、サイズでローテーションする
+
+const char* const CAPTURE_DIR = "/capture";
+
+// 固定長レコード。各ファイルの先頭はヘッダーレコード (flags に CAPTURE_FLAG_HEADER)
+struct CaptureRecord {
+    uint64_t timestampUs; // esp_timer_get_time() (起動からのµs)
+    uint32_t identifier;
+    uint8_t flags;        // RX_FLAG_* / CAPTURE_FLAG_HEADER
+    uint8_t dlc;
+    uint16_t reserved;
+    uint8_t data[8];      // ヘッダーでは CAPTURE_MAGIC
+};
+static_assert(sizeof(CaptureRecord) == 24, "CaptureRecord must stay 24 bytes");
+
+const uint8_t CAPTURE_FLAG_HEADER = 0x80;
+const uint8_t CAPTURE_MAGIC[8] = {'C', 'A', 'N', 'C', 'A', 'P', 0x01, 0x00}; // 最後の2byteはバージョン
+
+enum CaptureFormat : uint8_t {
+    CAPTURE_FORMAT_BIN = 0, // そのまま
+    CAPTURE_FORMAT_CANDUMP, // Linux can-utils の candump -l 形式
+    CAPTURE_FORMAT_ASC      // Vector ASC 形式
+};
+
+struct CaptureStatus {
+    bool active;
+    uint32_t fileSeq;      // 書き込み中（または最後に書いた）ファイル番号
+    uint32_t fileBytes;    // 書き込み中ファイルのサイズ
+    uint32_t records;      // 今回のキャプチャで書いたレコード数
+    uint32_t rotations;
+    uint32_t ringDrops;    // 書き込みが追いつかず捨てたフレーム数
+};
+
+// ディレクトリ作成と書き込みタスクの生成 (LittleFS.begin() と setupCANRx() の後に呼ぶ)
+void setupCapture();
+
+void captureStart();
+void captureStop();   // 残りを書き出してから閉じる
+CaptureStatus getCaptureStatus();
+
+// ファイル番号からパスを作る
+void captureFilePath(uint32_t seq, char* out, size_t outSize);
+
+// レコード1件をテキスト1行に変換する（ヘッダーレコードは 0 を返す）
+// baseUs は ASC 形式の相対時刻の基準 (ファイルのヘッダー時刻)
+size_t captureFormatRecord(const CaptureRecord& rec, CaptureFormat format, uint64_t baseUs,
+                           char* out, size_t outSize);
+
+// ASC 形式の先頭・末尾
+const char* captureAscHeader();
+const char* captureAscFooter();
@@ -0,0 +1,81 @@
+#pragma once
+#include <Arduino.h>
+#include <utility>
+
+// ファイルを一定サイズのチャンクに区切り、複数IDのCANフレームに割り付ける
+// フレーム k はチャンク内の k 番目のデータ (8byte、連番ありなら7byte) を ids[k % idCount] で送る
+// 連番ありなら各フレームの先頭1byteにチャンク番号 (下位8bit) を入れる
+// チェックサムありならチャンクの後に checksumId で [連番, CRC-8] を送る
+
+const size_t CHUNK_MAX_SIZE = 64;
+const size_t CHUNK_MAX_IDS = 8;
+const size_t CHUNK_MAX_FRAMES = CHUNK_MAX_SIZE / 7 + 2; // 連番ありの最悪値 + チェックサム
+
+struct ChunkLayout {
+    uint8_t chunkSize;               // 1-64
+    uint8_t idCount;                 // 1-8
+    bool seqCounter;
+    bool checksum;
+    uint32_t ids[CHUNK_MAX_IDS];
+    uint32_t checksumId;
+};
+
+// 生成した1フレーム
+struct ChunkFrame {
+    uint32_t id;
+    uint8_t dlc;
+    uint8_t data[8];
+    uint8_t end;                     // このフレームまででチャンクの何byte目まで送ったか
+};
+
+// チャンク1つ分 (len <= chunkSize、最後のチャンクは短い) のフレームを out に作り、フレーム数を返す
+typedef size_t (*ChunkFramerFn)(const ChunkLayout& layout, uint8_t seq,
+                                const uint8_t* chunk, size_t len, ChunkFrame* out);
+
+// レイアウトに合う展開済みの実装を返す。なければ汎用ループ (buildChunkFrames)
+ChunkFramerFn selectChunkFramer(const ChunkLayout& layout);
+
+// 設定ファイルのレイアウトをそのまま解釈する汎用版
+size_t buildChunkFrames(const ChunkLayout& layout, uint8_t seq, const uint8_t* chunk, size_t len, ChunkFrame* out);
+
+// チェックサムフレーム [連番, CRC-8 (SAE J1850)] を作る
+size_t buildChecksumFrame(const ChunkLayout& layout, uint8_t seq, const uint8_t* chunk, size_t len, ChunkFrame* out);
+
+// チャンクサイズ・ID数・オプションをコンパイル時に固定した実装
+// フレームごとの処理を index_sequence で展開し、ループも動的確保もしない
+template <size_t ChunkSize, size_t IdCount, bool SeqCounter, bool Checksum>
+struct ChunkFramer {
+    static_assert(ChunkSize > 0 && ChunkSize <= CHUNK_MAX_SIZE, "ChunkSize out of range");
+    static_assert(IdCount > 0 && IdCount <= CHUNK_MAX_IDS, "IdCount out of range");
+
+    static constexpr size_t PER_FRAME = SeqCounter ? 7 : 8;
+    static constexpr size_t FRAMES = (ChunkSize + PER_FRAME - 1) / PER_FRAME;
+
+    static size_t build(const ChunkLayout& layout, uint8_t seq, const uint8_t* chunk, size_t len, ChunkFrame* out) {
+        return buildAll(layout, seq, chunk, len, out, std::make_index_sequence<FRAMES>());
+    }
+
+private:
+    template <size_t I>
+    static size_t buildFrame(const ChunkLayout& layout, uint8_t seq, const uint8_t* chunk, size_t len, ChunkFrame* out) {
+        constexpr size_t offset = I * PER_FRAME;
+        if (offset >= len) return 0;
+        size_t n = len - offset < PER_FRAME ? len - offset : PER_FRAME;
+        out->id = layout.ids[I % IdCount];
+        uint8_t* p = out->data;
+        if (SeqCounter) *p++ = seq;
+        memcpy(p, chunk + offset, n);
+        out->dlc = n + (SeqCounter ? 1 : 0);
+        out->end = offset + n;
+        return 1;
+    }
+
+    template <size_t... I>
+    static size_t buildAll(const ChunkLayout& layout, uint8_t seq, const uint8_t* chunk, size_t len,
+                           ChunkFrame* out, std::index_sequence<I...>) {
+        size_t count = 0;
+        ((count += buildFrame<I>(layout, seq, chunk, len, out + count)), ...);
+        if (Checksum && count > 0) count += buildChecksumFrame(layout, seq, chunk, len, out + count);
+        return count;
+    }
+};
@@ -0,0 +1,32 @@
+#pragma once
+#include <Arduino.h>
+#include <WebServer.h>
+
+// HTTPレスポンスを chunked で少しずつ送るための書き込み口
+// 固定長のスタック上バッファにためて、いっぱいになったら sendContent する
+// (String の連結でページ全体をヒープに組み立てない)
+class ChunkedResponse {
+public:
+    explicit ChunkedResponse(WebServer& server) : server_(server) {}
+    ~ChunkedResponse() { end(); }
+
+    void begin(int code, const char* contentType);
+    void print(const char* text);
+    void write(const char* data, size_t len);
+    void printf(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+    void flush();
+    void end(); // 残りを送り、終端チャンクを送る
+
+    // 計測用: 送ったバイト数と、送信中に見たヒープ空きの最小値
+    size_t bytesSent() const { return sent_; }
+    uint32_t minFreeHeap() const { return minFreeHeap_; }
+
+private:
+    static const size_t BUF_SIZE = 512;
+    WebServer& server_;
+    char buf_[BUF_SIZE];
+    size_t len_ = 0;
+    size_t sent_ = 0;
+    uint32_t minFreeHeap_ = UINT32_MAX;
+    bool open_ = false;
+};
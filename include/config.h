@@ -0,0 +1,81 @@
+#pragma once
+#include <Arduino.h>
+
+// 設定値 (/config.json の内容を起動時に一度だけ読み、RAM上に保持する)
+// 全項目 uint32_t に揃え、スキーマ表からメンバーポインタで参照する
+struct Config {
+    uint32_t packetGap;        // ms
+    uint32_t chunkInterval;    // ms
+    uint32_t packetGapUs;      // packetGap に加算する µs
+    uint32_t chunkIntervalUs;  // chunkInterval に加算する µs
+    uint32_t busLoadPct;       // 1-100: 目標バス負荷率 (0で無効)
+    uint32_t sendId1;
+    uint32_t sendId2;
+    uint32_t sendId3;
+    uint32_t sendId4;
+    uint32_t sendId5;
+    uint32_t sendId6;
+    uint32_t sendId7;
+    uint32_t sendId8;
+    uint32_t idCount;          // チャンクを割り付けるIDの数 (id1〜)
+    uint32_t chunkSize;        // 1チャンクのbyte数
+    uint32_t seqCounter;       // 各フレームの先頭にチャンク番号を入れる
+    uint32_t chunkChecksum;    // チャンクごとにCRC-8のフレームを追加する
+    uint32_t checksumId;
+    uint32_t transport;        // TxTransport (raw / isotp)
+    uint32_t isotpTxId;
+    uint32_t isotpRxId;
+    uint32_t isotpPayloadSize;
+    uint32_t rateControl;      // 0: 固定間隔, 1: エラーカウンタを見て自動調整
+    uint32_t jobSchedule;      // 0: 1ジョブずつ順に送る, 1: raw方式のジョブを交互に送る
+    uint32_t monitorIdCount;   // 受信チャートに並べるIDの数 (monitorId1〜)
+    uint32_t monitorId1;
+    uint32_t monitorId2;
+    uint32_t monitorId3;
+    uint32_t monitorId4;
+    uint32_t logLevel;         // LogLevel: これより詳細なログは出さない
+    uint32_t logTx;            // カテゴリ別のログ出力 (0: off, 1: on)
+    uint32_t logRx;
+    uint32_t logIsotp;
+};
+
+enum ConfigType : uint8_t {
+    CFG_UINT = 0, // JSONでは数値
+    CFG_HEX,      // JSONでは16進数文字列 ("123")
+    CFG_CHOICE    // JSONでは choices のいずれかの文字列。値はその番号
+};
+
+// スキーマ表の1項目（キー・型・デフォルト・範囲）
+struct ConfigField {
+    const char* key;
+    ConfigType type;
+    uint32_t defaultValue;
+    uint32_t minValue;
+    uint32_t maxValue;
+    uint32_t Config::*member;
+    const char* choices; // CFG_CHOICE: "raw|isotp" のように '|' 区切り
+};
+
+extern Config appConfig;
+
+// 起動時に呼ぶ。ファイルがない・壊れている場合はデフォルトを書き出す
+void loadConfig();
+
+// スキーマで検証済みの設定を一時ファイル経由で置き換え保存し、RAMにも反映する
+bool saveConfig(const Config& c);
+
+// デフォルトに戻して保存
+void resetConfig();
+
+size_t configFieldCount();
+const ConfigField& configField(size_t index);
+const ConfigField* findConfigField(const char* key);
+
+// 文字列（Webフォームの入力）を検証して設定する。範囲外・不正なら false
+bool configSetFromString(Config* c, const ConfigField& field, const char* value);
+
+// フォーム表示用に値を文字列化する
+void configFormatValue(const Config& c, const ConfigField& field, char* out, size_t outSize);
+
+// CFG_CHOICE の index 番目の選択肢を out に取り出す。なければ false
+bool configChoiceName(const ConfigField& field, uint32_t index, char* out, size_t outSize);
@@ -0,0 +1,44 @@
+#pragma once
+#include <Arduino.h>
+#include "esp_timer.h"
+
+// setupCAN() の TWAI_TIMING_CONFIG_500KBITS() と合わせること
+const uint32_t CAN_BITRATE = 500000;
+
+// 標準ID(11bit)データフレームのビット数（スタッフビット最悪値・フレーム間スペース込み）
+uint32_t canFrameBits(uint8_t dlc);
+
+// 1フレームがバスを占有する時間 (µs)
+uint32_t canFrameTimeUs(uint8_t dlc, uint32_t bitrate = CAN_BITRATE);
+
+// 目標バス負荷率(1-100%)から、フレーム送信開始の間隔 (µs) を計算
+uint32_t busLoadIntervalUs(uint8_t dlc, uint8_t loadPct, uint32_t bitrate = CAN_BITRATE);
+
+// esp_timer を使ったµs単位の送信タイミング制御
+// 呼び出し元タスクを esp_timer で起こし、最後の数十µsだけビジーウェイトする
+class FrameScheduler {
+public:
+    // 待ち合わせを行うタスク内で一度だけ呼ぶ
+    bool begin();
+
+    // 次の送信時刻を「今」にリセットする（ジョブ開始・FC受信後など）
+    void reset();
+
+    // 次の送信時刻まで待ち、実際の送信時刻 (µs) を返す
+    int64_t waitForSlot();
+
+    // 直前の送信開始から intervalUs 後を次の送信時刻にする
+    // 遅れていた場合は取り戻そうとせず、今から数える
+    void scheduleNext(int64_t sentAtUs, uint32_t intervalUs);
+
+    // 次の送信時刻を絶対時刻で指定する（リプレイ用）
+    // 過ぎていればすぐに送り、以降のフレームも予定に追いつくまで詰めて送る
+    void scheduleAt(int64_t slotUs);
+
+private:
+    static void onTimer(void* arg);
+
+    esp_timer_handle_t timer = nullptr;
+    TaskHandle_t task = nullptr;
+    int64_t nextSlotUs = 0;
+};
@@ -0,0 +1,47 @@
+#pragma once
+#include <Arduino.h>
+#include "rom/miniz.h"
+#include "prefetch_reader.h"
+
+// gzip で圧縮保存されたファイルを、送信しながら少しずつ展開するリーダー
+// 展開には ROM の tinfl を使い、32KiB の辞書 (リングバッファ) を出力窓として使い回す
+// 使うRAMはファイルサイズによらず一定 (辞書 + 展開器の状態 + 入力バッファ)
+// read() などは PrefetchReader と同じ形で使える
+
+class InflateReader {
+public:
+    explicit InflateReader(PrefetchReader& input) : in_(input) {}
+
+    bool open(const char* path);
+    void close();
+
+    size_t read(uint8_t* out, size_t len);
+
+    bool available() const { return pos_ < size_; }
+    size_t size() const { return size_; }      // 展開後のサイズ (gzip の ISIZE)
+    size_t position() const { return pos_; }
+    size_t compressedSize() const { return compressedSize_; }
+    // 壊れた deflate データ、または末尾の CRC32・サイズの不一致で途中までしか正しく読めなかった
+    bool failed() const { return failed_; }
+
+private:
+    bool skipHeader();
+    bool readInput(uint8_t* out, size_t len);
+    void inflateMore();
+
+    PrefetchReader& in_;
+    tinfl_decompressor* inflator_ = nullptr;
+    uint8_t* dict_ = nullptr;
+    uint8_t inBuf_[512];
+    size_t inLen_ = 0;
+    size_t inPos_ = 0;
+    size_t dictOfs_ = 0;     // 次に展開結果を書く位置
+    size_t pending_ = 0;     // 展開済みでまだ読まれていないbyte数
+    size_t size_ = 0;
+    size_t pos_ = 0;
+    size_t compressedSize_ = 0;
+    uint32_t expectedCrc_ = 0;
+    uint32_t crc_ = 0;
+    bool done_ = false;
+    bool failed_ = false;
+};
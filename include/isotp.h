@@ -0,0 +1,46 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// ISO 15765-2 (ISO-TP) のフレーム組み立て・解析
+// ノーマルアドレッシング、クラシックCAN (8byte) のみ対応
+
+const uint16_t ISOTP_MAX_PAYLOAD = 4095;    // FFの12bit長で表せる最大値
+const uint8_t ISOTP_SF_MAX_DATA = 7;
+const uint8_t ISOTP_FF_DATA = 6;
+const uint8_t ISOTP_CF_MAX_DATA = 7;
+const uint8_t ISOTP_PAD_BYTE = 0xCC;        // 未使用バイトの埋め値
+const uint32_t ISOTP_TIMEOUT_BS_MS = 1000;  // N_Bs: FC待ちタイムアウト
+const uint8_t ISOTP_MAX_WAIT_FRAMES = 10;   // N_WFTmax: 連続WAITの上限
+
+// PCI種別 (1byte目の上位4bit)
+enum IsoTpPciType : uint8_t {
+    ISOTP_PCI_SF = 0x0,
+    ISOTP_PCI_FF = 0x1,
+    ISOTP_PCI_CF = 0x2,
+    ISOTP_PCI_FC = 0x3
+};
+
+enum IsoTpFlowStatus : uint8_t {
+    ISOTP_FC_CTS = 0,
+    ISOTP_FC_WAIT = 1,
+    ISOTP_FC_OVERFLOW = 2
+};
+
+// 受信側から返ってきたFlow Controlの内容
+struct IsoTpFlowControl {
+    IsoTpFlowStatus status;
+    uint8_t blockSize; // 0 なら以降FCなしで全CFを送ってよい
+    uint32_t stMinUs;  // CF間の最小間隔 (µs)
+};
+
+// 各フレームを out[8] に組み立て、DLC(常に8、パディング済み)を返す
+uint8_t isotpBuildSingleFrame(uint8_t* out, const uint8_t* data, uint8_t len);
+uint8_t isotpBuildFirstFrame(uint8_t* out, uint16_t totalLen, const uint8_t* data);
+uint8_t isotpBuildConsecutiveFrame(uint8_t* out, uint8_t sn, const uint8_t* data, uint8_t len);
+
+// Flow Controlフレームを解析する。FCでない・不正な場合は false
+bool isotpParseFlowControl(const uint8_t* data, uint8_t len, IsoTpFlowControl* fc);
+
+// STmin の生値を µs に変換 (予約値は規格どおり 127ms として扱う)
+uint32_t isotpStMinToUs(uint8_t raw);
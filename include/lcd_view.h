@@ -0,0 +1,25 @@
+#pragma once
+#include <Arduino.h>
+
+// M5StickC (USE_LCD) の画面表示
+// 呼び出し側は描画コマンドをキューに積むだけで、SPI には触れない
+// 低優先度の描画タスクがオフスクリーンのスプライトに描き、変更のあった行の帯だけを
+// 1回の転送でパネルへ送る（loop() や CAN の処理が描画を待たない）
+
+static const int LCD_MONITOR_MAX = 4; // 受信チャートに並べられるIDの数
+
+// 起動時に呼ぶ（スプライトの確保と描画タスクの起動）
+void setupLcdView();
+
+// 画面全体を消して左上から文字を出す
+void lcdShowMessage(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+
+// 下半分 (y=40-80) に進捗率・詳細行・プログレスバー (y=barY, 高さ10px) を出す
+void lcdShowProgress(int percent, uint16_t barColor, int barY, const char* fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+// 下半分に色付きで結果を出す
+void lcdShowResult(const char* text, uint16_t color);
+
+// 受信チャートを1コマ進める。received の bit i が ids[i] の受信あり
+void lcdChartStep(const uint32_t* ids, int count, uint32_t received);
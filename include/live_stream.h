@@ -0,0 +1,30 @@
+#pragma once
+#include <Arduino.h>
+#include <WiFi.h>
+#include "can_rx.h"
+
+// 受信フレームのライブ配信 (Server-Sent Events, /live)
+// フレームは1件ずつ送らず、LIVE_BATCH_MS ごとか LIVE_BATCH_FRAMES 件たまったら
+// バイナリレコードをまとめて base64 にし、"frames" イベントとして送る
+// レコード (17byte, リトルエンディアン): u32 時刻µs, u32 ID (bit31=拡張, bit30=RTR), u8 DLC, data[8]
+// LIVE_RATES_MS ごとに ID別の受信レートを "rates" イベント (JSON) で送る
+
+const uint32_t LIVE_BATCH_MS = 100;
+const size_t LIVE_BATCH_FRAMES = 64;
+const uint32_t LIVE_RATES_MS = 1000;
+const size_t LIVE_RECORD_SIZE = 17;
+
+// "123,124,7E0-7EF,ext" のようなID指定を解釈する（16進数、ext は拡張ID全部）
+// 空文字または "*" は全ID (*all = true)。書式が不正なら false
+bool liveParseFilter(const char* spec, RxIdFilter* filter, bool* all);
+
+// 接続中のクライアントを配信先にする（以前のクライアントは切る）
+void liveStreamStart(WiFiClient client, const RxIdFilter* filter);
+
+// 配信中のフィルタを変更する (nullptr で全て)
+void liveStreamSetFilter(const RxIdFilter* filter);
+
+// loop() から呼ぶ。リングから取り出してまとめて送る
+void liveStreamPoll();
+
+bool liveStreamActive();
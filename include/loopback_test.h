@@ -0,0 +1,54 @@
+#pragma once
+#include <Arduino.h>
+#include "driver/twai.h"
+
+// 自己受信による送信経路の試験 (/selftest)
+// 通常の送信ジョブと同じフレーム生成・送信タスクを通し、各フレームを self=1 で送る
+// (NO_ACK モードなので、自分が送ったフレームを自分で受信できる)
+// 受信タスクで送った順に照合し、twai_transmit に渡してから受信するまでの遅延・欠落・実効フレームレートを出す
+
+static const uint32_t LOOPBACK_BUCKETS_US[] = {50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000};
+static const size_t LOOPBACK_BUCKET_COUNT = sizeof(LOOPBACK_BUCKETS_US) / sizeof(LOOPBACK_BUCKETS_US[0]);
+
+enum LoopbackState : uint8_t {
+    LOOPBACK_IDLE = 0,
+    LOOPBACK_RUNNING,
+    LOOPBACK_DONE
+};
+
+struct LoopbackResult {
+    uint32_t jobId;
+    LoopbackState state;
+    uint32_t framesSent;     // twai_transmit に渡したフレーム数
+    uint32_t framesReceived; // 自己受信で照合できたフレーム数
+    uint32_t framesLost;     // 送れたのに受信できなかったフレーム数
+    uint32_t txFailed;       // twai_transmit が失敗したフレーム数
+    uint32_t unmatched;      // 送った覚えのない受信フレーム数（他のノードから等）
+    uint32_t latencyMinUs;
+    uint32_t latencyMaxUs;
+    uint32_t latencyAvgUs;
+    uint32_t framesPerSec;   // 最初の送信から最後の受信までの実効レート
+    uint32_t buckets[LOOPBACK_BUCKET_COUNT + 1]; // 遅延の分布（最後は上限超え）
+};
+
+// 試験ジョブを投入する直前に呼ぶ（前回の結果を消して計測を始める）
+// 読み込みタスクの方が優先度が高く、投入した直後に送り始めることがあるため
+void loopbackBegin();
+
+// ジョブを投入できなかった・送り始める前に取り消したときに呼ぶ
+void loopbackAbort();
+
+// 送信タスク: ジョブの開始・終端を処理したとき、twai_transmit の直前と失敗したとき
+void loopbackJobStarted(uint32_t jobId);
+void loopbackJobEnded();
+void loopbackOnTransmit(const twai_message_t& msg, int64_t enqueueUs);
+void loopbackOnTransmitFailed();
+
+// 受信タスク: 受信したフレームごとに呼ぶ
+void loopbackOnReceive(const twai_message_t& msg, int64_t rxUs);
+
+// loop() から呼ぶ。ジョブ終了後、遅れて届くフレームを待ってから集計を確定しシリアルへ出す
+void loopbackPoll();
+
+bool loopbackActive();
+LoopbackResult loopbackResult();
@@ -0,0 +1,22 @@
+#pragma once
+#include <Arduino.h>
+#include "chunked_response.h"
+
+// 稼働状況のカウンター (/metrics で Prometheus のテキスト形式で出す)
+// 更新側はどのタスクから呼んでもよい（ロックを取らずアトミックに加算する）
+
+// ID別に数える送信IDの数。あふれたIDは id="other" にまとめる
+const size_t METRICS_TX_ID_SLOTS = 16;
+
+// 送信1フレームの結果 (transmitMessage から呼ぶ)
+void metricsCountTx(uint32_t id, bool ok);
+
+// アップロードの受信バイト数と、直近のスループット
+void metricsAddUploadBytes(uint32_t bytes);
+void metricsSetUploadRate(uint32_t kbPerSec);
+
+// loop() 1回分の処理時間
+void metricsObserveLoopUs(uint32_t us);
+
+// すべての値をテキスト形式で書き出す
+void metricsWrite(ChunkedResponse& out);
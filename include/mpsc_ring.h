@@ -0,0 +1,59 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+
+// 複数生産者・単一消費者のロックフリーリングバッファ（セルごとの連番で空き/使用中を判定）
+// push() はどのタスクから呼んでもよい。pop() は消費者タスクだけが呼ぶこと
+template <typename T, uint32_t N>
+class MpscRing {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "N must be a power of two");
+
+public:
+    MpscRing() {
+        for (uint32_t i = 0; i < N; i++) cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    // 満杯なら捨てて false を返す（生産者を止めない）
+    bool push(const T& item) {
+        uint32_t pos = head_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells_[pos & (N - 1)];
+            int32_t diff = (int32_t)(cell.seq.load(std::memory_order_acquire) - pos);
+            if (diff == 0) {
+                // このセルを取れたら書き込む（取れなければ pos が更新されるのでやり直し）
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.item = item;
+                    cell.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool pop(T* out) {
+        Cell& cell = cells_[tail_ & (N - 1)];
+        if ((int32_t)(cell.seq.load(std::memory_order_acquire) - (tail_ + 1)) < 0) return false;
+        *out = cell.item;
+        cell.seq.store(tail_ + N, std::memory_order_release);
+        tail_++;
+        return true;
+    }
+
+    uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+    static constexpr uint32_t capacity() { return N; }
+
+private:
+    struct Cell {
+        std::atomic<uint32_t> seq;
+        T item;
+    };
+    Cell cells_[N];
+    std::atomic<uint32_t> head_{0};
+    uint32_t tail_ = 0;
+    std::atomic<uint32_t> dropped_{0};
+};
@@ -0,0 +1,58 @@
+#pragma once
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+// 送信ファイルの先読みリーダー
+// 収まるならファイル全体を RAM (PSRAM があればそちら) に読み込み、
+// 収まらなければ 4KiB ×2 (交互送信で追加するリーダーは 1KiB ×2) のダブルバッファを先読みタスクが交互に埋める
+// read() はメモリからコピーするだけで、フレームごとのファイルシステム呼び出しをなくす
+// (ブロック読み込み待ちがフレームの送信間隔に入らないようにする)
+
+const size_t PREFETCH_BLOCK_SIZE = 4096;
+const size_t PREFETCH_SMALL_BLOCK_SIZE = 1024;    // 交互送信で同時に開くリーダー用 (1KiB ×2)
+const size_t PREFETCH_RAM_MAX = 64 * 1024;        // 内部RAMに丸ごと載せる上限
+const size_t PREFETCH_HEAP_RESERVE = 48 * 1024;   // 丸ごと載せた後も残しておくヒープ
+
+class PrefetchReader {
+public:
+    explicit PrefetchReader(size_t blockSize = PREFETCH_BLOCK_SIZE) : blockSize_(blockSize) {}
+
+    // 先読みタスク・キュー・ダブルバッファの確保（open() が必要なときに呼ぶ。確保したものは解放しない）
+    bool begin();
+
+    bool open(const char* path);
+    void close();
+
+    // 先読み済みのデータからコピーする。次のブロックが未読なら読み終わるまで待つ
+    size_t read(uint8_t* out, size_t len);
+
+    bool available() const { return pos_ < size_; }
+    size_t size() const { return size_; }
+    size_t position() const { return pos_; }
+    bool inMemory() const { return image_ != nullptr; }
+
+private:
+    static void fillTask(void* arg);
+    bool requestBlock(uint8_t index);
+
+    File file_;
+    size_t size_ = 0;
+    size_t pos_ = 0;
+
+    // 全体読み込み
+    uint8_t* image_ = nullptr;
+
+    // ダブルバッファ（空きと読み込み済みの番号をキューで受け渡す）
+    size_t blockSize_;
+    bool started_ = false;
+    uint8_t* blocks_[2] = {nullptr, nullptr};
+    size_t blockLen_[2] = {0, 0};
+    QueueHandle_t emptyQueue_ = nullptr;
+    QueueHandle_t fullQueue_ = nullptr;
+    size_t requested_ = 0;      // 先読みを依頼したbyte数
+    uint8_t outstanding_ = 0;   // 先読みタスクが持っているバッファ数
+    int8_t current_ = -1;       // 読み出し中のバッファ
+    size_t currentPos_ = 0;
+};
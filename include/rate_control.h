@@ -0,0 +1,49 @@
+#pragma once
+#include <Arduino.h>
+#include "driver/twai.h"
+
+// TWAI のエラーカウンタと送信キューの溜まり具合から送信間隔を自動調整する
+// 異常の兆候があれば間隔を倍にし、正常が続けば少しずつ詰める (AIMD)
+
+const uint32_t RATE_MAX_GAP_US = 100000;     // これ以上は広げない
+const uint16_t RATE_HEALTHY_FRAMES = 16;     // これだけ正常が続いたら詰める
+const uint32_t RATE_TX_QUEUE_HIGH = 12;      // ドライバ送信キュー (tx_queue_len=16) の上限目安
+const uint32_t RATE_TEC_WARNING = 96;        // TWAI のエラーワーニング閾値
+const uint8_t RATE_MAX_RETRIES = 3;          // 送信失敗時に同じフレームを送り直す回数
+const uint32_t BUS_OFF_RECOVERY_TIMEOUT_MS = 1000;
+
+enum TxBusHealth : uint8_t {
+    BUS_HEALTHY = 0,
+    BUS_STRESSED, // エラーカウンタ上昇・送信キュー滞留・送信失敗
+    BUS_OFF
+};
+
+class TxRateController {
+public:
+    // ジョブ開始時に呼ぶ。startGapUs は設定値から求めた初期間隔
+    void reset(uint32_t startGapUs);
+
+    // 1フレーム送信するたびに呼ぶ。バスの状態を読み、間隔を調整する
+    TxBusHealth sample(bool sent);
+
+    // 次のフレームまでの間隔 (そのフレームのバス占有時間より短くはしない)
+    uint32_t gapUs(uint8_t dlc) const;
+
+    uint32_t currentGapUs() const { return gap_; }
+
+    // 直前の sample() 時点でドライバの送信キューに残っていたフレーム数
+    // バスオフ復帰時にはこの分が捨てられる
+    uint32_t unsentFrames() const { return unsent_; }
+
+private:
+    void backOff();
+
+    uint32_t gap_ = 0;
+    uint32_t lastTec_ = 0;
+    uint32_t lastArbLost_ = 0;
+    uint32_t unsent_ = 0;
+    uint16_t healthyRun_ = 0;
+};
+
+// バスオフから復帰させて送信を再開する。復帰できなければ false
+bool twaiRecoverBusOff();
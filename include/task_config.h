@@ -0,0 +1,71 @@
+#pragma once
+
+// タスクの配置（コア・優先度・スタックサイズ）
+// platformio.ini の build_flags で -DCAN_CORE=0 のように上書きできる
+//
+// コア0: Wi-Fi / HTTP (loop) / LittleFS の読み書き
+// コア1: CAN の送信・受信とタイミング制御
+// loop() をコア0に置くため、platformio.ini で -DARDUINO_RUNNING_CORE=0 を指定している
+
+#ifndef NET_CORE
+#define NET_CORE 0
+#endif
+#ifndef CAN_CORE
+#define CAN_CORE 1
+#endif
+
+// CAN受信（取りこぼし防止のため最優先）
+#ifndef CAN_RX_TASK_PRIORITY
+#define CAN_RX_TASK_PRIORITY 6
+#endif
+#ifndef CAN_RX_TASK_STACK
+#define CAN_RX_TASK_STACK 4096
+#endif
+
+// CAN送信（フレームキューから twai_transmit へ）
+#ifndef CAN_TX_TASK_PRIORITY
+#define CAN_TX_TASK_PRIORITY 5
+#endif
+#ifndef CAN_TX_TASK_STACK
+#define CAN_TX_TASK_STACK 4096
+#endif
+
+// 送信ファイルの読み込み（フレームキューへ積む）
+#ifndef TX_READER_TASK_PRIORITY
+#define TX_READER_TASK_PRIORITY 3
+#endif
+#ifndef TX_READER_TASK_STACK
+#define TX_READER_TASK_STACK 4096
+#endif
+
+// 送信ファイルの先読み（読み込みタスクより上）
+#ifndef PREFETCH_TASK_PRIORITY
+#define PREFETCH_TASK_PRIORITY 4
+#endif
+#ifndef PREFETCH_TASK_STACK
+#define PREFETCH_TASK_STACK 3072
+#endif
+
+// 受信キャプチャの書き込み
+#ifndef CAPTURE_TASK_PRIORITY
+#define CAPTURE_TASK_PRIORITY 2
+#endif
+#ifndef CAPTURE_TASK_STACK
+#define CAPTURE_TASK_STACK 4096
+#endif
+
+// 非同期ログの書き出し（Serial 待ちで他を止めないよう最低優先度）
+#ifndef LOG_TASK_PRIORITY
+#define LOG_TASK_PRIORITY 1
+#endif
+#ifndef LOG_TASK_STACK
+#define LOG_TASK_STACK 3072
+#endif
+
+// LCDの描画と転送（受信・送信の処理を待たせないよう最低優先度）
+#ifndef LCD_TASK_PRIORITY
+#define LCD_TASK_PRIORITY 1
+#endif
+#ifndef LCD_TASK_STACK
+#define LCD_TASK_STACK 3072
+#endif
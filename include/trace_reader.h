@@ -0,0 +1,45 @@
+#pragma once
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "driver/twai.h"
+
+// 記録済みトレースの逐次読み出し（RAMに全体を読み込まない）
+// 対応形式: capture_log のバイナリレコード / candump -l のテキストログ
+enum TraceFormat : uint8_t {
+    TRACE_FORMAT_UNKNOWN = 0,
+    TRACE_FORMAT_CAPTURE, // 先頭がヘッダーレコード
+    TRACE_FORMAT_CANDUMP  // "(秒.µs) can0 123#1122..."
+};
+
+class TraceReader {
+public:
+    bool open(const char* path);
+    void close();
+
+    // 先頭に戻る（ループ再生用）
+    void rewind();
+
+    // 次のフレームを読む。終端なら false
+    bool next(twai_message_t* msg, uint64_t* timestampUs);
+
+    TraceFormat format() const { return format_; }
+    size_t size() const { return size_; }
+    size_t position() const { return consumed_; }
+
+private:
+    bool fill();
+    bool readLine(char* line, size_t lineSize);
+    bool nextCapture(twai_message_t* msg, uint64_t* timestampUs);
+    bool nextCandump(twai_message_t* msg, uint64_t* timestampUs);
+
+    File file_;
+    TraceFormat format_ = TRACE_FORMAT_UNKNOWN;
+    size_t size_ = 0;
+    size_t consumed_ = 0;  // 解析済みのbyte数
+    uint8_t buf_[512];     // ブロック単位で読んで行/レコードを切り出す
+    size_t bufLen_ = 0;
+    size_t bufPos_ = 0;
+};
+
+// candump -l の1行を解析する。コメント・不正行は false
+bool parseCandumpLine(const char* line, twai_message_t* msg, uint64_t* timestampUs);
@@ -0,0 +1,56 @@
+#pragma once
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "mbedtls/sha256.h"
+
+// アップロードされたファイルの書き込み口
+// ファイルはアップロード中ずっと開いたままにし、ブロック単位にまとめて書く
+// 受信しながら CRC32 と SHA-256 (ESP32のハードウェアSHA) を計算し、
+// 完了時に <path>.sum へ保存する（送信前に画面で確認できるように）
+
+const size_t UPLOAD_PATH_MAX = 48; // /payloads/ + 名前32文字まで
+
+struct UploadDigest {
+    uint32_t size;
+    uint32_t crc32;
+    uint8_t sha256[32];
+};
+
+class UploadWriter {
+public:
+    bool begin(const char* path);
+    bool write(const uint8_t* data, size_t len);
+    bool finish(UploadDigest* digest); // 残りを書き出して閉じ、ダイジェストを保存する
+    void abort();                      // 途中のファイルを消す
+
+    bool active() const { return active_; }
+    uint32_t bytesReceived() const { return received_; }
+    uint32_t kbPerSec() const;         // 開始からの平均スループット
+
+private:
+    bool flushBlock();
+
+    static const size_t BLOCK_SIZE = 4096; // LittleFS のブロックサイズ
+    File file_;
+    char path_[UPLOAD_PATH_MAX];
+    uint8_t buf_[BLOCK_SIZE];
+    size_t len_ = 0;
+    uint32_t received_ = 0;
+    uint32_t crc_ = 0;
+    int64_t startUs_ = 0;
+    bool active_ = false;
+    bool failed_ = false;
+    mbedtls_sha256_context sha_;
+};
+
+// finish() で保存したダイジェストを読む。なければ false
+bool loadUploadDigest(const char* path, UploadDigest* digest);
+
+// ダイジェストを <path>.sum に保存する
+bool saveUploadDigest(const char* path, const UploadDigest& digest);
+
+// 保存済みのファイルを読み直してダイジェストを計算する（ブロック単位のアップロードの確定用）
+bool computeFileDigest(const char* path, UploadDigest* digest);
+
+// SHA-256 を16進数文字列にする (out は65byte以上)
+void formatSha256(const UploadDigest& digest, char* out, size_t outSize);
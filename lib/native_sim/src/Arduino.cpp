@@ -0,0 +1,325 @@
+#include "Arduino.h"
+#include "native_sim.h"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <new>
+#include <thread>
+#include <ctype.h>
+#include <unistd.h>
+
+using SimClock = std::chrono::steady_clock;
+SimClock::time_point nativeSimEpoch();
+
+HardwareSerial Serial;
+EspClass ESP;
+
+// --- ヒープ計測: operator new / delete を置き換えて使用量とピークを数える ---
+// malloc() を直接呼ぶ領域 (PrefetchReader / InflateReader のバッファ) は数えない
+
+static std::atomic<size_t> heapUsed(0);
+static std::atomic<size_t> heapPeak(0);
+static const size_t HEAP_HEADER = alignof(std::max_align_t); // 先頭にサイズを置き、整列を保つ
+
+static void* trackedAlloc(size_t size) {
+    void* p = malloc(size + HEAP_HEADER);
+    if (!p) return nullptr;
+    *(size_t*)p = size;
+    size_t used = heapUsed.fetch_add(size, std::memory_order_relaxed) + size;
+    size_t peak = heapPeak.load(std::memory_order_relaxed);
+    while (used > peak && !heapPeak.compare_exchange_weak(peak, used, std::memory_order_relaxed)) {
+    }
+    return (uint8_t*)p + HEAP_HEADER;
+}
+
+static void trackedFree(void* ptr) {
+    if (!ptr) return;
+    void* p = (uint8_t*)ptr - HEAP_HEADER;
+    heapUsed.fetch_sub(*(size_t*)p, std::memory_order_relaxed);
+    free(p);
+}
+
+void* operator new(size_t size) {
+    void* p = trackedAlloc(size);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return trackedAlloc(size);
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return trackedAlloc(size);
+}
+void operator delete(void* ptr) noexcept {
+    trackedFree(ptr);
+}
+void operator delete[](void* ptr) noexcept {
+    trackedFree(ptr);
+}
+void operator delete(void* ptr, size_t) noexcept {
+    trackedFree(ptr);
+}
+void operator delete[](void* ptr, size_t) noexcept {
+    trackedFree(ptr);
+}
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    trackedFree(ptr);
+}
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    trackedFree(ptr);
+}
+
+size_t nativeSimHeapUsed() {
+    return heapUsed.load(std::memory_order_relaxed);
+}
+
+size_t nativeSimHeapPeak() {
+    return heapPeak.load(std::memory_order_relaxed);
+}
+
+void nativeSimResetHeapPeak() {
+    heapPeak.store(heapUsed.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+size_t nativeSimFreeHeap() {
+    size_t used = nativeSimHeapUsed();
+    return used < NATIVE_SIM_HEAP_SIZE ? NATIVE_SIM_HEAP_SIZE - used : 0;
+}
+
+size_t nativeSimMinFreeHeap() {
+    size_t peak = nativeSimHeapPeak();
+    return peak < NATIVE_SIM_HEAP_SIZE ? NATIVE_SIM_HEAP_SIZE - peak : 0;
+}
+
+uint32_t EspClass::getHeapSize() {
+    return NATIVE_SIM_HEAP_SIZE;
+}
+
+uint32_t EspClass::getFreeHeap() {
+    return nativeSimFreeHeap();
+}
+
+uint32_t EspClass::getMinFreeHeap() {
+    return nativeSimMinFreeHeap();
+}
+
+uint32_t EspClass::getMaxAllocHeap() {
+    return nativeSimFreeHeap();
+}
+
+void EspClass::restart() {
+    fflush(stdout);
+    _exit(0);
+}
+
+bool psramFound() {
+    return false;
+}
+
+void* ps_malloc(size_t) {
+    return nullptr;
+}
+
+// --- 時間 ---
+
+unsigned long millis() {
+    return (unsigned long)(esp_timer_get_time() / 1000);
+}
+
+unsigned long micros() {
+    return (unsigned long)esp_timer_get_time();
+}
+
+void delay(uint32_t ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(uint32_t us) {
+    int64_t end = esp_timer_get_time() + us;
+    while (esp_timer_get_time() < end) {
+    }
+}
+
+void yield() {
+    std::this_thread::yield();
+}
+
+long random(long howBig) {
+    return howBig > 0 ? rand() % howBig : 0;
+}
+
+long random(long howSmall, long howBig) {
+    return howBig > howSmall ? howSmall + random(howBig - howSmall) : howSmall;
+}
+
+void randomSeed(unsigned long seed) {
+    srand((unsigned)seed);
+}
+
+#ifdef NATIVE_SIM_NEEDS_STRLCPY
+size_t strlcpy(char* dst, const char* src, size_t size) {
+    size_t len = strlen(src);
+    if (size > 0) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+
+size_t strlcat(char* dst, const char* src, size_t size) {
+    size_t dlen = strnlen(dst, size);
+    if (dlen == size) return size + strlen(src);
+    return dlen + strlcpy(dst + dlen, src, size - dlen);
+}
+#endif
+
+// --- String ---
+
+static std::string formatInteger(unsigned long long v, bool negative, unsigned char base) {
+    if (base < 2 || base > 36) base = 10;
+    char buf[72];
+    char* p = buf + sizeof(buf);
+    *--p = '\0';
+    do {
+        unsigned digit = (unsigned)(v % base);
+        *--p = (char)(digit < 10 ? '0' + digit : 'a' + digit - 10);
+        v /= base;
+    } while (v);
+    if (negative) *--p = '-';
+    return p;
+}
+
+static std::string formatSigned(long long v, unsigned char base) {
+    // Arduino と同じく、10進以外では負の数を2の補数のまま出す
+    if (base != 10) return formatInteger((unsigned long long)(unsigned long)v, false, base);
+    return formatInteger(v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v, v < 0, base);
+}
+
+String::String(unsigned char v, unsigned char base) : s_(formatInteger(v, false, base)) {}
+String::String(int v, unsigned char base) : s_(base == 10 ? formatSigned(v, base) : formatInteger((unsigned int)v, false, base)) {}
+String::String(unsigned int v, unsigned char base) : s_(formatInteger(v, false, base)) {}
+String::String(long v, unsigned char base) : s_(formatSigned(v, base)) {}
+String::String(unsigned long v, unsigned char base) : s_(formatInteger(v, false, base)) {}
+String::String(long long v, unsigned char base) : s_(formatSigned(v, base)) {}
+String::String(unsigned long long v, unsigned char base) : s_(formatInteger(v, false, base)) {}
+
+String::String(float v, unsigned int decimals) : String((double)v, decimals) {}
+
+String::String(double v, unsigned int decimals) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", (int)decimals, v);
+    s_ = buf;
+}
+
+bool String::equalsIgnoreCase(const String& s) const {
+    if (s_.size() != s.s_.size()) return false;
+    for (size_t i = 0; i < s_.size(); i++) {
+        if (tolower((unsigned char)s_[i]) != tolower((unsigned char)s.s_[i])) return false;
+    }
+    return true;
+}
+
+String String::substring(unsigned int from, unsigned int to) const {
+    if (from > to) std::swap(from, to);
+    if (from >= s_.size()) return String();
+    if (to > s_.size()) to = s_.size();
+    return String(s_.substr(from, to - from));
+}
+
+void String::replace(const String& from, const String& to) {
+    if (from.s_.empty()) return;
+    size_t pos = 0;
+    while ((pos = s_.find(from.s_, pos)) != std::string::npos) {
+        s_.replace(pos, from.s_.size(), to.s_);
+        pos += to.s_.size();
+    }
+}
+
+void String::toLowerCase() {
+    for (char& c : s_) c = (char)tolower((unsigned char)c);
+}
+
+void String::toUpperCase() {
+    for (char& c : s_) c = (char)toupper((unsigned char)c);
+}
+
+void String::trim() {
+    size_t begin = 0;
+    while (begin < s_.size() && isspace((unsigned char)s_[begin])) begin++;
+    size_t end = s_.size();
+    while (end > begin && isspace((unsigned char)s_[end - 1])) end--;
+    s_ = s_.substr(begin, end - begin);
+}
+
+// --- Print / Stream ---
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (n < size && write(buffer[n])) n++;
+    return n;
+}
+
+size_t Print::printf(const char* format, ...) {
+    char stackBuf[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(stackBuf, sizeof(stackBuf), format, args);
+    va_end(args);
+    if (len < 0) return 0;
+    if ((size_t)len < sizeof(stackBuf)) return write((const uint8_t*)stackBuf, len);
+
+    std::string buf(len + 1, '\0');
+    va_start(args, format);
+    vsnprintf(&buf[0], buf.size(), format, args);
+    va_end(args);
+    return write((const uint8_t*)buf.data(), len);
+}
+
+size_t Stream::readBytes(char* buffer, size_t length) {
+    size_t n = 0;
+    while (n < length) {
+        int c = read();
+        if (c < 0) break;
+        buffer[n++] = (char)c;
+    }
+    return n;
+}
+
+String Stream::readString() {
+    String s;
+    char buf[256];
+    size_t n;
+    while ((n = readBytes(buf, sizeof(buf))) > 0) s.concat(buf, n);
+    return s;
+}
+
+String Stream::readStringUntil(char terminator) {
+    String s;
+    int c;
+    while ((c = read()) >= 0 && c != terminator) s.concat((char)c);
+    return s;
+}
+
+static std::atomic<bool> serialEnabled(true);
+
+void nativeSimSetSerialEnabled(bool enabled) {
+    serialEnabled.store(enabled);
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+    if (serialEnabled.load(std::memory_order_relaxed)) fputc(c, stdout);
+    return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+    if (serialEnabled.load(std::memory_order_relaxed)) fwrite(buffer, 1, size, stdout);
+    return size;
+}
+
+void HardwareSerial::flush() {
+    fflush(stdout);
+}
@@ -0,0 +1,220 @@
+#pragma once
+// native 環境用の Arduino (ESP32) コア代替
+// ファームウェアが使う範囲の API を、ホストの標準ライブラリとスレッドで実装している
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <time.h>
+#include <string>
+#include <algorithm>
+#include <type_traits>
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define PROGMEM
+#define PGM_P const char*
+#define PSTR(s) (s)
+#define IRAM_ATTR
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define strlen_P strlen
+#define memcpy_P memcpy
+#define strcpy_P strcpy
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+
+using std::min;
+using std::max;
+template <class T, class L, class H>
+auto constrain(T x, L lo, H hi) -> typename std::decay<decltype(x < lo ? lo : (x > hi ? hi : x))>::type {
+    return x < lo ? lo : (x > hi ? hi : x);
+}
+
+#ifndef __GLIBC__
+#define NATIVE_SIM_NEEDS_STRLCPY
+#elif !__GLIBC_PREREQ(2, 38)
+#define NATIVE_SIM_NEEDS_STRLCPY
+#endif
+#ifdef NATIVE_SIM_NEEDS_STRLCPY
+size_t strlcpy(char* dst, const char* src, size_t size);
+size_t strlcat(char* dst, const char* src, size_t size);
+#endif
+
+// --- String (Arduino の WString 互換。中身は std::string) ---
+class String {
+public:
+    String() {}
+    String(const char* s) : s_(s ? s : "") {}
+    String(const char* s, unsigned len) : s_(s ? s : "", s ? len : 0) {}
+    String(const __FlashStringHelper* s) : String(reinterpret_cast<const char*>(s)) {}
+    String(const std::string& s) : s_(s) {}
+    explicit String(char c) : s_(1, c) {}
+    explicit String(unsigned char v, unsigned char base = 10);
+    explicit String(int v, unsigned char base = 10);
+    explicit String(unsigned int v, unsigned char base = 10);
+    explicit String(long v, unsigned char base = 10);
+    explicit String(unsigned long v, unsigned char base = 10);
+    explicit String(long long v, unsigned char base = 10);
+    explicit String(unsigned long long v, unsigned char base = 10);
+    explicit String(float v, unsigned int decimals = 2);
+    explicit String(double v, unsigned int decimals = 2);
+
+    const char* c_str() const { return s_.c_str(); }
+    unsigned int length() const { return (unsigned int)s_.size(); }
+    bool isEmpty() const { return s_.empty(); }
+    bool reserve(unsigned int size) { s_.reserve(size); return true; }
+    char charAt(unsigned int i) const { return i < s_.size() ? s_[i] : 0; }
+    char operator[](unsigned int i) const { return charAt(i); }
+    char& operator[](unsigned int i) { return s_[i]; }
+    void setCharAt(unsigned int i, char c) { if (i < s_.size()) s_[i] = c; }
+
+    bool concat(const String& s) { s_ += s.s_; return true; }
+    bool concat(const char* s) { if (!s) return false; s_ += s; return true; }
+    bool concat(const char* s, unsigned int len) { if (!s) return false; s_.append(s, len); return true; }
+    bool concat(char c) { s_ += c; return true; }
+    bool concat(int v) { return concat(String(v)); }
+    bool concat(unsigned int v) { return concat(String(v)); }
+    bool concat(long v) { return concat(String(v)); }
+    bool concat(unsigned long v) { return concat(String(v)); }
+    bool concat(double v) { return concat(String(v)); }
+    template <class T> String& operator+=(const T& v) { concat(v); return *this; }
+
+    int compareTo(const String& s) const { return s_.compare(s.s_); }
+    bool equals(const String& s) const { return s_ == s.s_; }
+    bool equals(const char* s) const { return s_ == (s ? s : ""); }
+    bool equalsIgnoreCase(const String& s) const;
+    bool operator==(const String& s) const { return equals(s); }
+    bool operator==(const char* s) const { return equals(s); }
+    bool operator!=(const String& s) const { return !equals(s); }
+    bool operator!=(const char* s) const { return !equals(s); }
+    bool operator<(const String& s) const { return s_ < s.s_; }
+    bool startsWith(const String& prefix) const { return s_.compare(0, prefix.s_.size(), prefix.s_) == 0; }
+    bool endsWith(const String& suffix) const {
+        return s_.size() >= suffix.s_.size() && s_.compare(s_.size() - suffix.s_.size(), suffix.s_.size(), suffix.s_) == 0;
+    }
+
+    int indexOf(char c, unsigned int from = 0) const { return find(s_.find(c, from)); }
+    int indexOf(const String& s, unsigned int from = 0) const { return find(s_.find(s.s_, from)); }
+    int lastIndexOf(char c) const { return find(s_.rfind(c)); }
+    int lastIndexOf(const String& s) const { return find(s_.rfind(s.s_)); }
+    String substring(unsigned int from) const { return from < s_.size() ? String(s_.substr(from)) : String(); }
+    String substring(unsigned int from, unsigned int to) const;
+
+    void replace(char from, char to) { std::replace(s_.begin(), s_.end(), from, to); }
+    void replace(const String& from, const String& to);
+    void remove(unsigned int index) { if (index < s_.size()) s_.erase(index); }
+    void remove(unsigned int index, unsigned int count) { if (index < s_.size()) s_.erase(index, count); }
+    void toLowerCase();
+    void toUpperCase();
+    void trim();
+
+    long toInt() const { return atol(s_.c_str()); }
+    float toFloat() const { return (float)atof(s_.c_str()); }
+    double toDouble() const { return atof(s_.c_str()); }
+
+private:
+    static int find(size_t pos) { return pos == std::string::npos ? -1 : (int)pos; }
+    std::string s_;
+};
+
+inline String operator+(const String& a, const String& b) { String r(a); r.concat(b); return r; }
+inline String operator+(const String& a, const char* b) { String r(a); r.concat(b); return r; }
+inline String operator+(const char* a, const String& b) { String r(a); r.concat(b); return r; }
+inline String operator+(const String& a, char b) { String r(a); r.concat(b); return r; }
+
+// --- Print / Stream ---
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size);
+    size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+    size_t write(const char* str) { return str ? write((const uint8_t*)str, strlen(str)) : 0; }
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() {}
+
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+    size_t print(const String& s) { return write(s.c_str(), s.length()); }
+    size_t print(const char* s) { return write(s); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int v, int base = 10) { return print(String(v, (unsigned char)base)); }
+    size_t print(unsigned int v, int base = 10) { return print(String(v, (unsigned char)base)); }
+    size_t print(long v, int base = 10) { return print(String(v, (unsigned char)base)); }
+    size_t print(unsigned long v, int base = 10) { return print(String(v, (unsigned char)base)); }
+    size_t print(double v, int digits = 2) { return print(String(v, (unsigned int)digits)); }
+    size_t print(const __FlashStringHelper* s) { return print(reinterpret_cast<const char*>(s)); }
+    size_t println() { return write("\r\n"); }
+    template <class T> size_t println(const T& v) { size_t n = print(v); return n + println(); }
+    template <class T> size_t println(const T& v, int base) { size_t n = print(v, base); return n + println(); }
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    void setTimeout(unsigned long timeoutMs) { timeoutMs_ = timeoutMs; }
+    virtual size_t readBytes(char* buffer, size_t length);
+    size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*)buffer, length); }
+    String readString();
+    String readStringUntil(char terminator);
+
+protected:
+    unsigned long timeoutMs_ = 1000;
+};
+
+// 標準出力へ書く。nativeSimSetSerialEnabled(false) の間は捨てる
+class HardwareSerial : public Stream {
+public:
+    void begin(unsigned long) {}
+    void end() {}
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    int availableForWrite() override { return 128; }
+    void flush() override;
+    operator bool() const { return true; }
+};
+extern HardwareSerial Serial;
+
+// --- 時間・その他 ---
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+long random(long howBig);
+long random(long howSmall, long howBig);
+void randomSeed(unsigned long seed);
+
+// ESP.getFreeHeap() などは native_sim.h のヒープ計測から返す
+class EspClass {
+public:
+    uint32_t getHeapSize();
+    uint32_t getFreeHeap();
+    uint32_t getMinFreeHeap();
+    uint32_t getMaxAllocHeap();
+    uint32_t getPsramSize() { return 0; }
+    uint32_t getFreePsram() { return 0; }
+    uint32_t getCpuFreqMHz() { return 240; }
+    void restart();
+};
+extern EspClass ESP;
+
+bool psramFound();
+void* ps_malloc(size_t size);
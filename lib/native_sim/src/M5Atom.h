@@ -0,0 +1,26 @@
+#pragma once
+// native 環境用の M5Atom 代替（LED とボタンは何もしない）
+#include "Arduino.h"
+
+class Button {
+public:
+    bool wasPressed() { return false; }
+    bool isPressed() { return false; }
+};
+
+class LED_Display {
+public:
+    void drawpix(uint8_t, uint32_t) {}
+    void clear() {}
+};
+
+class M5Atom {
+public:
+    void begin(bool serialEnable = true, bool i2cEnable = true, bool displayEnable = false);
+    void update() {}
+
+    Button Btn;
+    LED_Display dis;
+};
+
+extern M5Atom M5;
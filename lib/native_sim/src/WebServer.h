@@ -0,0 +1,129 @@
+#pragma once
+// native 環境用の WebServer 代替
+// ソケットは開かず、テストから sim* 関数でリクエストを流して登録済みのハンドラを呼ぶ
+#include <functional>
+#include <vector>
+#include "Arduino.h"
+#include "FS.h"
+#include "WiFi.h"
+
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_HEAD, HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE, HTTP_OPTIONS };
+enum HTTPUploadStatus { UPLOAD_FILE_START, UPLOAD_FILE_WRITE, UPLOAD_FILE_END, UPLOAD_FILE_ABORTED };
+
+#define HTTP_UPLOAD_BUFLEN 1436
+#define CONTENT_LENGTH_UNKNOWN ((size_t)-1)
+#define CONTENT_LENGTH_NOT_SET ((size_t)-2)
+
+struct HTTPUpload {
+    HTTPUploadStatus status;
+    String filename;
+    String name;
+    String type;
+    size_t totalSize;   // これまでに渡し終えたバイト数（今回の currentSize は含まない）
+    size_t currentSize; // buf に入っているバイト数
+    uint8_t buf[HTTP_UPLOAD_BUFLEN];
+};
+
+class WebServer {
+public:
+    typedef std::function<void(void)> THandlerFunction;
+
+    explicit WebServer(int port = 80) : port_(port) {}
+
+    void begin() {}
+    void handleClient() {}
+    void close() {}
+
+    void on(const String& uri, THandlerFunction handler) { on(uri, HTTP_ANY, handler); }
+    void on(const String& uri, HTTPMethod method, THandlerFunction handler) { on(uri, method, handler, nullptr); }
+    void on(const String& uri, HTTPMethod method, THandlerFunction handler, THandlerFunction uploadHandler);
+    void onNotFound(THandlerFunction handler) { notFound_ = handler; }
+
+    String uri() const { return uri_; }
+    HTTPMethod method() const { return method_; }
+    HTTPUpload& upload() { return upload_; }
+    WiFiClient client() { return WiFiClient(); }
+
+    String arg(const String& name) const;
+    String arg(int i) const;
+    String argName(int i) const;
+    int args() const { return (int)args_.size(); }
+    bool hasArg(const String& name) const;
+    void collectHeaders(const char* headerKeys[], size_t count);
+    String header(const String& name) const;
+    bool hasHeader(const String& name) const;
+
+    void send(int code, const char* contentType = nullptr, const String& content = String(""));
+    void send(int code, const String& contentType, const String& content) { send(code, contentType.c_str(), content); }
+    void send(int code, const char* contentType, const char* content) { send(code, contentType, String(content)); }
+    void send_P(int code, const char* contentType, const char* content) { send(code, contentType, String(content)); }
+    void send_P(int code, const char* contentType, const char* content, size_t len) { send(code, contentType, String(content, len)); }
+    void setContentLength(size_t contentLength) { contentLength_ = contentLength; }
+    void sendHeader(const String& name, const String& value, bool first = false);
+    void sendContent(const String& content) { sendContent(content.c_str(), content.length()); }
+    void sendContent(const char* content, size_t len);
+    void sendContent_P(const char* content) { sendContent(content, strlen(content)); }
+    void sendContent_P(const char* content, size_t len) { sendContent(content, len); }
+
+    template <typename T>
+    size_t streamFile(T& file, const String& contentType, int code = 200) {
+        setContentLength(file.size());
+        send(code, contentType.c_str(), String(""));
+        uint8_t buf[1024];
+        size_t total = 0;
+        size_t n;
+        while ((n = file.read(buf, sizeof(buf))) > 0) {
+            sendContent((const char*)buf, n);
+            total += n;
+        }
+        return total;
+    }
+
+    // --- native_sim: テストからリクエストを流す ---
+    struct SimArg {
+        String name;
+        String value;
+    };
+    struct SimResponse {
+        int code;
+        String contentType;
+        size_t bytes;        // ヘッダーを除いた本文のバイト数
+        String body;         // simCaptureBody(true) のときだけ残す
+        std::vector<SimArg> headers;
+    };
+
+    // 登録済みのハンドラを呼ぶ。該当する URI がなければ false (onNotFound があればそれを呼ぶ)
+    bool simRequest(HTTPMethod method, const char* uri, const std::vector<SimArg>& args = {},
+                    const std::vector<SimArg>& headers = {});
+    // multipart のファイル送信として、data を chunkSize ずつアップロードハンドラに渡す
+    bool simUpload(const char* uri, const char* filename, const uint8_t* data, size_t len,
+                   const std::vector<SimArg>& args = {}, size_t chunkSize = HTTP_UPLOAD_BUFLEN);
+    const SimResponse& simResponse() const { return response_; }
+    // 本文を String に溜めるか（溜めるとそのぶんヒープを使うので、ヒープを測るときは false にする）
+    void simCaptureBody(bool capture) { captureBody_ = capture; }
+
+private:
+    struct Route {
+        String uri;
+        HTTPMethod method;
+        THandlerFunction handler;
+        THandlerFunction uploadHandler;
+    };
+    const Route* findRoute(HTTPMethod method, const char* uri) const;
+    void beginRequest(HTTPMethod method, const char* uri, const std::vector<SimArg>& args,
+                      const std::vector<SimArg>& headers);
+
+    int port_;
+    std::vector<Route> routes_;
+    THandlerFunction notFound_;
+    std::vector<String> collectKeys_;
+    String uri_;
+    HTTPMethod method_ = HTTP_GET;
+    std::vector<SimArg> args_;
+    std::vector<SimArg> requestHeaders_;
+    std::vector<SimArg> pendingHeaders_; // sendHeader で積み、send で応答に付ける
+    HTTPUpload upload_ = {};
+    SimResponse response_ = {};
+    size_t contentLength_ = CONTENT_LENGTH_NOT_SET;
+    bool captureBody_ = true;
+};
@@ -0,0 +1,36 @@
+#pragma once
+// native 環境用の WiFi 代替（アクセスポイントは立てたことにするだけ）
+#include "Arduino.h"
+
+class IPAddress {
+public:
+    IPAddress() {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : bytes_{a, b, c, d} {}
+    String toString() const;
+
+private:
+    uint8_t bytes_[4] = {0, 0, 0, 0};
+};
+
+// 接続先のないクライアント。書き込みは捨て、connected() は false を返す
+class WiFiClient : public Stream {
+public:
+    size_t write(uint8_t) override { return 1; }
+    size_t write(const uint8_t*, size_t size) override { return size; }
+    using Print::write;
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    int availableForWrite() override { return 0; }
+    uint8_t connected() { return 0; }
+    void stop() {}
+    void setNoDelay(bool) {}
+    operator bool() { return false; }
+};
+
+class WiFiClass {
+public:
+    bool softAP(const char* ssid, const char* passphrase = nullptr);
+    IPAddress softAPIP() { return IPAddress(192, 168, 4, 1); }
+};
+extern WiFiClass WiFi;
@@ -0,0 +1,5 @@
+#pragma once
+// native 環境用: ROM の CRC32 と同じ値を zlib で計算する（初期値 0 で標準の CRC-32）
+#include <stdint.h>
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len);
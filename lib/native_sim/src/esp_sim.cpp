@@ -0,0 +1,143 @@
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_rom_crc.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+#include <zlib.h>
+
+using SimClock = std::chrono::steady_clock;
+SimClock::time_point nativeSimEpoch();
+size_t nativeSimFreeHeap();
+size_t nativeSimMinFreeHeap();
+
+int64_t esp_timer_get_time() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(SimClock::now() - nativeSimEpoch()).count();
+}
+
+// --- esp_timer: 1本のスレッドで期限の来たタイマーを順に呼ぶ ---
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void* arg;
+    int64_t dueUs;
+    uint64_t periodUs; // 0 なら1回だけ
+    bool armed;
+};
+
+static std::mutex timerMutex;
+static std::condition_variable timerCv;
+static std::vector<esp_timer*> timers;
+static bool timerThreadStarted = false;
+
+static void timerThread() {
+    std::unique_lock<std::mutex> lock(timerMutex);
+    for (;;) {
+        esp_timer* next = nullptr;
+        for (esp_timer* t : timers) {
+            if (t->armed && (!next || t->dueUs < next->dueUs)) next = t;
+        }
+        if (!next) {
+            timerCv.wait(lock);
+            continue;
+        }
+        int64_t now = esp_timer_get_time();
+        if (next->dueUs > now) {
+            timerCv.wait_for(lock, std::chrono::microseconds(next->dueUs - now));
+            continue; // 待っている間に止められたり、早いタイマーが入ったりする
+        }
+        if (next->periodUs) {
+            next->dueUs += next->periodUs;
+        } else {
+            next->armed = false;
+        }
+        esp_timer_cb_t cb = next->callback;
+        void* arg = next->arg;
+        lock.unlock();
+        cb(arg);
+        lock.lock();
+    }
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* outHandle) {
+    if (!args || !args->callback || !outHandle) return ESP_ERR_INVALID_ARG;
+    esp_timer* t = new esp_timer{args->callback, args->arg, 0, 0, false};
+    std::lock_guard<std::mutex> lock(timerMutex);
+    timers.push_back(t);
+    if (!timerThreadStarted) {
+        timerThreadStarted = true;
+        std::thread(timerThread).detach();
+    }
+    *outHandle = t;
+    return ESP_OK;
+}
+
+static esp_err_t startTimer(esp_timer_handle_t timer, uint64_t timeoutUs, uint64_t periodUs) {
+    {
+        std::lock_guard<std::mutex> lock(timerMutex);
+        if (timer->armed) return ESP_ERR_INVALID_STATE;
+        timer->dueUs = esp_timer_get_time() + (int64_t)timeoutUs;
+        timer->periodUs = periodUs;
+        timer->armed = true;
+    }
+    timerCv.notify_one();
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeoutUs) {
+    return startTimer(timer, timeoutUs, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t periodUs) {
+    return startTimer(timer, periodUs, periodUs);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    std::lock_guard<std::mutex> lock(timerMutex);
+    if (!timer->armed) return ESP_ERR_INVALID_STATE;
+    timer->armed = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    std::lock_guard<std::mutex> lock(timerMutex);
+    if (timer->armed) return ESP_ERR_INVALID_STATE;
+    for (size_t i = 0; i < timers.size(); i++) {
+        if (timers[i] == timer) {
+            timers.erase(timers.begin() + i);
+            break;
+        }
+    }
+    delete timer;
+    return ESP_OK;
+}
+
+// --- heap_caps: PSRAM はない構成として扱う ---
+
+void* heap_caps_malloc(size_t size, uint32_t caps) {
+    if (caps & MALLOC_CAP_SPIRAM) return nullptr;
+    return malloc(size);
+}
+
+void heap_caps_free(void* ptr) {
+    free(ptr);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+    return (caps & MALLOC_CAP_SPIRAM) ? 0 : nativeSimFreeHeap();
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+    return (caps & MALLOC_CAP_SPIRAM) ? 0 : nativeSimMinFreeHeap();
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+    return heap_caps_get_free_size(caps);
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len) {
+    return (uint32_t)crc32(crc, buf, len);
+}
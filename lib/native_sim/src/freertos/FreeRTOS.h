@@ -0,0 +1,50 @@
+#pragma once
+// native 環境用の FreeRTOS 代替
+// タスクは std::thread、キューとタスク通知は mutex + condition_variable で動かす
+// 優先度とコアの指定は受け取るだけで、スケジューリングはホストOSに任せる
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <thread>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef void* TaskHandle_t;
+typedef void* QueueHandle_t;
+typedef void* SemaphoreHandle_t;
+typedef void (*TaskFunction_t)(void*);
+
+#define pdTRUE  1
+#define pdFALSE 0
+#define pdPASS  1
+#define pdFAIL  0
+#define errQUEUE_FULL 0
+
+// ESP32 Arduino と同じく 1tick = 1ms
+#define configTICK_RATE_HZ 1000
+#define portTICK_PERIOD_MS 1
+#define portMAX_DELAY 0xffffffffu
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define configMAX_PRIORITIES 25
+#define tskIDLE_PRIORITY 0
+#define tskNO_AFFINITY 0x7fffffff
+
+// ESP-IDF の portMUX と同じく、同じスレッドからは入れ子で取れるスピンロック
+struct portMUX_TYPE {
+    std::atomic<bool> locked;
+    std::thread::id owner;
+    uint32_t count;
+};
+#define portMUX_INITIALIZER_UNLOCKED {false, {}, 0}
+
+void vPortEnterCritical(portMUX_TYPE* mux);
+void vPortExitCritical(portMUX_TYPE* mux);
+
+#define portENTER_CRITICAL(mux)     vPortEnterCritical(mux)
+#define portEXIT_CRITICAL(mux)      vPortExitCritical(mux)
+#define portENTER_CRITICAL_ISR(mux) vPortEnterCritical(mux)
+#define portEXIT_CRITICAL_ISR(mux)  vPortExitCritical(mux)
+#define portYIELD_FROM_ISR()
+
+BaseType_t xPortGetCoreID();
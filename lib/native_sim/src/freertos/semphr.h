@@ -0,0 +1,10 @@
+#pragma once
+#include "FreeRTOS.h"
+#include "queue.h"
+
+// 1要素のキューとして作る（FreeRTOS と同じ考え方）
+SemaphoreHandle_t xSemaphoreCreateBinary();
+SemaphoreHandle_t xSemaphoreCreateMutex();
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticksToWait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+void vSemaphoreDelete(SemaphoreHandle_t sem);
@@ -0,0 +1,275 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <string.h>
+#include <pthread.h>
+
+using SimClock = std::chrono::steady_clock;
+
+// 起動からの経過時間の基準（millis() / esp_timer_get_time() と共通）
+SimClock::time_point nativeSimEpoch() {
+    static const SimClock::time_point epoch = SimClock::now();
+    return epoch;
+}
+
+// portMAX_DELAY なら無期限、それ以外は tick (ms) 後の期限
+static bool waitDeadline(TickType_t ticks, SimClock::time_point* deadline) {
+    if (ticks == portMAX_DELAY) return false;
+    *deadline = SimClock::now() + std::chrono::milliseconds(ticks);
+    return true;
+}
+
+template <class Pred>
+static bool waitFor(std::condition_variable& cv, std::unique_lock<std::mutex>& lock, TickType_t ticks, Pred pred) {
+    SimClock::time_point deadline;
+    if (!waitDeadline(ticks, &deadline)) {
+        cv.wait(lock, pred);
+        return true;
+    }
+    return cv.wait_until(lock, deadline, pred);
+}
+
+// --- portMUX ---
+
+void vPortEnterCritical(portMUX_TYPE* mux) {
+    std::thread::id self = std::this_thread::get_id();
+    if (mux->locked.load(std::memory_order_acquire) && mux->owner == self) {
+        mux->count++;
+        return;
+    }
+    while (mux->locked.exchange(true, std::memory_order_acquire)) std::this_thread::yield();
+    mux->owner = self;
+    mux->count = 1;
+}
+
+void vPortExitCritical(portMUX_TYPE* mux) {
+    if (--mux->count > 0) return;
+    mux->owner = std::thread::id();
+    mux->locked.store(false, std::memory_order_release);
+}
+
+BaseType_t xPortGetCoreID() {
+    return 0;
+}
+
+// --- タスク ---
+
+struct SimTask {
+    std::string name;
+    std::mutex mutex;
+    std::condition_variable cv;
+    uint32_t notifyValue = 0;
+};
+
+static thread_local SimTask* currentTask = nullptr;
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t, void* arg,
+                                   UBaseType_t, TaskHandle_t* handle, BaseType_t) {
+    SimTask* task = new SimTask();
+    task->name = name ? name : "";
+    std::thread([task, fn, arg]() {
+        currentTask = task;
+        pthread_setname_np(pthread_self(), task->name.substr(0, 15).c_str());
+        fn(arg);
+    }).detach();
+    if (handle) *handle = task;
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t stackDepth, void* arg,
+                       UBaseType_t priority, TaskHandle_t* handle) {
+    return xTaskCreatePinnedToCore(fn, name, stackDepth, arg, priority, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    // 他のタスクを外から止める手段はないので、自タスクの終了だけ扱う
+    if (task == nullptr || task == currentTask) pthread_exit(nullptr);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+TickType_t xTaskGetTickCount() {
+    return (TickType_t)std::chrono::duration_cast<std::chrono::milliseconds>(SimClock::now() - nativeSimEpoch()).count();
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+    // setup()/loop() のスレッドなど、xTaskCreate で作っていないスレッドにも通知用の状態を持たせる
+    if (!currentTask) {
+        currentTask = new SimTask();
+        currentTask->name = "main";
+    }
+    return currentTask;
+}
+
+const char* pcTaskGetName(TaskHandle_t task) {
+    SimTask* t = static_cast<SimTask*>(task ? task : xTaskGetCurrentTaskHandle());
+    return t->name.c_str();
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t) {
+    return 0;
+}
+
+void taskYIELD() {
+    std::this_thread::yield();
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticksToWait) {
+    SimTask* task = static_cast<SimTask*>(xTaskGetCurrentTaskHandle());
+    std::unique_lock<std::mutex> lock(task->mutex);
+    waitFor(task->cv, lock, ticksToWait, [task] { return task->notifyValue > 0; });
+    uint32_t value = task->notifyValue;
+    if (value > 0) task->notifyValue = clearOnExit ? 0 : value - 1;
+    return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t handle) {
+    SimTask* task = static_cast<SimTask*>(handle);
+    {
+        std::lock_guard<std::mutex> lock(task->mutex);
+        task->notifyValue++;
+    }
+    task->cv.notify_one();
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higherPriorityTaskWoken) {
+    xTaskNotifyGive(task);
+    if (higherPriorityTaskWoken) *higherPriorityTaskWoken = pdFALSE;
+}
+
+// --- キュー ---
+
+struct SimQueue {
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::vector<uint8_t> storage;
+    size_t itemSize;
+    size_t length;
+    size_t head = 0; // 次に取り出す位置
+    size_t count = 0;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+    SimQueue* q = new SimQueue();
+    q->itemSize = itemSize;
+    q->length = length;
+    q->storage.resize((size_t)length * itemSize);
+    return q;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    delete static_cast<SimQueue*>(queue);
+}
+
+static BaseType_t queueSend(QueueHandle_t queue, const void* item, TickType_t ticksToWait, bool front) {
+    SimQueue* q = static_cast<SimQueue*>(queue);
+    std::unique_lock<std::mutex> lock(q->mutex);
+    if (!waitFor(q->notFull, lock, ticksToWait, [q] { return q->count < q->length; })) return errQUEUE_FULL;
+    size_t index;
+    if (front) {
+        q->head = (q->head + q->length - 1) % q->length;
+        index = q->head;
+    } else {
+        index = (q->head + q->count) % q->length;
+    }
+    if (q->itemSize) memcpy(&q->storage[index * q->itemSize], item, q->itemSize);
+    q->count++;
+    lock.unlock();
+    q->notEmpty.notify_one();
+    return pdPASS;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticksToWait) {
+    return queueSend(queue, item, ticksToWait, false);
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void* item, TickType_t ticksToWait) {
+    return queueSend(queue, item, ticksToWait, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void* item, TickType_t ticksToWait) {
+    return queueSend(queue, item, ticksToWait, true);
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void* item, BaseType_t* higherPriorityTaskWoken) {
+    if (higherPriorityTaskWoken) *higherPriorityTaskWoken = pdFALSE;
+    return queueSend(queue, item, 0, false);
+}
+
+static BaseType_t queueReceive(QueueHandle_t queue, void* item, TickType_t ticksToWait, bool remove) {
+    SimQueue* q = static_cast<SimQueue*>(queue);
+    std::unique_lock<std::mutex> lock(q->mutex);
+    if (!waitFor(q->notEmpty, lock, ticksToWait, [q] { return q->count > 0; })) return pdFALSE;
+    if (q->itemSize && item) memcpy(item, &q->storage[q->head * q->itemSize], q->itemSize);
+    if (!remove) return pdTRUE;
+    q->head = (q->head + 1) % q->length;
+    q->count--;
+    lock.unlock();
+    q->notFull.notify_one();
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticksToWait) {
+    return queueReceive(queue, item, ticksToWait, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void* item, TickType_t ticksToWait) {
+    return queueReceive(queue, item, ticksToWait, false);
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue) {
+    SimQueue* q = static_cast<SimQueue*>(queue);
+    {
+        std::lock_guard<std::mutex> lock(q->mutex);
+        q->head = 0;
+        q->count = 0;
+    }
+    q->notFull.notify_all();
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    SimQueue* q = static_cast<SimQueue*>(queue);
+    std::lock_guard<std::mutex> lock(q->mutex);
+    return q->count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue) {
+    SimQueue* q = static_cast<SimQueue*>(queue);
+    std::lock_guard<std::mutex> lock(q->mutex);
+    return q->length - q->count;
+}
+
+// --- セマフォ（要素サイズ0のキュー。Give で積み、Take で取る） ---
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+    return xQueueCreate(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+    SemaphoreHandle_t sem = xQueueCreate(1, 0);
+    xQueueSend(sem, nullptr, 0); // ミューテックスは取れる状態で作る
+    return sem;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticksToWait) {
+    return xQueueReceive(sem, nullptr, ticksToWait);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+    return xQueueSend(sem, nullptr, 0);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem) {
+    vQueueDelete(sem);
+}
@@ -0,0 +1,257 @@
+#include "LittleFS.h"
+#include "native_sim.h"
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+fs::LittleFSFS LittleFS;
+
+// LittleFS のパーティションサイズ相当（usedBytes との比較用）
+static const size_t FS_TOTAL_BYTES = 1536 * 1024;
+
+static std::string fsRoot;
+
+const char* nativeSimFsRoot() {
+    if (fsRoot.empty()) {
+        const char* env = getenv("NATIVE_SIM_FS_ROOT");
+        if (env && *env) {
+            fsRoot = env;
+            ::mkdir(fsRoot.c_str(), 0755);
+        } else {
+            char tmpl[] = "/tmp/native_sim_fs_XXXXXX";
+            const char* dir = mkdtemp(tmpl);
+            fsRoot = dir ? dir : "/tmp";
+        }
+    }
+    return fsRoot.c_str();
+}
+
+static std::string hostPath(const char* path) {
+    std::string p = nativeSimFsRoot();
+    if (!path || path[0] != '/') p += '/';
+    if (path) p += path;
+    return p;
+}
+
+namespace fs {
+
+struct FileImpl {
+    std::string path;      // LittleFS 上のパス
+    std::string name;      // path のファイル名部分
+    FILE* fp = nullptr;
+    DIR* dir = nullptr;
+    std::string mode;
+
+    ~FileImpl() {
+        if (fp) fclose(fp);
+        if (dir) closedir(dir);
+    }
+};
+
+static std::shared_ptr<FileImpl> openImpl(const char* path, const char* mode) {
+    std::string host = hostPath(path);
+    struct stat st;
+    bool exists = stat(host.c_str(), &st) == 0;
+    auto impl = std::make_shared<FileImpl>();
+    impl->path = path;
+    const char* slash = strrchr(path, '/');
+    impl->name = slash ? slash + 1 : path;
+    impl->mode = mode;
+
+    if (exists && S_ISDIR(st.st_mode)) {
+        impl->dir = opendir(host.c_str());
+        return impl->dir ? impl : nullptr;
+    }
+    if (!exists && mode[0] == 'r') return nullptr;
+    // バイナリで開く。"r+" は既存ファイルの途中に書ける
+    std::string m = mode;
+    if (m.find('b') == std::string::npos) m += 'b';
+    impl->fp = fopen(host.c_str(), m.c_str());
+    return impl->fp ? impl : nullptr;
+}
+
+size_t File::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t File::write(const uint8_t* buffer, size_t size) {
+    if (!impl_ || !impl_->fp || impl_->mode == "r") return 0;
+    return fwrite(buffer, 1, size, impl_->fp);
+}
+
+int File::available() {
+    if (!impl_ || !impl_->fp) return 0;
+    long pos = ftell(impl_->fp);
+    size_t total = size();
+    return pos >= 0 && (size_t)pos < total ? (int)(total - pos) : 0;
+}
+
+int File::read() {
+    if (!impl_ || !impl_->fp) return -1;
+    int c = fgetc(impl_->fp);
+    return c == EOF ? -1 : c;
+}
+
+int File::peek() {
+    if (!impl_ || !impl_->fp) return -1;
+    int c = fgetc(impl_->fp);
+    if (c == EOF) return -1;
+    ungetc(c, impl_->fp);
+    return c;
+}
+
+size_t File::read(uint8_t* buffer, size_t size) {
+    if (!impl_ || !impl_->fp) return 0;
+    return fread(buffer, 1, size, impl_->fp);
+}
+
+void File::flush() {
+    if (impl_ && impl_->fp) fflush(impl_->fp);
+}
+
+bool File::seek(uint32_t pos, SeekMode mode) {
+    if (!impl_ || !impl_->fp) return false;
+    int whence = mode == SeekCur ? SEEK_CUR : mode == SeekEnd ? SEEK_END : SEEK_SET;
+    return fseek(impl_->fp, (long)pos, whence) == 0;
+}
+
+size_t File::position() const {
+    if (!impl_ || !impl_->fp) return 0;
+    long pos = ftell(impl_->fp);
+    return pos < 0 ? 0 : (size_t)pos;
+}
+
+size_t File::size() const {
+    if (!impl_ || !impl_->fp) return 0;
+    fflush(impl_->fp);
+    struct stat st;
+    if (fstat(fileno(impl_->fp), &st) != 0) return 0;
+    return (size_t)st.st_size;
+}
+
+void File::close() {
+    impl_.reset();
+}
+
+File::operator bool() const {
+    return impl_ != nullptr;
+}
+
+const char* File::path() const {
+    return impl_ ? impl_->path.c_str() : "";
+}
+
+const char* File::name() const {
+    return impl_ ? impl_->name.c_str() : "";
+}
+
+bool File::isDirectory() const {
+    return impl_ && impl_->dir;
+}
+
+File File::openNextFile(const char* mode) {
+    if (!impl_ || !impl_->dir) return File();
+    for (struct dirent* e; (e = readdir(impl_->dir)) != nullptr;) {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) continue;
+        std::string child = impl_->path;
+        if (child.empty() || child.back() != '/') child += '/';
+        child += e->d_name;
+        return File(openImpl(child.c_str(), mode));
+    }
+    return File();
+}
+
+void File::rewindDirectory() {
+    if (impl_ && impl_->dir) rewinddir(impl_->dir);
+}
+
+time_t File::getLastWrite() {
+    struct stat st;
+    if (!impl_ || stat(hostPath(impl_->path.c_str()).c_str(), &st) != 0) return 0;
+    return st.st_mtime;
+}
+
+File FS::open(const char* path, const char* mode, bool create) {
+    if (create && mode[0] != 'r') {
+        // 途中のディレクトリも作る
+        std::string p = path;
+        for (size_t i = 1; (i = p.find('/', i)) != std::string::npos; i++) {
+            ::mkdir(hostPath(p.substr(0, i).c_str()).c_str(), 0755);
+        }
+    }
+    return File(openImpl(path, mode));
+}
+
+bool FS::exists(const char* path) {
+    struct stat st;
+    return stat(hostPath(path).c_str(), &st) == 0;
+}
+
+bool FS::remove(const char* path) {
+    return unlink(hostPath(path).c_str()) == 0;
+}
+
+bool FS::rename(const char* from, const char* to) {
+    return ::rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0;
+}
+
+bool FS::mkdir(const char* path) {
+    return ::mkdir(hostPath(path).c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+bool FS::rmdir(const char* path) {
+    return ::rmdir(hostPath(path).c_str()) == 0;
+}
+
+bool LittleFSFS::begin(bool, const char*, uint8_t, const char*) {
+    nativeSimFsRoot();
+    return true;
+}
+
+static void removeTree(const std::string& dir, bool removeSelf) {
+    DIR* d = opendir(dir.c_str());
+    if (!d) return;
+    for (struct dirent* e; (e = readdir(d)) != nullptr;) {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) continue;
+        std::string child = dir + "/" + e->d_name;
+        struct stat st;
+        if (stat(child.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            removeTree(child, true);
+        } else {
+            unlink(child.c_str());
+        }
+    }
+    closedir(d);
+    if (removeSelf) ::rmdir(dir.c_str());
+}
+
+bool LittleFSFS::format() {
+    removeTree(nativeSimFsRoot(), false);
+    return true;
+}
+
+size_t LittleFSFS::totalBytes() {
+    return FS_TOTAL_BYTES;
+}
+
+static size_t treeBytes(const std::string& dir) {
+    size_t total = 0;
+    DIR* d = opendir(dir.c_str());
+    if (!d) return 0;
+    for (struct dirent* e; (e = readdir(d)) != nullptr;) {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) continue;
+        std::string child = dir + "/" + e->d_name;
+        struct stat st;
+        if (stat(child.c_str(), &st) != 0) continue;
+        total += S_ISDIR(st.st_mode) ? treeBytes(child) : (size_t)st.st_size;
+    }
+    closedir(d);
+    return total;
+}
+
+size_t LittleFSFS::usedBytes() {
+    return treeBytes(nativeSimFsRoot());
+}
+
+} // namespace fs
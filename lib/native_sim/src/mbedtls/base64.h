@@ -0,0 +1,7 @@
+#pragma once
+#include <stddef.h>
+
+#define MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL -0x002A
+
+// dst が足りなければ *olen に必要なサイズ（終端込み）を入れて MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL を返す
+int mbedtls_base64_encode(unsigned char* dst, size_t dlen, size_t* olen, const unsigned char* src, size_t slen);
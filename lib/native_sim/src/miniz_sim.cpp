@@ -0,0 +1,51 @@
+#include "rom/miniz.h"
+#include <stdlib.h>
+#include <zlib.h>
+
+static void endStream(tinfl_decompressor* r) {
+    z_stream* zs = static_cast<z_stream*>(r->m_stream);
+    if (!zs) return;
+    inflateEnd(zs);
+    free(zs);
+    r->m_stream = NULL;
+}
+
+tinfl_status tinfl_decompress(tinfl_decompressor* r, const mz_uint8* pIn_buf_next, size_t* pIn_buf_size,
+                              mz_uint8*, mz_uint8* pOut_buf_next, size_t* pOut_buf_size,
+                              const mz_uint32 decomp_flags) {
+    if (!r || !pIn_buf_size || !pOut_buf_size) return TINFL_STATUS_BAD_PARAM;
+    if (r->m_state == 0) {
+        z_stream* zs = static_cast<z_stream*>(calloc(1, sizeof(z_stream)));
+        // zlib ヘッダー付きか、生の deflate か
+        int windowBits = (decomp_flags & TINFL_FLAG_PARSE_ZLIB_HEADER) ? 15 : -15;
+        if (!zs || inflateInit2(zs, windowBits) != Z_OK) {
+            free(zs);
+            return TINFL_STATUS_FAILED;
+        }
+        r->m_stream = zs;
+        r->m_state = 1;
+    }
+    z_stream* zs = static_cast<z_stream*>(r->m_stream);
+    if (!zs) return TINFL_STATUS_FAILED; // 終わった・失敗したストリームにさらに渡された
+
+    zs->next_in = const_cast<Bytef*>(pIn_buf_next);
+    zs->avail_in = (uInt)*pIn_buf_size;
+    zs->next_out = pOut_buf_next;
+    zs->avail_out = (uInt)*pOut_buf_size;
+    int ret = inflate(zs, Z_NO_FLUSH);
+    *pIn_buf_size -= zs->avail_in;
+    *pOut_buf_size -= zs->avail_out;
+
+    if (ret == Z_STREAM_END) {
+        endStream(r);
+        return TINFL_STATUS_DONE;
+    }
+    if (ret != Z_OK && ret != Z_BUF_ERROR) {
+        endStream(r);
+        return TINFL_STATUS_FAILED;
+    }
+    if (zs->avail_out == 0) return TINFL_STATUS_HAS_MORE_OUTPUT;
+    if (decomp_flags & TINFL_FLAG_HAS_MORE_INPUT) return TINFL_STATUS_NEEDS_MORE_INPUT;
+    endStream(r); // 入力が終わったのにストリームが終わっていない
+    return TINFL_STATUS_FAILED;
+}
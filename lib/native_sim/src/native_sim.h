@@ -0,0 +1,40 @@
+#pragma once
+// native 環境のテスト・ベンチマークから模擬環境を操作・観測するための関数
+#include <stddef.h>
+#include <stdint.h>
+#include "driver/twai.h"
+
+// --- TWAI ---
+struct TwaiSimStats {
+    uint64_t framesQueued;        // twai_transmit で受け付けたフレーム数
+    uint64_t framesOnBus;         // バスに出し終えたフレーム数
+    uint64_t busBusyUs;           // バスを占有した時間の合計
+    uint64_t selfReceived;        // 自己受信で受信キューに入れたフレーム数
+    uint32_t txQueueFullTimeouts; // 送信キューが空かずに twai_transmit がタイムアウトした回数
+};
+TwaiSimStats twaiSimStats();
+
+// 送信キューが空になり、最後のフレームがバスに出終わるまで待つ
+bool twaiSimWaitIdle(uint32_t timeoutMs);
+
+// 送ったフレームがバスに出終わるたびに呼ぶ関数 (バス上の相手ノードの代わりに使う)
+// doneUs は出終わった時刻 (esp_timer_get_time() と同じ基準)
+// ドライバのロックを持ったまま呼ぶので、中から twai_* / twaiSim* は呼ばないこと
+typedef void (*TwaiSimTxObserver)(const twai_message_t& msg, int64_t doneUs);
+void twaiSimSetTxObserver(TwaiSimTxObserver observer); // nullptr で外す
+
+// 相手ノードから届いたフレームとして受信キューに入れる
+void twaiSimInjectRx(const twai_message_t& msg);
+
+// --- ヒープ (operator new / delete で数えた量。ESP.getFreeHeap() はここから計算する) ---
+const size_t NATIVE_SIM_HEAP_SIZE = 320 * 1024; // ESP32 の DRAM ヒープ相当
+size_t nativeSimHeapUsed();
+size_t nativeSimHeapPeak();
+void nativeSimResetHeapPeak(); // 今の使用量をピークにする
+
+// --- Serial ---
+void nativeSimSetSerialEnabled(bool enabled); // false の間は出力を捨てる（計測中の出力コストを除く）
+
+// --- LittleFS ---
+// 置き場所は環境変数 NATIVE_SIM_FS_ROOT、なければ起動ごとに /tmp に作る空のディレクトリ
+const char* nativeSimFsRoot();
@@ -0,0 +1,37 @@
+#pragma once
+// native 環境用: ROM の tinfl と同じ呼び出し方で、展開はホストの zlib に任せる
+// 辞書は zlib 側が持つので、出力バッファは単なる書き込み先として使う
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint8_t mz_uint8;
+typedef uint32_t mz_uint32;
+
+#define TINFL_LZ_DICT_SIZE 32768
+
+enum {
+    TINFL_FLAG_PARSE_ZLIB_HEADER = 1,
+    TINFL_FLAG_HAS_MORE_INPUT = 2,
+    TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF = 4,
+    TINFL_FLAG_COMPUTE_ADLER32 = 8
+};
+
+typedef enum {
+    TINFL_STATUS_BAD_PARAM = -3,
+    TINFL_STATUS_ADLER32_MISMATCH = -2,
+    TINFL_STATUS_FAILED = -1,
+    TINFL_STATUS_DONE = 0,
+    TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+    TINFL_STATUS_HAS_MORE_OUTPUT = 2
+} tinfl_status;
+
+typedef struct {
+    mz_uint32 m_state; // 0: 未初期化 (tinfl_init 直後)
+    void* m_stream;    // zlib の z_stream。終わりまで展開するか失敗したら解放する
+} tinfl_decompressor;
+
+#define tinfl_init(r) do { (r)->m_state = 0; (r)->m_stream = NULL; } while (0)
+
+tinfl_status tinfl_decompress(tinfl_decompressor* r, const mz_uint8* pIn_buf_next, size_t* pIn_buf_size,
+                              mz_uint8* pOut_buf_start, mz_uint8* pOut_buf_next, size_t* pOut_buf_size,
+                              const mz_uint32 decomp_flags);
@@ -0,0 +1,274 @@
+#include "driver/twai.h"
+#include "native_sim.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// 模擬バスは時刻で進める: twai_transmit で受け付けた時点で、前のフレームに続けて送り終わる時刻を決めておく
+// 各関数は最初に advanceBus() で「今までに送り終わったはずのフレーム」を片付ける
+// スレッドの起床が遅れても (VMの停止など) バスの進み方は変わらず、タイムアウトも模擬時刻で判定する
+
+using SimTime = std::chrono::steady_clock::time_point;
+
+struct SimFrame {
+    twai_message_t msg;
+    SimTime doneAt;      // バスに出し終わる時刻
+    uint32_t durationUs; // バスを占有する時間
+};
+
+// ドライバの状態（すべて simMutex で守る）
+static std::mutex simMutex;
+static std::condition_variable txReady;   // 送信キューにフレームが入った / 止まった
+static std::condition_variable txSpace;   // 送信キューが進んだ
+static std::condition_variable rxReady;
+static bool installed = false;
+static twai_general_config_t generalConfig;
+static uint32_t bitrate = 500000;
+static twai_state_t state = TWAI_STATE_STOPPED;
+static std::deque<SimFrame> txQueue;      // 先頭はバスに出ている（出し終わっていない）フレーム
+static std::deque<twai_message_t> rxQueue;
+static bool busThreadStarted = false;
+static twai_status_info_t counters = {};
+static TwaiSimStats stats = {};
+static TwaiSimTxObserver txObserver = nullptr;
+
+SimTime nativeSimEpoch(); // freertos_sim.cpp (esp_timer_get_time() の基準)
+
+static SimTime simNow() {
+    return std::chrono::steady_clock::now();
+}
+
+// 1フレームのビット数（firmware の canFrameBits と同じく、スタッフビットは最悪値）
+static uint32_t frameBits(const twai_message_t& msg) {
+    uint32_t dlc = msg.data_length_code > 8 ? 8 : msg.data_length_code;
+    uint32_t dataBits = msg.rtr ? 0 : 8 * dlc;
+    // SOF〜CRC: 標準 1+11+1+1+1+4+15 = 34、拡張は ID と SRR/IDE の分 +20
+    uint32_t stuffed = (msg.extd ? 54 : 34) + dataBits;
+    // スタッフビット + CRCデリミタ1 + ACK2 + EOF7 + フレーム間スペース3
+    return stuffed + (stuffed - 1) / 4 + 13;
+}
+
+// 受信キューに入れる。一杯なら取りこぼしとして数える（simMutex を持って呼ぶ）
+static bool deliverRx(const twai_message_t& msg) {
+    if (rxQueue.size() >= generalConfig.rx_queue_len) {
+        counters.rx_missed_count++;
+        return false;
+    }
+    rxQueue.push_back(msg);
+    rxReady.notify_all();
+    return true;
+}
+
+// now までに送り終わったフレームをキューから外す（simMutex を持って呼ぶ）
+static void advanceBus(SimTime now) {
+    bool progressed = false;
+    while (!txQueue.empty() && txQueue.front().doneAt <= now) {
+        const SimFrame& f = txQueue.front();
+        stats.framesOnBus++;
+        stats.busBusyUs += f.durationUs;
+        if (f.msg.self) {
+            // 自己受信要求付きのフレームは自分の受信キューにも入る
+            if (deliverRx(f.msg)) stats.selfReceived++;
+        }
+        if (txObserver) {
+            txObserver(f.msg, std::chrono::duration_cast<std::chrono::microseconds>(f.doneAt - nativeSimEpoch()).count());
+        }
+        txQueue.pop_front();
+        progressed = true;
+    }
+    if (progressed) txSpace.notify_all();
+}
+
+// 送信キューの空き。先頭 (送信中) のフレームはコントローラ側にあるので数えない
+static bool txHasSpace() {
+    return txQueue.size() < (size_t)generalConfig.tx_queue_len + 1;
+}
+
+// 誰も呼ばない間も自己受信フレームを届け、待っている側を起こす
+static void busThread() {
+    std::unique_lock<std::mutex> lock(simMutex);
+    for (;;) {
+        txReady.wait(lock, [] { return !txQueue.empty(); });
+        txReady.wait_until(lock, txQueue.front().doneAt);
+        advanceBus(simNow());
+    }
+}
+
+esp_err_t twai_driver_install(const twai_general_config_t* g, const twai_timing_config_t* t, const twai_filter_config_t*) {
+    std::lock_guard<std::mutex> lock(simMutex);
+    if (installed) return ESP_ERR_INVALID_STATE;
+    if (!g || !t || t->brp == 0) return ESP_ERR_INVALID_ARG;
+    generalConfig = *g;
+    if (generalConfig.tx_queue_len == 0) generalConfig.tx_queue_len = 1;
+    if (generalConfig.rx_queue_len == 0) generalConfig.rx_queue_len = 1;
+    // APB 80MHz / brp / (1 + tseg1 + tseg2)
+    bitrate = 80000000UL / t->brp / (1 + t->tseg_1 + t->tseg_2);
+    installed = true;
+    state = TWAI_STATE_STOPPED;
+    counters = {};
+    if (!busThreadStarted) {
+        busThreadStarted = true;
+        std::thread(busThread).detach();
+    }
+    return ESP_OK;
+}
+
+esp_err_t twai_driver_uninstall() {
+    std::lock_guard<std::mutex> lock(simMutex);
+    if (!installed || state == TWAI_STATE_RUNNING) return ESP_ERR_INVALID_STATE;
+    installed = false;
+    txQueue.clear();
+    rxQueue.clear();
+    return ESP_OK;
+}
+
+esp_err_t twai_start() {
+    std::lock_guard<std::mutex> lock(simMutex);
+    if (!installed || state != TWAI_STATE_STOPPED) return ESP_ERR_INVALID_STATE;
+    state = TWAI_STATE_RUNNING;
+    return ESP_OK;
+}
+
+esp_err_t twai_stop() {
+    std::lock_guard<std::mutex> lock(simMutex);
+    if (!installed || state != TWAI_STATE_RUNNING) return ESP_ERR_INVALID_STATE;
+    advanceBus(simNow());
+    state = TWAI_STATE_STOPPED;
+    txQueue.clear(); // 送り終わっていないフレームは捨てる
+    txSpace.notify_all();
+    return ESP_OK;
+}
+
+esp_err_t twai_transmit(const twai_message_t* message, TickType_t ticksToWait) {
+    if (!message || message->data_length_code > TWAI_FRAME_MAX_DLC) return ESP_ERR_INVALID_ARG;
+    std::unique_lock<std::mutex> lock(simMutex);
+    if (!installed || state != TWAI_STATE_RUNNING) return ESP_ERR_INVALID_STATE;
+    if (generalConfig.mode == TWAI_MODE_LISTEN_ONLY) return ESP_ERR_NOT_SUPPORTED;
+    SimTime deadline = simNow() + std::chrono::milliseconds(ticksToWait);
+    for (;;) {
+        advanceBus(simNow());
+        if (state != TWAI_STATE_RUNNING) return ESP_FAIL;
+        if (txHasSpace()) break;
+        // 空きができるのは先頭のフレームを送り終えたとき。それが待ち時間より後ならタイムアウト
+        SimTime freeAt = txQueue.front().doneAt;
+        if (ticksToWait != portMAX_DELAY && freeAt > deadline) {
+            stats.txQueueFullTimeouts++;
+            return ESP_ERR_TIMEOUT;
+        }
+        txSpace.wait_until(lock, freeAt);
+    }
+
+    // バスが空いていれば今から、続けて送るなら前のフレームの直後から
+    SimFrame f = {*message, simNow(), (uint32_t)((uint64_t)frameBits(*message) * 1000000ULL / bitrate)};
+    if (!txQueue.empty() && txQueue.back().doneAt > f.doneAt) f.doneAt = txQueue.back().doneAt;
+    f.doneAt += std::chrono::microseconds(f.durationUs);
+    txQueue.push_back(f);
+    stats.framesQueued++;
+    txReady.notify_all();
+    return ESP_OK;
+}
+
+esp_err_t twai_receive(twai_message_t* message, TickType_t ticksToWait) {
+    std::unique_lock<std::mutex> lock(simMutex);
+    if (!installed) return ESP_ERR_INVALID_STATE;
+    SimTime deadline = simNow() + std::chrono::milliseconds(ticksToWait);
+    for (;;) {
+        SimTime now = simNow();
+        advanceBus(now);
+        if (!rxQueue.empty()) break;
+        if (ticksToWait != portMAX_DELAY && now >= deadline) return ESP_ERR_TIMEOUT;
+        // 次にフレームを送り終わる時刻か、待ち時間の終わりまで
+        SimTime wakeAt = ticksToWait == portMAX_DELAY ? SimTime::max() : deadline;
+        if (!txQueue.empty() && txQueue.front().doneAt < wakeAt) wakeAt = txQueue.front().doneAt;
+        if (wakeAt == SimTime::max()) {
+            rxReady.wait(lock);
+        } else {
+            rxReady.wait_until(lock, wakeAt);
+        }
+    }
+    *message = rxQueue.front();
+    rxQueue.pop_front();
+    return ESP_OK;
+}
+
+esp_err_t twai_get_status_info(twai_status_info_t* status) {
+    std::lock_guard<std::mutex> lock(simMutex);
+    if (!installed) return ESP_ERR_INVALID_STATE;
+    advanceBus(simNow());
+    *status = counters;
+    status->state = state;
+    status->msgs_to_tx = txQueue.size();
+    status->msgs_to_rx = rxQueue.size();
+    return ESP_OK;
+}
+
+esp_err_t twai_initiate_recovery() {
+    std::lock_guard<std::mutex> lock(simMutex);
+    if (!installed || state != TWAI_STATE_BUS_OFF) return ESP_ERR_INVALID_STATE;
+    // 模擬バスではエラーが起きないので、すぐに停止状態へ戻る
+    state = TWAI_STATE_STOPPED;
+    return ESP_OK;
+}
+
+esp_err_t twai_reconfigure_alerts(uint32_t alertsEnabled, uint32_t* currentAlerts) {
+    std::lock_guard<std::mutex> lock(simMutex);
+    if (!installed) return ESP_ERR_INVALID_STATE;
+    generalConfig.alerts_enabled = alertsEnabled;
+    if (currentAlerts) *currentAlerts = 0;
+    return ESP_OK;
+}
+
+esp_err_t twai_read_alerts(uint32_t* alerts, TickType_t ticksToWait) {
+    // 模擬バスではアラートは起きない
+    if (alerts) *alerts = 0;
+    if (ticksToWait != portMAX_DELAY) std::this_thread::sleep_for(std::chrono::milliseconds(ticksToWait));
+    return ESP_ERR_TIMEOUT;
+}
+
+esp_err_t twai_clear_transmit_queue() {
+    std::lock_guard<std::mutex> lock(simMutex);
+    if (!installed) return ESP_ERR_INVALID_STATE;
+    advanceBus(simNow());
+    // 送信中のフレームは最後まで出る
+    if (txQueue.size() > 1) txQueue.erase(txQueue.begin() + 1, txQueue.end());
+    txSpace.notify_all();
+    return ESP_OK;
+}
+
+esp_err_t twai_clear_receive_queue() {
+    std::lock_guard<std::mutex> lock(simMutex);
+    if (!installed) return ESP_ERR_INVALID_STATE;
+    rxQueue.clear();
+    return ESP_OK;
+}
+
+TwaiSimStats twaiSimStats() {
+    std::lock_guard<std::mutex> lock(simMutex);
+    advanceBus(simNow());
+    return stats;
+}
+
+bool twaiSimWaitIdle(uint32_t timeoutMs) {
+    std::unique_lock<std::mutex> lock(simMutex);
+    SimTime deadline = simNow() + std::chrono::milliseconds(timeoutMs);
+    for (;;) {
+        advanceBus(simNow());
+        if (txQueue.empty()) return true;
+        SimTime doneAt = txQueue.back().doneAt;
+        if (doneAt > deadline) return false;
+        txSpace.wait_until(lock, doneAt);
+    }
+}
+
+void twaiSimSetTxObserver(TwaiSimTxObserver observer) {
+    std::lock_guard<std::mutex> lock(simMutex);
+    txObserver = observer;
+}
+
+void twaiSimInjectRx(const twai_message_t& msg) {
+    std::lock_guard<std::mutex> lock(simMutex);
+    advanceBus(simNow());
+    if (installed) deliverRx(msg);
+}
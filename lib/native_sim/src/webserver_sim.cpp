@@ -0,0 +1,156 @@
+#include "WebServer.h"
+#include "M5Atom.h"
+
+WiFiClass WiFi;
+M5Atom M5;
+
+String IPAddress::toString() const {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", bytes_[0], bytes_[1], bytes_[2], bytes_[3]);
+    return String(buf);
+}
+
+bool WiFiClass::softAP(const char* ssid, const char*) {
+    Serial.printf("[native_sim] softAP %s\n", ssid);
+    return true;
+}
+
+void M5Atom::begin(bool serialEnable, bool, bool) {
+    if (serialEnable) Serial.begin(115200);
+}
+
+void WebServer::on(const String& uri, HTTPMethod method, THandlerFunction handler, THandlerFunction uploadHandler) {
+    routes_.push_back({uri, method, handler, uploadHandler});
+}
+
+String WebServer::arg(const String& name) const {
+    for (const SimArg& a : args_) {
+        if (a.name == name) return a.value;
+    }
+    return String();
+}
+
+String WebServer::arg(int i) const {
+    return i >= 0 && i < (int)args_.size() ? args_[i].value : String();
+}
+
+String WebServer::argName(int i) const {
+    return i >= 0 && i < (int)args_.size() ? args_[i].name : String();
+}
+
+bool WebServer::hasArg(const String& name) const {
+    for (const SimArg& a : args_) {
+        if (a.name == name) return true;
+    }
+    return false;
+}
+
+void WebServer::collectHeaders(const char* headerKeys[], size_t count) {
+    collectKeys_.clear();
+    for (size_t i = 0; i < count; i++) collectKeys_.push_back(headerKeys[i]);
+}
+
+String WebServer::header(const String& name) const {
+    for (const SimArg& h : requestHeaders_) {
+        if (h.name.equalsIgnoreCase(name)) return h.value;
+    }
+    return String();
+}
+
+bool WebServer::hasHeader(const String& name) const {
+    for (const SimArg& h : requestHeaders_) {
+        if (h.name.equalsIgnoreCase(name)) return true;
+    }
+    return false;
+}
+
+void WebServer::send(int code, const char* contentType, const String& content) {
+    response_.code = code;
+    response_.contentType = contentType ? contentType : "";
+    response_.headers = pendingHeaders_;
+    pendingHeaders_.clear();
+    sendContent(content.c_str(), content.length());
+}
+
+void WebServer::sendHeader(const String& name, const String& value, bool first) {
+    if (first) {
+        pendingHeaders_.insert(pendingHeaders_.begin(), {name, value});
+    } else {
+        pendingHeaders_.push_back({name, value});
+    }
+}
+
+void WebServer::sendContent(const char* content, size_t len) {
+    response_.bytes += len;
+    if (captureBody_) response_.body.concat(content, len);
+}
+
+const WebServer::Route* WebServer::findRoute(HTTPMethod method, const char* uri) const {
+    for (const Route& r : routes_) {
+        if (r.uri == uri && (r.method == HTTP_ANY || r.method == method)) return &r;
+    }
+    return nullptr;
+}
+
+void WebServer::beginRequest(HTTPMethod method, const char* uri, const std::vector<SimArg>& args,
+                             const std::vector<SimArg>& headers) {
+    method_ = method;
+    uri_ = uri;
+    args_ = args;
+    requestHeaders_ = headers;
+    pendingHeaders_.clear();
+    contentLength_ = CONTENT_LENGTH_NOT_SET;
+    response_ = SimResponse();
+}
+
+bool WebServer::simRequest(HTTPMethod method, const char* uri, const std::vector<SimArg>& args,
+                           const std::vector<SimArg>& headers) {
+    beginRequest(method, uri, args, headers);
+    const Route* route = findRoute(method, uri);
+    if (!route) {
+        if (notFound_) {
+            notFound_();
+        } else {
+            send(404, "text/plain", "Not found");
+        }
+        return false;
+    }
+    route->handler();
+    return true;
+}
+
+bool WebServer::simUpload(const char* uri, const char* filename, const uint8_t* data, size_t len,
+                          const std::vector<SimArg>& args, size_t chunkSize) {
+    if (chunkSize == 0 || chunkSize > HTTP_UPLOAD_BUFLEN) chunkSize = HTTP_UPLOAD_BUFLEN;
+    // 本物の WebServer と同じく Content-Length はリクエスト全体の長さ（ここでは本文だけ）
+    beginRequest(HTTP_POST, uri, args, {{"Content-Length", String((unsigned long)len)}});
+    const Route* route = findRoute(HTTP_POST, uri);
+    if (!route) {
+        send(404, "text/plain", "Not found");
+        return false;
+    }
+
+    upload_.filename = filename;
+    upload_.name = "file";
+    upload_.type = "application/octet-stream";
+    upload_.totalSize = 0;
+    upload_.currentSize = 0;
+    upload_.status = UPLOAD_FILE_START;
+    if (route->uploadHandler) route->uploadHandler();
+
+    // バッファがいっぱいになるたびに渡し、渡し終えてから totalSize に足す（本物と同じ順）
+    upload_.status = UPLOAD_FILE_WRITE;
+    for (size_t pos = 0; pos < len; pos += chunkSize) {
+        size_t n = len - pos < chunkSize ? len - pos : chunkSize;
+        memcpy(upload_.buf, data + pos, n);
+        upload_.currentSize = n;
+        if (route->uploadHandler) route->uploadHandler();
+        upload_.totalSize += n;
+    }
+
+    upload_.currentSize = 0;
+    upload_.status = UPLOAD_FILE_END;
+    if (route->uploadHandler) route->uploadHandler();
+    route->handler();
+    return true;
+}
@@ -0,0 +1,94 @@
+#include "async_log.h"
+#include "mpsc_ring.h"
+#include "task_config.h"
+
+struct LogRecord {
+    uint8_t fmt;
+    uint8_t blobLen;
+    uint32_t args[4];
+    uint8_t blob[LOG_BLOB_MAX];
+};
+
+// 書式文字列の表（LogFormat の順）。16進ダンプはこの後ろに続けて出す
+static const char* const LOG_FORMATS[LOG_FMT_COUNT] = {
+    "[%04X]: ",
+    "CAN Transmit failed (Check if driver is started)",
+    "--- CAN Transmission End ---",
+    "TX job %u: aborted after bus-off",
+    "CAN bus-off: recovering (%u frames to resend)",
+    "CAN bus-off: recovery failed",
+    "ISO-TP: receiver reported overflow",
+    "ISO-TP: flow control timeout",
+    "RX ID: 0x%03X, Data: ",
+};
+
+static const uint32_t LOG_RING_SIZE = 128;
+static MpscRing<LogRecord, LOG_RING_SIZE> logRing;
+static TaskHandle_t logTaskHandle = nullptr;
+
+volatile uint8_t logMaxLevel = LOG_DEBUG;
+volatile uint32_t logCategoryMask = (1u << LOG_CAT_COUNT) - 1;
+
+static void pushRecord(LogFormat fmt, const uint32_t* args, const uint8_t* data, size_t len) {
+    LogRecord rec;
+    rec.fmt = fmt;
+    rec.blobLen = len > LOG_BLOB_MAX ? LOG_BLOB_MAX : len;
+    memcpy(rec.args, args, sizeof(rec.args));
+    if (rec.blobLen) memcpy(rec.blob, data, rec.blobLen);
+    if (logRing.push(rec) && logTaskHandle) xTaskNotifyGive(logTaskHandle);
+}
+
+void logWrite(LogCategory cat, LogLevel level, LogFormat fmt,
+              uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3) {
+    if (!logEnabled(cat, level)) return;
+    const uint32_t args[4] = {a0, a1, a2, a3};
+    pushRecord(fmt, args, nullptr, 0);
+}
+
+void logWriteHex(LogCategory cat, LogLevel level, LogFormat fmt, uint32_t a0,
+                 const uint8_t* data, size_t len) {
+    if (!logEnabled(cat, level)) return;
+    const uint32_t args[4] = {a0, 0, 0, 0};
+    pushRecord(fmt, args, data, len);
+}
+
+uint32_t logDropped() {
+    return logRing.dropped();
+}
+
+void logConfigure(LogLevel maxLevel, uint32_t categoryMask) {
+    logMaxLevel = maxLevel;
+    logCategoryMask = categoryMask | (1u << LOG_CAT_SYS);
+}
+
+static void printRecord(const LogRecord& rec) {
+    char line[160];
+    int n = snprintf(line, sizeof(line), LOG_FORMATS[rec.fmt], rec.args[0], rec.args[1], rec.args[2], rec.args[3]);
+    if (n < 0) return;
+    if ((size_t)n >= sizeof(line)) n = sizeof(line) - 1;
+    for (uint8_t i = 0; i < rec.blobLen && (size_t)n + 4 < sizeof(line); i++) {
+        n += snprintf(line + n, sizeof(line) - n, "%02X ", rec.blob[i]);
+    }
+    line[n++] = '\n';
+    Serial.write((const uint8_t*)line, n);
+}
+
+static void logTask(void*) {
+    uint32_t reportedDrops = 0;
+    LogRecord rec;
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+        while (logRing.pop(&rec)) printRecord(rec);
+
+        // 捨てた分があれば、出力が追いついたところで件数を出す
+        uint32_t drops = logRing.dropped();
+        if (drops != reportedDrops) {
+            Serial.printf("(%u log records dropped)\n", drops - reportedDrops);
+            reportedDrops = drops;
+        }
+    }
+}
+
+void setupLog() {
+    xTaskCreatePinnedToCore(logTask, "log", LOG_TASK_STACK, nullptr, LOG_TASK_PRIORITY, &logTaskHandle, NET_CORE);
+}
@@ -0,0 +1,228 @@
+#include "block_upload.h"
+#include "esp_rom_crc.h"
+
+static const uint32_t BLOCK_MAP_MAGIC = 0x314B4C42; // "BLK1"
+
+// .map の先頭。続けて blocks ビットのビットマップ（1 = 受信済み）
+struct BlockMapHeader {
+    uint32_t magic;
+    uint32_t size;
+    uint32_t blockSize;
+    uint32_t blocks;
+};
+
+// 作業ファイル名: /staging/ + 保存先パスの '/' を '_' にしたもの + 拡張子
+static void stagingPath(const char* path, const char* ext, char* out, size_t outSize) {
+    int n = snprintf(out, outSize, "%s/", BLOCK_STAGING_DIR);
+    for (const char* p = path[0] == '/' ? path + 1 : path; *p && (size_t)n + 1 < outSize; p++) {
+        out[n++] = *p == '/' ? '_' : *p;
+    }
+    out[n] = '\0';
+    strlcat(out, ext, outSize);
+}
+
+static bool readHeader(const char* path, BlockMapHeader* header) {
+    char mapPath[UPLOAD_PATH_MAX + 16];
+    stagingPath(path, ".map", mapPath, sizeof(mapPath));
+    File f = LittleFS.open(mapPath, "r");
+    if (!f) return false;
+    bool ok = f.read((uint8_t*)header, sizeof(*header)) == sizeof(*header) && header->magic == BLOCK_MAP_MAGIC;
+    f.close();
+    return ok;
+}
+
+static uint32_t blockLength(const BlockMapHeader& h, uint32_t index) {
+    uint32_t start = index * h.blockSize;
+    return h.size - start < h.blockSize ? h.size - start : h.blockSize;
+}
+
+const char* blockResultName(BlockResult result) {
+    switch (result) {
+        case BLOCK_OK:              return "ok";
+        case BLOCK_NO_SESSION:      return "no session";
+        case BLOCK_BAD_PARAMS:      return "bad parameters";
+        case BLOCK_BAD_INDEX:       return "bad index";
+        case BLOCK_BAD_LENGTH:      return "bad length";
+        case BLOCK_CRC_MISMATCH:    return "crc mismatch";
+        case BLOCK_INCOMPLETE:      return "incomplete";
+        case BLOCK_DIGEST_MISMATCH: return "file crc mismatch";
+        case BLOCK_NO_SPACE:        return "no space";
+        default:                    return "io error";
+    }
+}
+
+void setupBlockUpload() {
+    if (!LittleFS.exists(BLOCK_STAGING_DIR)) LittleFS.mkdir(BLOCK_STAGING_DIR);
+}
+
+BlockResult blockUploadBegin(const char* path, uint32_t size, uint32_t blockSize, BlockSession* session) {
+    if (size == 0 || blockSize < BLOCK_SIZE_MIN || blockSize > BLOCK_SIZE_MAX) return BLOCK_BAD_PARAMS;
+    uint32_t blocks = (size + blockSize - 1) / blockSize;
+    if (blocks > BLOCK_COUNT_MAX) return BLOCK_BAD_PARAMS;
+
+    // 同じ条件のセッションが残っていれば再開する
+    BlockMapHeader h;
+    if (readHeader(path, &h) && h.size == size && h.blockSize == blockSize) {
+        return blockUploadStatus(path, session, nullptr, 0, nullptr);
+    }
+
+    blockUploadAbort(path);
+    if (size > LittleFS.totalBytes() - LittleFS.usedBytes()) return BLOCK_NO_SPACE;
+
+    char partPath[UPLOAD_PATH_MAX + 16];
+    char mapPath[UPLOAD_PATH_MAX + 16];
+    stagingPath(path, ".part", partPath, sizeof(partPath));
+    stagingPath(path, ".map", mapPath, sizeof(mapPath));
+
+    // 本体は空で作り、各ブロックは後から該当位置へ書く
+    File part = LittleFS.open(partPath, "w");
+    if (!part) return BLOCK_IO_ERROR;
+    part.close();
+
+    File map = LittleFS.open(mapPath, "w");
+    if (!map) return BLOCK_IO_ERROR;
+    h = {BLOCK_MAP_MAGIC, size, blockSize, blocks};
+    bool ok = map.write((const uint8_t*)&h, sizeof(h)) == sizeof(h);
+    uint8_t zeros[64] = {};
+    for (uint32_t left = (blocks + 7) / 8; ok && left > 0;) {
+        uint32_t n = left < sizeof(zeros) ? left : sizeof(zeros);
+        ok = map.write(zeros, n) == n;
+        left -= n;
+    }
+    map.close();
+    if (!ok) {
+        blockUploadAbort(path);
+        return BLOCK_IO_ERROR;
+    }
+
+    session->size = size;
+    session->blockSize = blockSize;
+    session->blocks = blocks;
+    session->received = 0;
+    return BLOCK_OK;
+}
+
+BlockResult blockUploadStatus(const char* path, BlockSession* session,
+                              uint32_t* missing, size_t maxMissing, size_t* missingCount) {
+    char mapPath[UPLOAD_PATH_MAX + 16];
+    stagingPath(path, ".map", mapPath, sizeof(mapPath));
+    File f = LittleFS.open(mapPath, "r");
+    if (!f) return BLOCK_NO_SESSION;
+    BlockMapHeader h;
+    if (f.read((uint8_t*)&h, sizeof(h)) != sizeof(h) || h.magic != BLOCK_MAP_MAGIC) {
+        f.close();
+        return BLOCK_NO_SESSION;
+    }
+
+    session->size = h.size;
+    session->blockSize = h.blockSize;
+    session->blocks = h.blocks;
+    session->received = 0;
+    size_t found = 0;
+    uint8_t bits[64];
+    for (uint32_t index = 0; index < h.blocks;) {
+        size_t n = f.read(bits, sizeof(bits));
+        if (n == 0) break;
+        for (size_t i = 0; i < n * 8 && index < h.blocks; i++, index++) {
+            if (bits[i / 8] & (1 << (i % 8))) {
+                session->received++;
+            } else {
+                if (found < maxMissing) missing[found] = index;
+                found++;
+            }
+        }
+    }
+    f.close();
+    if (missingCount) *missingCount = found;
+    return BLOCK_OK;
+}
+
+BlockResult blockUploadCommit(const char* path, const uint32_t* expectedCrc, UploadDigest* digest) {
+    BlockSession session;
+    BlockResult result = blockUploadStatus(path, &session, nullptr, 0, nullptr);
+    if (result != BLOCK_OK) return result;
+    if (session.received != session.blocks) return BLOCK_INCOMPLETE;
+
+    char partPath[UPLOAD_PATH_MAX + 16];
+    stagingPath(path, ".part", partPath, sizeof(partPath));
+    if (!computeFileDigest(partPath, digest) || digest->size != session.size) return BLOCK_IO_ERROR;
+    if (expectedCrc && digest->crc32 != *expectedCrc) return BLOCK_DIGEST_MISMATCH;
+
+    // ここで初めて元のファイルを置き換える
+    String sumPath = String(path) + ".sum";
+    LittleFS.remove(sumPath);
+    LittleFS.remove(path);
+    if (!LittleFS.rename(partPath, path)) return BLOCK_IO_ERROR;
+    saveUploadDigest(path, *digest);
+    blockUploadAbort(path);
+    return BLOCK_OK;
+}
+
+void blockUploadAbort(const char* path) {
+    char stagePath[UPLOAD_PATH_MAX + 16];
+    stagingPath(path, ".part", stagePath, sizeof(stagePath));
+    LittleFS.remove(stagePath);
+    stagingPath(path, ".map", stagePath, sizeof(stagePath));
+    LittleFS.remove(stagePath);
+}
+
+BlockResult BlockWriter::begin(const char* path, uint32_t index) {
+    abort();
+    BlockMapHeader h;
+    if (!readHeader(path, &h)) return state_ = BLOCK_NO_SESSION;
+    if (index >= h.blocks) return state_ = BLOCK_BAD_INDEX;
+
+    char partPath[UPLOAD_PATH_MAX + 16];
+    stagingPath(path, ".part", partPath, sizeof(partPath));
+    // "r+" で開き、ブロックの位置へ移動して上書きする（ファイル末尾より先なら間は0で埋まる）
+    file_ = LittleFS.open(partPath, "r+");
+    if (!file_ || !file_.seek(index * h.blockSize)) {
+        file_.close();
+        return state_ = BLOCK_IO_ERROR;
+    }
+    strlcpy(path_, path, sizeof(path_));
+    index_ = index;
+    expected_ = blockLength(h, index);
+    received_ = 0;
+    crc_ = 0;
+    return state_ = BLOCK_OK;
+}
+
+void BlockWriter::write(const uint8_t* data, size_t len) {
+    if (state_ != BLOCK_OK) return;
+    if (received_ + len > expected_) {
+        state_ = BLOCK_BAD_LENGTH;
+        return;
+    }
+    crc_ = esp_rom_crc32_le(crc_, data, len);
+    if (file_.write(data, len) != len) state_ = BLOCK_IO_ERROR;
+    received_ += len;
+}
+
+BlockResult BlockWriter::finish(uint32_t expectedCrc) {
+    if (state_ == BLOCK_OK && received_ != expected_) state_ = BLOCK_BAD_LENGTH;
+    if (state_ == BLOCK_OK && crc_ != expectedCrc) state_ = BLOCK_CRC_MISMATCH;
+    if (file_) file_.close();
+    if (state_ != BLOCK_OK) return state_; // 受信済みにしないので、送り直せば上書きされる
+
+    // ビットマップの該当ビットを立てる
+    char mapPath[UPLOAD_PATH_MAX + 16];
+    stagingPath(path_, ".map", mapPath, sizeof(mapPath));
+    File map = LittleFS.open(mapPath, "r+");
+    size_t pos = sizeof(BlockMapHeader) + index_ / 8;
+    uint8_t bits = 0;
+    if (!map || !map.seek(pos) || map.read(&bits, 1) != 1) {
+        map.close();
+        return state_ = BLOCK_IO_ERROR;
+    }
+    bits |= 1 << (index_ % 8);
+    bool ok = map.seek(pos) && map.write(&bits, 1) == 1;
+    map.close();
+    state_ = ok ? BLOCK_OK : BLOCK_IO_ERROR;
+    return state_;
+}
+
+void BlockWriter::abort() {
+    if (file_) file_.close();
+    state_ = BLOCK_NO_SESSION;
+}
@@ -0,0 +1,138 @@
+#include "can_rx.h"
+#include "esp_timer.h"
+#include "can_tx.h"
+#include "spsc_ring.h"
+#include "task_config.h"
+#include "loopback_test.h"
+
+// 消費者ごとのリング（生産者は受信タスク）
+static SpscRing<RxFrame, 256> monitorRing;  // シリアル表示は間引いてよいので浅め
+static SpscRing<RxFrame, 1024> captureRing; // フラッシュ書き込み待ちを吸収する
+static SpscRing<RxFrame, 512> liveRing;     // Wi-Fi送信のまとめ待ち (100ms分程度)
+static volatile bool consumerEnabled[RX_CONSUMER_COUNT] = {true, false, false};
+
+// 消費者ごとのIDフィルタ（filterActive が false の間に書き換える）
+static RxIdFilter consumerFilters[RX_CONSUMER_COUNT];
+static volatile bool filterActive[RX_CONSUMER_COUNT] = {false, false, false};
+
+// 標準ID全2048個分の統計と、受信済みIDのビットマップ
+static RxIdStats idStats[CAN_STD_ID_COUNT];
+static uint32_t activeIds[CAN_STD_ID_COUNT / 32];
+
+static RxCounters counters = {};
+
+static void updateStats(const RxFrame& frame) {
+    counters.frames++;
+    if (frame.flags & RX_FLAG_EXTD) {
+        counters.extended++;
+        return;
+    }
+
+    uint16_t id = frame.identifier & (CAN_STD_ID_COUNT - 1);
+    RxIdStats& st = idStats[id];
+    uint32_t now = (uint32_t)frame.timestampUs;
+    if (st.count > 0) {
+        uint32_t gap = now - st.lastUs;
+        if (st.count == 1 || gap < st.minGapUs) st.minGapUs = gap;
+        if (gap > st.maxGapUs) st.maxGapUs = gap;
+    } else {
+        activeIds[id / 32] |= (1UL << (id % 32));
+    }
+    st.lastUs = now;
+    st.count++;
+}
+
+static bool accepts(RxConsumer consumer, const RxFrame& frame) {
+    if (!consumerEnabled[consumer]) return false;
+    if (!filterActive[consumer]) return true;
+    const RxIdFilter& f = consumerFilters[consumer];
+    if (frame.flags & RX_FLAG_EXTD) return f.extended;
+    uint16_t id = frame.identifier & (CAN_STD_ID_COUNT - 1);
+    return (f.stdIds[id / 32] >> (id % 32)) & 1;
+}
+
+static void pushRings(const RxFrame& frame) {
+    if (accepts(RX_CONSUMER_MONITOR, frame)) monitorRing.push(frame);
+    if (accepts(RX_CONSUMER_CAPTURE, frame)) captureRing.push(frame);
+    if (accepts(RX_CONSUMER_LIVE, frame)) liveRing.push(frame);
+}
+
+// TWAIドライバの受信キューを空にし続けるタスク
+static void rxTask(void*) {
+    twai_message_t msg;
+    for (;;) {
+        if (twai_receive(&msg, portMAX_DELAY) != ESP_OK) continue;
+
+        RxFrame frame;
+        frame.timestampUs = esp_timer_get_time();
+        frame.identifier = msg.identifier;
+        frame.flags = (msg.extd ? RX_FLAG_EXTD : 0) | (msg.rtr ? RX_FLAG_RTR : 0);
+        frame.dlc = msg.data_length_code > 8 ? 8 : msg.data_length_code;
+        memcpy(frame.data, msg.data, frame.dlc);
+
+        // ISO-TP送信中のFlow Controlはここで即座に送信タスクへ渡す
+        canTxOnReceive(msg);
+        // 自己受信試験中は送ったフレームと照合する
+        loopbackOnReceive(msg, frame.timestampUs);
+
+        updateStats(frame);
+        pushRings(frame);
+    }
+}
+
+void setupCANRx() {
+    xTaskCreatePinnedToCore(rxTask, "canRx", CAN_RX_TASK_STACK, nullptr, CAN_RX_TASK_PRIORITY, nullptr, CAN_CORE);
+}
+
+bool canRxPop(RxConsumer consumer, RxFrame* out) {
+    switch (consumer) {
+        case RX_CONSUMER_MONITOR: return monitorRing.pop(out);
+        case RX_CONSUMER_CAPTURE: return captureRing.pop(out);
+        case RX_CONSUMER_LIVE:    return liveRing.pop(out);
+        default: return false;
+    }
+}
+
+void canRxSetConsumerEnabled(RxConsumer consumer, bool enabled) {
+    if (consumer < RX_CONSUMER_COUNT) consumerEnabled[consumer] = enabled;
+}
+
+void canRxSetConsumerFilter(RxConsumer consumer, const RxIdFilter* filter) {
+    if (consumer >= RX_CONSUMER_COUNT) return;
+    filterActive[consumer] = false;
+    if (!filter) return;
+    consumerFilters[consumer] = *filter;
+    filterActive[consumer] = true;
+}
+
+const RxIdStats* canRxStats(uint32_t id) {
+    if (id >= CAN_STD_ID_COUNT) return nullptr;
+    return &idStats[id];
+}
+
+int canRxNextActiveId(int from) {
+    if (from < 0) from = 0;
+    while (from < CAN_STD_ID_COUNT) {
+        uint32_t word = activeIds[from / 32] >> (from % 32);
+        if (word) return from + __builtin_ctz(word);
+        from = (from / 32 + 1) * 32; // 次のワードへ
+    }
+    return -1;
+}
+
+void canRxUpdateRates() {
+    for (int id = canRxNextActiveId(0); id >= 0; id = canRxNextActiveId(id + 1)) {
+        RxIdStats& st = idStats[id];
+        uint16_t now = (uint16_t)st.count;
+        st.rateFps = (uint16_t)(now - st.prevCount);
+        st.prevCount = now;
+    }
+}
+
+RxCounters canRxCounters() {
+    RxCounters c = counters;
+    c.ringDrops[RX_CONSUMER_MONITOR] = monitorRing.dropped();
+    c.ringDrops[RX_CONSUMER_CAPTURE] = captureRing.dropped();
+    c.ringDrops[RX_CONSUMER_LIVE] = liveRing.dropped();
+    return c;
+}
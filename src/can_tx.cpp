@@ -0,0 +1,832 @@
+#include "can_tx.h"
+#include "isotp.h"
+#include "frame_scheduler.h"
+#include "trace_reader.h"
+#include "prefetch_reader.h"
+#include "inflate_reader.h"
+#include "metrics.h"
+#include "rate_control.h"
+#include "task_config.h"
+#include "async_log.h"
+#include "loopback_test.h"
+#include <new>
+
+// キュー・タスク設定
+static const UBaseType_t FRAME_QUEUE_LEN = 64; // 先読みしておくフレーム数
+static const UBaseType_t FC_QUEUE_LEN = 4;
+static const size_t TX_HISTORY_LEN = 32; // バスオフ時の送り直し用（ドライバの送信キュー16より多く）
+
+// フレームキューに積む要素の種類
+// ジョブの開始・終了もキュー経由で伝え、送信タスク側で状態を切り替える
+enum TxFrameKind : uint8_t {
+    FRAME_DATA = 0,
+    FRAME_JOB_START, // offset にファイルサイズ、gapAfterUs に送信間隔の初期値を入れる
+                     // 送信タスクはジョブ表の slot を見て、ジョブごとの進捗を更新する
+    FRAME_JOB_END,
+    FRAME_JOB_FAILED
+};
+
+// ISO-TPのフロー制御が必要なフレームの目印
+enum TxIsoTpRole : uint8_t {
+    ISOTP_ROLE_NONE = 0, // 従来方式 / Single Frame
+    ISOTP_ROLE_FIRST,    // 送信後にFlow Controlを待つ
+    ISOTP_ROLE_CONSECUTIVE, // BlockSize と STmin に従う
+    ISOTP_ROLE_LAST_CF   // メッセージ最後のCF。STmin には従うが、後にFCは来ない
+};
+
+// フレームキューに積む1フレーム分の情報
+struct TxFrame {
+    twai_message_t msg;
+    uint32_t gapAfterUs; // このフレームの送信開始から次のフレームまでの間隔 (µs)
+    uint32_t jobId;
+    uint32_t offset;     // このフレームまで送ると何byte送信済みになるか
+    uint8_t slot;        // ジョブ表の位置
+    TxFrameKind kind;
+    TxIsoTpRole isotpRole;
+    uint32_t fcId;       // ISOTP_ROLE_FIRST: Flow Controlを受け取るID
+    int64_t dueUs;       // リプレイ: ジョブの最初のフレームからの送信予定時刻 (µs)。負なら gapAfterUs で数える
+};
+
+// ジョブ表の1件。job は投入後は書き換えない。info と各フラグは statusMux で守る
+// 終了したジョブは /jobs に残し、空きがなくなったら古いものから再利用する
+struct JobSlot {
+    TxJob job;
+    TxJobInfo info;
+    bool used;
+    bool claimed;                 // 読み込みタスクが取り出した
+    volatile bool cancelRequested; // 読み込みタスクは積むのをやめ、送信タスクは残りを捨てる
+    bool aborted;                 // バスオフやFC失敗で中断した（送信タスクだけが使う）
+};
+
+static JobSlot jobSlots[TX_JOB_TABLE_LEN];
+static QueueHandle_t frameQueue = nullptr;
+static TaskHandle_t readerTaskHandle = nullptr;
+static portMUX_TYPE statusMux = portMUX_INITIALIZER_UNLOCKED;
+static TxStatus txStatus = {};
+static uint32_t nextJobId = 1;
+static volatile bool interleaveJobs = false;
+
+// 送信ファイルの読み込み（読み込みタスクだけが使う。バッファが大きいので静的に置く）
+static PrefetchReader fileReader;
+static InflateReader inflateReader(fileReader); // 圧縮ファイルは fileReader から読んで展開する
+// 交互送信の2つ目以降のジョブ用（初めて交互送信するときに確保し、以後使い回す）
+static PrefetchReader* interleaveReaders[TX_INTERLEAVE_MAX] = {};
+
+// 直近にドライバへ渡したフレーム（送信タスクだけが使う）
+static TxFrame txHistory[TX_HISTORY_LEN];
+static uint32_t txHistoryCount = 0; // 現在のジョブで記録した総数
+
+// ISO-TP Flow Control 受け渡し用
+static QueueHandle_t fcQueue = nullptr;
+static volatile uint32_t fcExpectId = UINT32_MAX; // FC待ちでなければ UINT32_MAX
+
+// twai_transmit の共通部分 (ノーアック・モード対応)
+// selfRx なら自己受信要求を付け、自己受信試験に送信時刻を渡す
+// resent (バスオフ後の送り直し) は最初の送信で試験に記録済みなので、自己受信要求だけ付ける
+static bool transmitMessage(twai_message_t& message, bool selfRx = false, bool resent = false) {
+    message.ss = 1;             // Single Shot送信 (再送しない設定: NO_ACK時推奨)
+    message.self = selfRx ? 1 : 0;
+    message.dlc_non_comp = 0;
+    bool track = selfRx && !resent;
+
+    // 受信タスクの方が優先度が高く、渡した直後に受信されることがあるので先に記録する
+    if (track) loopbackOnTransmit(message, esp_timer_get_time());
+
+    // 第2引数のタイムアウトを少し長めに取るか、即時送信(0)にします
+    if (twai_transmit(&message, pdMS_TO_TICKS(10)) != ESP_OK) {
+        if (track) loopbackOnTransmitFailed();
+        metricsCountTx(message.identifier, false);
+        logWrite(LOG_CAT_TX, LOG_ERROR, LOG_FMT_TX_FAILED);
+        return false;
+    }
+    metricsCountTx(message.identifier, true);
+    return true;
+}
+
+// CAN送信処理 (8byteずつ送信) (ノーアック・モード対応)
+bool sendCAN(uint32_t id, const uint8_t* data, uint8_t len) {
+    twai_message_t message;
+    // フラグに「ACKを期待しない」設定を明示（ドライバ内部でNO_ACKモードと連動します）
+    message.flags = TWAI_MSG_FLAG_NONE;
+    message.identifier = id;
+    message.extd = 0;           // 標準ID(11bit)
+    message.rtr = 0;            // データフレーム
+    message.data_length_code = len;
+
+    for (int i = 0; i < len; i++) {
+        message.data[i] = data[i];
+    }
+    return transmitMessage(message);
+}
+
+// 送信間隔を決める。バス負荷率指定があれば DLC から計算し、なければ設定値(µs)を使う
+static uint32_t frameIntervalUs(const TxJob& job, uint8_t dlc, uint32_t configuredUs) {
+    if (job.busLoadPct > 0) return busLoadIntervalUs(dlc, job.busLoadPct);
+    return configuredUs;
+}
+
+// フレームキューに1フレーム積む（満杯なら送信タスクが空けるまで待つ）
+static void pushMessage(const TxJob& job, const twai_message_t& msg, uint32_t gapAfterUs,
+                        uint32_t offset, TxIsoTpRole role = ISOTP_ROLE_NONE, int64_t dueUs = -1) {
+    TxFrame frame = {};
+    frame.msg = msg;
+    frame.gapAfterUs = gapAfterUs;
+    frame.jobId = job.jobId;
+    frame.offset = offset;
+    frame.slot = job.slot;
+    frame.isotpRole = role;
+    frame.fcId = job.isotpRxId;
+    frame.dueUs = dueUs;
+    xQueueSend(frameQueue, &frame, portMAX_DELAY);
+}
+
+// 標準IDのデータフレームとして積む
+static void pushFrame(const TxJob& job, uint32_t id, const uint8_t* data, uint8_t len,
+                      uint32_t gapAfterUs, uint32_t offset, TxIsoTpRole role = ISOTP_ROLE_NONE) {
+    twai_message_t msg = {};
+    msg.identifier = id;
+    msg.data_length_code = len;
+    memcpy(msg.data, data, len);
+    pushMessage(job, msg, frameIntervalUs(job, len, gapAfterUs), offset, role);
+}
+
+// ジョブの開始・終了をフレームキューに積む
+static void pushMarker(const TxJob& job, TxFrameKind kind, uint32_t offset) {
+    TxFrame marker = {};
+    marker.jobId = job.jobId;
+    marker.offset = offset;
+    marker.slot = job.slot;
+    marker.kind = kind;
+    marker.gapAfterUs = job.packetGap * 1000 + job.packetGapUs;
+    marker.dueUs = -1;
+    xQueueSend(frameQueue, &marker, portMAX_DELAY);
+}
+
+// /jobs/cancel で取り消されたか（読み込み中のループごとに見る）
+static bool cancelRequested(const TxJob& job) {
+    return jobSlots[job.slot].cancelRequested;
+}
+
+// ISO-TP用: ファイルを isotpPayloadSize ごとのメッセージに分け、SF または FF+CF として積む
+// Reader は PrefetchReader (そのまま) か InflateReader (展開しながら)
+template <class Reader>
+static void processFileIsoTp(const TxJob& job, Reader& f) {
+    uint16_t payloadSize = job.isotpPayloadSize;
+    if (payloadSize == 0 || payloadSize > ISOTP_MAX_PAYLOAD) payloadSize = ISOTP_MAX_PAYLOAD;
+
+    Serial.printf("Job %u: ISO-TP TX=0x%X, RX=0x%X, Payload=%u\n",
+                  job.jobId, job.isotpTxId, job.isotpRxId, payloadSize);
+    uint8_t data[ISOTP_SF_MAX_DATA];
+    uint8_t frame[8];
+    while (f.available() && !cancelRequested(job)) {
+        size_t msgStart = f.position();
+        size_t remaining = f.size() - msgStart;
+        uint16_t msgLen = remaining < payloadSize ? remaining : payloadSize;
+
+        if (msgLen <= ISOTP_SF_MAX_DATA) {
+            f.read(data, msgLen);
+            uint8_t dlc = isotpBuildSingleFrame(frame, data, msgLen);
+            pushFrame(job, job.isotpTxId, frame, dlc, 0, f.position());
+            continue;
+        }
+
+        f.read(data, ISOTP_FF_DATA);
+        uint8_t dlc = isotpBuildFirstFrame(frame, msgLen, data);
+        pushFrame(job, job.isotpTxId, frame, dlc, 0, f.position(), ISOTP_ROLE_FIRST);
+
+        uint16_t left = msgLen - ISOTP_FF_DATA;
+        uint8_t sn = 1;
+        while (left > 0) {
+            uint8_t n = left < ISOTP_CF_MAX_DATA ? left : ISOTP_CF_MAX_DATA;
+            f.read(data, n);
+            dlc = isotpBuildConsecutiveFrame(frame, sn, data, n);
+            left -= n;
+            pushFrame(job, job.isotpTxId, frame, dlc, 0, f.position(),
+                      left > 0 ? ISOTP_ROLE_CONSECUTIVE : ISOTP_ROLE_LAST_CF);
+            sn = (sn + 1) & 0x0F;
+        }
+    }
+}
+
+// リプレイ用: 速度指定があれば、各フレームをトレース先頭からの時刻（速度倍率で伸縮）で積む
+// 前のフレームからの差で数えると遅れが積み重なるので、送信タスクは絶対時刻で待つ
+// 最速再生 (速度0) はバス負荷率の間隔で詰めて送る
+static void processTrace(const TxJob& job) {
+    TraceReader reader;
+    if (!reader.open(job.path)) {
+        Serial.printf("TX job %u: cannot open %s\n", job.jobId, job.path);
+        pushMarker(job, FRAME_JOB_FAILED, 0);
+        return;
+    }
+    uint16_t loops = job.replayLoops > 0 ? job.replayLoops : 1;
+    uint64_t size = reader.size();
+    // 進捗は 周回 × サイズ で数えるので、32bitに収まらない指定は始めない (/replay でも弾いている)
+    if (size * loops > TX_JOB_BYTES_MAX) {
+        Serial.printf("TX job %u: %u bytes x %u loops is too large\n", job.jobId, (unsigned)size, loops);
+        reader.close();
+        pushMarker(job, FRAME_JOB_FAILED, 0);
+        return;
+    }
+    pushMarker(job, FRAME_JOB_START, (uint32_t)(size * loops));
+
+    Serial.println("--- CAN Replay Start ---");
+    Serial.printf("Job %u: %s (%s), Speed=%u%%, Loops=%u\n", job.jobId, job.path,
+                  reader.format() == TRACE_FORMAT_CAPTURE ? "capture" : "candump",
+                  job.replaySpeedPct, loops);
+    int64_t loopBaseUs = 0; // 2周目以降は前の周の最後のフレームに続けて送る
+    int64_t dueUs = 0;
+    for (uint16_t loop = 0; loop < loops && !cancelRequested(job); loop++) {
+        reader.rewind();
+        twai_message_t msg;
+        uint64_t ts, firstTs = 0;
+        for (bool first = true; !cancelRequested(job) && reader.next(&msg, &ts); first = false) {
+            if (first) firstTs = ts;
+            uint32_t offset = (uint32_t)(loop * size + reader.position());
+            if (job.replaySpeedPct > 0) {
+                // 時刻が戻っている行は直前のフレームと同時刻にする
+                int64_t due = loopBaseUs + (int64_t)((ts > firstTs ? ts - firstTs : 0) * 100 / job.replaySpeedPct);
+                if (due > dueUs) dueUs = due;
+                pushMessage(job, msg, 0, offset, ISOTP_ROLE_NONE, dueUs);
+            } else {
+                // 最速再生でもバス負荷率の上限は守る
+                uint32_t gapUs = job.busLoadPct > 0 ? busLoadIntervalUs(msg.data_length_code, job.busLoadPct) : 0;
+                pushMessage(job, msg, gapUs, offset);
+            }
+        }
+        loopBaseUs = dueUs;
+    }
+    reader.close();
+    pushMarker(job, FRAME_JOB_END, 0);
+}
+
+// 従来方式の読み進め状態（交互送信ではジョブごとに1つ持つ）
+struct ChunkCursor {
+    const TxJob* job;
+    uint32_t packetGapUs;
+    uint32_t chunkIntervalUs;
+    size_t chunkSize;
+    ChunkFramerFn framer;
+    uint8_t seq;
+};
+
+static void beginChunks(ChunkCursor* c, const TxJob& job) {
+    const ChunkLayout& layout = job.layout;
+    c->job = &job;
+    c->packetGapUs = job.packetGap * 1000 + job.packetGapUs;
+    c->chunkIntervalUs = job.chunkInterval * 1000 + job.chunkIntervalUs;
+    c->chunkSize = layout.chunkSize > 0 && layout.chunkSize <= CHUNK_MAX_SIZE ? layout.chunkSize : CHUNK_MAX_SIZE;
+    c->framer = selectChunkFramer(layout);
+    c->seq = 0;
+
+    Serial.println("--- CAN Transmission Start ---");
+    Serial.printf("Job %u: Chunk=%u, IDs=%u (0x%X-), Seq=%s, Checksum=%s, %s\n",
+                  job.jobId, (unsigned)c->chunkSize, layout.idCount, layout.ids[0],
+                  layout.seqCounter ? "on" : "off", layout.checksum ? "on" : "off",
+                  c->framer == buildChunkFrames ? "generic" : "unrolled");
+    Serial.printf("Gap=%uus, Interval=%uus, Load=%u%%\n", c->packetGapUs, c->chunkIntervalUs, job.busLoadPct);
+}
+
+// 1チャンク読んで複数IDのフレームへ割り付けて積む。ファイルの終わりなら false
+template <class Reader>
+static bool pushNextChunk(ChunkCursor& c, Reader& f) {
+    if (!f.available()) return false;
+    const TxJob& job = *c.job;
+    uint8_t buffer[CHUNK_MAX_SIZE];
+    ChunkFrame frames[CHUNK_MAX_FRAMES];
+    size_t chunkStart = f.position();
+    size_t bytesRead = f.read(buffer, c.chunkSize);
+
+    // --- デバッグ用ダンプ（ログタスクが後で書式化する。16byteごとに1行）---
+    if (logEnabled(LOG_CAT_TX, LOG_DEBUG)) {
+        for (size_t i = 0; i < bytesRead; i += LOG_BLOB_MAX) {
+            size_t n = bytesRead - i < LOG_BLOB_MAX ? bytesRead - i : LOG_BLOB_MAX;
+            logWriteHex(LOG_CAT_TX, LOG_DEBUG, LOG_FMT_TX_CHUNK, chunkStart + i, buffer + i, n);
+        }
+    }
+
+    // --- CAN送信処理 ---
+    // チャンク内のフレーム間は packet_gap、チャンクの最後のフレームの後は chunk_interval
+    size_t count = c.framer(job.layout, c.seq++, buffer, bytesRead, frames);
+    for (size_t i = 0; i < count; i++) {
+        const ChunkFrame& fr = frames[i];
+        pushFrame(job, fr.id, fr.data, fr.dlc, i + 1 < count ? c.packetGapUs : c.chunkIntervalUs,
+                  chunkStart + fr.end);
+    }
+    return true;
+}
+
+// 従来方式: チャンクごとに複数IDのフレームへ割り付けて積む
+template <class Reader>
+static void processChunks(const TxJob& job, Reader& f) {
+    ChunkCursor c;
+    beginChunks(&c, job);
+    while (!cancelRequested(job) && pushNextChunk(c, f)) {
+    }
+}
+
+// 読み出しの途中でデータが壊れていると分かったか（展開エラー・CRC不一致）
+static bool streamFailed(const PrefetchReader&) {
+    return false;
+}
+
+static bool streamFailed(const InflateReader& f) {
+    return f.failed();
+}
+
+// 分割処理用: ファイルを読んでフレームキューに積む
+template <class Reader>
+static void processStream(const TxJob& job, Reader& f) {
+    pushMarker(job, FRAME_JOB_START, f.size());
+    if (job.transport == TRANSPORT_ISOTP) {
+        Serial.println("--- CAN Transmission Start (ISO-TP) ---");
+        processFileIsoTp(job, f);
+    } else {
+        processChunks(job, f);
+    }
+    bool failed = streamFailed(f);
+    f.close();
+
+    // 送信タスク側で完了を判定させるための終端（壊れたデータを送ったなら失敗として終える）
+    pushMarker(job, failed ? FRAME_JOB_FAILED : FRAME_JOB_END, 0);
+}
+
+static void processFile(const TxJob& job) {
+    if (job.transport == TRANSPORT_REPLAY) {
+        processTrace(job);
+        return;
+    }
+
+    // gzip はRAMに展開しきらず、決まった大きさの窓で展開しながら送る
+    if (job.compressed) {
+        if (!inflateReader.open(job.path)) {
+            Serial.printf("TX job %u: cannot open %s as gzip\n", job.jobId, job.path);
+            pushMarker(job, FRAME_JOB_FAILED, 0);
+            return;
+        }
+        Serial.printf("Job %u: %u bytes (gzip %u bytes)\n", job.jobId, (unsigned)inflateReader.size(),
+                      (unsigned)inflateReader.compressedSize());
+        processStream(job, inflateReader);
+        return;
+    }
+
+    PrefetchReader& f = fileReader;
+    if (!f.open(job.path)) {
+        Serial.printf("TX job %u: cannot open %s\n", job.jobId, job.path);
+        pushMarker(job, FRAME_JOB_FAILED, 0);
+        return;
+    }
+    Serial.printf("Job %u: %u bytes (%s)\n", job.jobId, (unsigned)f.size(), f.inMemory() ? "in RAM" : "prefetch");
+    processStream(job, f);
+}
+
+// 交互送信で同時に開くリーダーを readers に揃える。1つ目は fileReader、残りは小さいバッファで確保する
+static bool prepareInterleaveReaders(PrefetchReader** readers, size_t count) {
+    readers[0] = &fileReader;
+    for (size_t i = 1; i < count; i++) {
+        if (!interleaveReaders[i]) interleaveReaders[i] = new (std::nothrow) PrefetchReader(PREFETCH_SMALL_BLOCK_SIZE);
+        if (!interleaveReaders[i] || !interleaveReaders[i]->begin()) return false;
+        readers[i] = interleaveReaders[i];
+    }
+    return true;
+}
+
+// 交互送信: 1周ごとに各ジョブから (priority+1) チャンクずつ積む
+// 各ジョブが自分の先読みリーダーを持つ。確保できなければ交互にせず1ジョブずつ送る
+static void processInterleaved(const uint8_t* slots, size_t count) {
+    PrefetchReader* readers[TX_INTERLEAVE_MAX];
+    if (!prepareInterleaveReaders(readers, count)) {
+        Serial.println("Interleave: no memory for prefetch readers, sending jobs one by one");
+        for (size_t i = 0; i < count; i++) processFile(jobSlots[slots[i]].job);
+        return;
+    }
+
+    ChunkCursor cursors[TX_INTERLEAVE_MAX];
+    bool active[TX_INTERLEAVE_MAX] = {};
+    size_t remaining = 0;
+    for (size_t i = 0; i < count; i++) {
+        const TxJob& job = jobSlots[slots[i]].job;
+        PrefetchReader& f = *readers[i];
+        if (!f.open(job.path)) {
+            Serial.printf("TX job %u: cannot open %s\n", job.jobId, job.path);
+            pushMarker(job, FRAME_JOB_FAILED, 0);
+            continue;
+        }
+        Serial.printf("Job %u: %u bytes (interleaved, priority %u, %s)\n", job.jobId, (unsigned)f.size(),
+                      job.priority, f.inMemory() ? "in RAM" : "prefetch");
+        pushMarker(job, FRAME_JOB_START, f.size());
+        beginChunks(&cursors[i], job);
+        active[i] = true;
+        remaining++;
+    }
+
+    while (remaining > 0) {
+        for (size_t i = 0; i < count; i++) {
+            if (!active[i]) continue;
+            const TxJob& job = jobSlots[slots[i]].job;
+            bool more = true;
+            for (uint8_t n = 0; n <= job.priority && more; n++) {
+                more = !cancelRequested(job) && pushNextChunk(cursors[i], *readers[i]);
+            }
+            if (!more) {
+                readers[i]->close();
+                pushMarker(job, FRAME_JOB_END, 0);
+                active[i] = false;
+                remaining--;
+            }
+        }
+    }
+}
+
+static bool isInterleavable(const TxJob& job) {
+    return job.transport == TRANSPORT_RAW && !job.compressed && !job.loopback;
+}
+
+// 待っているジョブのうち、優先度が高く先に投入されたものほど先
+static bool runsBefore(const JobSlot& a, const JobSlot& b) {
+    if (a.job.priority != b.job.priority) return a.job.priority > b.job.priority;
+    return a.job.jobId < b.job.jobId;
+}
+
+// 次に読むジョブを取り出して slots に入れ、件数を返す
+// 交互送信が有効なら、交互送信できるジョブが続く限り TX_INTERLEAVE_MAX まで一緒に取り出す
+static size_t claimNextJobs(uint8_t* slots) {
+    size_t count = 0;
+    portENTER_CRITICAL(&statusMux);
+    for (;;) {
+        int best = -1;
+        for (size_t i = 0; i < TX_JOB_TABLE_LEN; i++) {
+            const JobSlot& s = jobSlots[i];
+            if (!s.used || s.claimed || s.info.state != TX_QUEUED) continue;
+            if (best < 0 || runsBefore(s, jobSlots[best])) best = i;
+        }
+        // 次に送るべきジョブが交互送信できないものなら、それは今のまとまりが終わってから
+        if (best < 0 || (count > 0 && !isInterleavable(jobSlots[best].job))) break;
+        jobSlots[best].claimed = true;
+        slots[count++] = best;
+        if (!interleaveJobs || !isInterleavable(jobSlots[best].job) || count == TX_INTERLEAVE_MAX) break;
+    }
+    portEXIT_CRITICAL(&statusMux);
+    return count;
+}
+
+// ジョブ表からジョブを取り出してフレームを生成するタスク
+static void readerTask(void*) {
+    uint8_t slots[TX_INTERLEAVE_MAX];
+    for (;;) {
+        size_t count = claimNextJobs(slots);
+        if (count == 0) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        } else if (count == 1) {
+            processFile(jobSlots[slots[0]].job);
+        } else {
+            processInterleaved(slots, count);
+        }
+    }
+}
+
+// Flow Control (CTS) を待つ。WAITは N_WFTmax 回まで待ち直す
+// タイムアウト・OVERFLOW・WAIT超過の場合は false
+static bool waitFlowControl(IsoTpFlowControl* fc) {
+    uint8_t waits = 0;
+    twai_message_t msg;
+    while (xQueueReceive(fcQueue, &msg, pdMS_TO_TICKS(ISOTP_TIMEOUT_BS_MS)) == pdTRUE) {
+        if (!isotpParseFlowControl(msg.data, msg.data_length_code, fc)) continue;
+        if (fc->status == ISOTP_FC_CTS) return true;
+        if (fc->status == ISOTP_FC_OVERFLOW) {
+            logWrite(LOG_CAT_ISOTP, LOG_WARN, LOG_FMT_ISOTP_OVERFLOW);
+            return false;
+        }
+        if (++waits > ISOTP_MAX_WAIT_FRAMES) break;
+    }
+    logWrite(LOG_CAT_ISOTP, LOG_WARN, LOG_FMT_ISOTP_TIMEOUT);
+    return false;
+}
+
+// バスオフから復帰し、ドライバのキューごと捨てられたフレームから送り直す
+// current が送れていなければ最後にそれも送る。sentAt に最後の送信時刻を返す
+static bool resumeAfterBusOff(FrameScheduler& scheduler, TxRateController& rate,
+                              const TxFrame& current, bool currentSent, int64_t* sentAt) {
+    uint32_t unsent = rate.unsentFrames();
+    logWrite(LOG_CAT_TX, LOG_WARN, LOG_FMT_BUS_OFF, unsent + (currentSent ? 0 : 1));
+    if (!twaiRecoverBusOff()) {
+        logWrite(LOG_CAT_TX, LOG_ERROR, LOG_FMT_BUS_OFF_FAILED);
+        return false;
+    }
+    portENTER_CRITICAL(&statusMux);
+    txStatus.busOffRecoveries++;
+    portEXIT_CRITICAL(&statusMux);
+
+    uint32_t kept = txHistoryCount < TX_HISTORY_LEN ? txHistoryCount : TX_HISTORY_LEN;
+    if (unsent > kept) unsent = kept;
+    scheduler.reset();
+    for (uint32_t i = 0; i <= unsent; i++) {
+        const TxFrame* f;
+        if (i < unsent) f = &txHistory[(txHistoryCount - unsent + i) % TX_HISTORY_LEN];
+        else if (!currentSent) f = &current;
+        else break;
+
+        *sentAt = scheduler.waitForSlot();
+        twai_message_t msg = f->msg;
+        // 自己受信試験のフレームは送り直しも自己受信で送り、記録済みの元のフレームとして受け取る
+        // current は送信に失敗して記録から外れているので、送り直しではなく新しく記録する
+        if (!transmitMessage(msg, jobSlots[f->slot].job.loopback, f != &current)) return false;
+        portENTER_CRITICAL(&statusMux);
+        txStatus.framesResent++;
+        portEXIT_CRITICAL(&statusMux);
+        scheduler.scheduleNext(*sentAt, rate.gapUs(msg.data_length_code));
+    }
+    if (!currentSent) txHistory[txHistoryCount++ % TX_HISTORY_LEN] = current;
+    return true;
+}
+
+// フレームキューからtwai_transmitへ流し込むタスク
+static void transmitTask(void*) {
+    FrameScheduler scheduler;
+    scheduler.begin();
+    TxRateController rate;
+    TxFrame frame;
+    IsoTpFlowControl fc = {};
+    uint8_t blockLeft = 0;     // 次のFCまでに送れるCF数 (BlockSize=0なら無制限)
+    uint8_t runningJobs = 0;   // 開始済みで終わっていないジョブ数（交互送信では複数）
+    TxJobState groupState = TX_DONE; // 同時に送っているジョブ全体の結果
+    uint32_t replayJobId = 0;  // replayOriginUs を決めたリプレイジョブ (0: 未決定)
+    int64_t replayOriginUs = 0;
+    for (;;) {
+        if (xQueueReceive(frameQueue, &frame, portMAX_DELAY) != pdTRUE) continue;
+        JobSlot& slot = jobSlots[frame.slot];
+        // 閉ループ制御にするか、バスオフ後に途中から再開してよいか
+        // ISO-TP は受信側の状態が分からないので、バスオフ後は途中から再開しない
+        bool adaptive = slot.job.adaptiveRate;
+        bool resumable = slot.job.transport != TRANSPORT_ISOTP;
+        bool loopback = slot.job.loopback;
+
+        if (frame.kind != FRAME_DATA) {
+            portENTER_CRITICAL(&statusMux);
+            if (frame.kind == FRAME_JOB_START) {
+                // 最初のジョブが始まるときだけ全体の状態と送信間隔を初期化する
+                if (runningJobs == 0) {
+                    scheduler.reset();
+                    rate.reset(frame.gapAfterUs);
+                    txHistoryCount = 0;
+                    groupState = TX_DONE;
+                    txStatus.jobId = frame.jobId;
+                    txStatus.state = TX_RUNNING;
+                    txStatus.totalBytes = 0;
+                    txStatus.bytesSent = 0;
+                    txStatus.framesSent = 0;
+                    txStatus.framesFailed = 0;
+                    txStatus.framesResent = 0;
+                    txStatus.rateGapUs = adaptive ? rate.currentGapUs() : 0;
+                }
+                runningJobs++;
+                txStatus.totalBytes += frame.offset;
+                slot.aborted = false;
+                slot.info.state = TX_RUNNING;
+                slot.info.totalBytes = frame.offset;
+            } else {
+                TxJobState end = TX_DONE;
+                if (frame.kind == FRAME_JOB_FAILED || slot.aborted) end = TX_FAILED;
+                else if (slot.cancelRequested) end = TX_CANCELLED;
+                // 全体の結果は 失敗 > 取り消し > 完了 の順で悪い方を残す
+                if (end == TX_FAILED || (end == TX_CANCELLED && groupState == TX_DONE)) groupState = end;
+
+                bool started = slot.info.state == TX_RUNNING;
+                slot.info.state = end;
+                if (started) runningJobs--;
+                if (runningJobs == 0) {
+                    // 開始前に失敗したジョブは単独の結果として出す
+                    if (!started) txStatus.jobId = frame.jobId;
+                    txStatus.state = started ? groupState : end;
+                }
+            }
+            portEXIT_CRITICAL(&statusMux);
+            fcExpectId = UINT32_MAX;
+            if (frame.kind == FRAME_JOB_END) logWrite(LOG_CAT_TX, LOG_INFO, LOG_FMT_TX_END);
+            if (loopback) {
+                if (frame.kind == FRAME_JOB_START) loopbackJobStarted(frame.jobId);
+                else loopbackJobEnded();
+            }
+            continue;
+        }
+
+        // 中断・取り消したジョブの残りは捨てる
+        if (slot.aborted || slot.cancelRequested) continue;
+
+        if (frame.isotpRole == ISOTP_ROLE_FIRST) {
+            // 古いFCを捨ててからFFを送る
+            xQueueReset(fcQueue);
+            fcExpectId = frame.fcId;
+        }
+
+        // リプレイは最初のフレームを送る時刻を基準にした絶対時刻で待つ（遅れても後で取り戻す）
+        if (frame.dueUs >= 0) {
+            if (replayJobId != frame.jobId) {
+                replayJobId = frame.jobId;
+                replayOriginUs = esp_timer_get_time() - frame.dueUs;
+            }
+            scheduler.scheduleAt(replayOriginUs + frame.dueUs);
+        }
+
+        // 送信時刻まで待つ（loop()を止めないよう delay() は使わない）
+        int64_t sentAt = scheduler.waitForSlot();
+        bool ok = transmitMessage(frame.msg, loopback);
+        uint8_t dlc = frame.msg.data_length_code;
+
+        // 閉ループ制御: 毎フレームバスの状態を見て間隔を調整し、失敗したフレームは間隔を広げて送り直す
+        // 固定間隔でも、失敗したときだけはバスオフかどうかを確かめる
+        TxBusHealth health = (adaptive || !ok) ? rate.sample(ok) : BUS_HEALTHY;
+        for (uint8_t retry = 0; adaptive && !ok && health == BUS_STRESSED && retry < RATE_MAX_RETRIES; retry++) {
+            scheduler.scheduleNext(sentAt, rate.gapUs(dlc));
+            sentAt = scheduler.waitForSlot();
+            ok = transmitMessage(frame.msg, loopback);
+            health = rate.sample(ok);
+        }
+        if (ok) txHistory[txHistoryCount++ % TX_HISTORY_LEN] = frame;
+        if (health == BUS_OFF) {
+            if (!resumable || !resumeAfterBusOff(scheduler, rate, frame, ok, &sentAt)) {
+                logWrite(LOG_CAT_TX, LOG_ERROR, LOG_FMT_TX_ABORTED, frame.jobId);
+                slot.aborted = true;
+                fcExpectId = UINT32_MAX;
+                continue;
+            }
+            ok = true;
+            // 復帰に掛かった時間は取り戻さず、リプレイの基準時刻を決め直す
+            replayJobId = 0;
+        }
+
+        portENTER_CRITICAL(&statusMux);
+        if (ok) {
+            txStatus.framesSent++;
+            slot.info.framesSent++;
+        } else {
+            txStatus.framesFailed++;
+            slot.info.framesFailed++;
+        }
+        txStatus.bytesSent += frame.offset - slot.info.bytesSent;
+        slot.info.bytesSent = frame.offset;
+        if (adaptive) txStatus.rateGapUs = rate.currentGapUs();
+        portEXIT_CRITICAL(&statusMux);
+
+        uint32_t intervalUs = adaptive ? rate.gapUs(dlc) : frame.gapAfterUs;
+
+        // --- ISO-TP フロー制御 ---
+        // STmin はCFを送り終えてから次を送り始めるまでの時間なので、送信開始の間隔にはフレーム長を足す
+        bool needFc = false;
+        uint32_t stMinGapUs = fc.stMinUs ? fc.stMinUs + canFrameTimeUs(dlc) : 0;
+        if (frame.isotpRole == ISOTP_ROLE_FIRST) {
+            needFc = true;
+        } else if (frame.isotpRole == ISOTP_ROLE_CONSECUTIVE) {
+            if (fc.blockSize != 0 && --blockLeft == 0) needFc = true;
+            else if (stMinGapUs > intervalUs) intervalUs = stMinGapUs;
+        } else if (frame.isotpRole == ISOTP_ROLE_LAST_CF) {
+            // ブロックの区切りと重なっても、メッセージの最後ではFCを待たない
+            if (stMinGapUs > intervalUs) intervalUs = stMinGapUs;
+            fcExpectId = UINT32_MAX;
+        }
+        if (needFc) {
+            if (!waitFlowControl(&fc)) {
+                slot.aborted = true;
+                fcExpectId = UINT32_MAX;
+                continue;
+            }
+            blockLeft = fc.blockSize;
+            // FC受信直後の最初のCFはすぐに送ってよい
+            scheduler.reset();
+            continue;
+        }
+
+        scheduler.scheduleNext(sentAt, intervalUs);
+    }
+}
+
+void canTxOnReceive(const twai_message_t& msg) {
+    if (!fcQueue || msg.identifier != fcExpectId) return;
+    if (msg.data_length_code == 0 || (msg.data[0] >> 4) != ISOTP_PCI_FC) return;
+    xQueueSend(fcQueue, &msg, 0);
+}
+
+void setupCANTx() {
+    frameQueue = xQueueCreate(FRAME_QUEUE_LEN, sizeof(TxFrame));
+    fcQueue = xQueueCreate(FC_QUEUE_LEN, sizeof(twai_message_t));
+    // ファイル読み込みはネットワーク側、送信はCAN側のコアに固定し、間はフレームキューで受け渡す
+    xTaskCreatePinnedToCore(readerTask, "canReader", TX_READER_TASK_STACK, nullptr, TX_READER_TASK_PRIORITY, &readerTaskHandle, NET_CORE);
+    xTaskCreatePinnedToCore(transmitTask, "canTx", CAN_TX_TASK_STACK, nullptr, CAN_TX_TASK_PRIORITY, nullptr, CAN_CORE);
+}
+
+static bool isFinished(TxJobState state) {
+    return state == TX_DONE || state == TX_FAILED || state == TX_CANCELLED;
+}
+
+// 空きがなければ、終了済みのうち最も古いジョブの場所を使う
+static int findFreeSlot() {
+    int oldest = -1;
+    for (size_t i = 0; i < TX_JOB_TABLE_LEN; i++) {
+        const JobSlot& s = jobSlots[i];
+        if (!s.used) return i;
+        if (isFinished(s.info.state) && (oldest < 0 || s.job.jobId < jobSlots[oldest].job.jobId)) oldest = i;
+    }
+    return oldest;
+}
+
+uint32_t enqueueTxJob(TxJob job) {
+    if (!frameQueue) return 0;
+    if (job.priority > TX_PRIORITY_MAX) job.priority = TX_PRIORITY_MAX;
+
+    portENTER_CRITICAL(&statusMux);
+    int index = findFreeSlot();
+    if (index < 0) {
+        portEXIT_CRITICAL(&statusMux);
+        return 0;
+    }
+    job.jobId = nextJobId++;
+    job.slot = index;
+    JobSlot& s = jobSlots[index];
+    s.job = job;
+    s.info = {};
+    s.info.jobId = job.jobId;
+    memcpy(s.info.path, job.path, sizeof(s.info.path));
+    s.info.priority = job.priority;
+    s.info.state = TX_QUEUED;
+    s.used = true;
+    s.claimed = false;
+    s.cancelRequested = false;
+    s.aborted = false;
+    // 実行中のジョブがなければ待ち状態として表示
+    if (txStatus.state != TX_RUNNING) {
+        txStatus.jobId = job.jobId;
+        txStatus.state = TX_QUEUED;
+    }
+    portEXIT_CRITICAL(&statusMux);
+
+    if (readerTaskHandle) xTaskNotifyGive(readerTaskHandle);
+    return job.jobId;
+}
+
+bool cancelTxJob(uint32_t jobId) {
+    bool found = false;
+    bool loopbackCancelled = false;
+    portENTER_CRITICAL(&statusMux);
+    for (JobSlot& s : jobSlots) {
+        if (!s.used || s.job.jobId != jobId || isFinished(s.info.state)) continue;
+        found = true;
+        if (s.info.state == TX_QUEUED && !s.claimed) {
+            s.info.state = TX_CANCELLED; // まだ読み込みタスクが取り出していない
+            loopbackCancelled = s.job.loopback;
+        } else {
+            s.cancelRequested = true;    // 読み込み・送信の途中で止め、終端で取り消し扱いにする
+        }
+    }
+    portEXIT_CRITICAL(&statusMux);
+    // 終端が送信タスクを通らないので、自己受信試験もここで終える（次の /selftest を受け付けるため）
+    if (loopbackCancelled) loopbackAbort();
+    return found;
+}
+
+size_t listTxJobs(TxJobInfo* out, size_t maxJobs) {
+    size_t count = 0;
+    portENTER_CRITICAL(&statusMux);
+    for (const JobSlot& s : jobSlots) {
+        if (!s.used || count >= maxJobs) continue;
+        // ID順に並べて挿入する
+        size_t i = count++;
+        while (i > 0 && out[i - 1].jobId > s.info.jobId) {
+            out[i] = out[i - 1];
+            i--;
+        }
+        out[i] = s.info;
+    }
+    portEXIT_CRITICAL(&statusMux);
+    return count;
+}
+
+void canTxSetInterleave(bool interleave) {
+    interleaveJobs = interleave;
+}
+
+TxStatus getTxStatus() {
+    portENTER_CRITICAL(&statusMux);
+    TxStatus s = txStatus;
+    s.pendingJobs = 0;
+    for (const JobSlot& slot : jobSlots) {
+        if (slot.used && slot.info.state == TX_QUEUED) s.pendingJobs++;
+    }
+    portEXIT_CRITICAL(&statusMux);
+    s.pendingFrames = frameQueue ? uxQueueMessagesWaiting(frameQueue) : 0;
+    return s;
+}
+
+bool isTxBusy() {
+    TxStatus s = getTxStatus();
+    return s.state == TX_RUNNING || s.pendingJobs > 0 || s.pendingFrames > 0;
+}
+
+const char* txStateName(TxJobState state) {
+    switch (state) {
+        case TX_QUEUED:    return "queued";
+        case TX_RUNNING:   return "running";
+        case TX_DONE:      return "done";
+        case TX_FAILED:    return "failed";
+        case TX_CANCELLED: return "cancelled";
+        default:           return "idle";
+    }
+}
@@ -0,0 +1,233 @@
+#include "capture_log.h"
+#include <LittleFS.h>
+#include "esp_timer.h"
+#include "can_rx.h"
+#include "frame_scheduler.h"
+#include "task_config.h"
+
+// 書き込み・ローテーション設定
+// 4096 は 24 の倍数ではないので、3ブロック (12288byte = 512レコード) を1回の書き込みの単位にする
+// ファイル先頭のヘッダーも1レコードとして数え、満杯のバッチは必ずブロック境界で終わる
+static const size_t CAPTURE_BLOCK_SIZE = 4096;
+static const size_t CAPTURE_BATCH_RECORDS = 512;
+static_assert(CAPTURE_BATCH_RECORDS * sizeof(CaptureRecord) % CAPTURE_BLOCK_SIZE == 0,
+              "capture batch must end on a LittleFS block boundary");
+static const uint32_t CAPTURE_FILE_MAX_BYTES = 128 * 1024;
+static const uint32_t CAPTURE_MAX_FILES = 4;     // 古いものから削除
+static const uint32_t CAPTURE_SYNC_MS = 2000;    // 書きかけのバッチもこの間隔で書き出す
+
+static CaptureRecord batch[CAPTURE_BATCH_RECORDS];
+static size_t batchCount = 0;
+static size_t batchLimit = CAPTURE_BATCH_RECORDS; // 次の境界までのレコード数
+static uint32_t fileRecords = 0;                  // 書き込み中ファイルに書いたレコード数（ヘッダー含む）
+static File captureFile;
+
+static volatile bool startRequested = false;
+static volatile bool stopRequested = false;
+static portMUX_TYPE statusMux = portMUX_INITIALIZER_UNLOCKED;
+static CaptureStatus status = {};
+static uint32_t nextSeq = 1;
+
+void captureFilePath(uint32_t seq, char* out, size_t outSize) {
+    snprintf(out, outSize, "%s/cap%04u.bin", CAPTURE_DIR, seq);
+}
+
+// 既存のキャプチャファイルから次の番号を決める
+static void scanExistingFiles() {
+    File dir = LittleFS.open(CAPTURE_DIR);
+    if (!dir) return;
+    for (File f = dir.openNextFile(); f; f = dir.openNextFile()) {
+        const char* name = strrchr(f.name(), '/');
+        name = name ? name + 1 : f.name();
+        unsigned seq;
+        if (sscanf(name, "cap%u.bin", &seq) == 1 && seq >= nextSeq) nextSeq = seq + 1;
+        f.close();
+    }
+    dir.close();
+}
+
+static bool openNextFile() {
+    char path[32];
+    // 上限を超える古いファイルを削除
+    if (nextSeq > CAPTURE_MAX_FILES) {
+        captureFilePath(nextSeq - CAPTURE_MAX_FILES, path, sizeof(path));
+        if (LittleFS.exists(path)) LittleFS.remove(path);
+    }
+
+    uint32_t seq = nextSeq++;
+    captureFilePath(seq, path, sizeof(path));
+    captureFile = LittleFS.open(path, "w");
+    if (!captureFile) {
+        Serial.printf("Capture: cannot open %s\n", path);
+        return false;
+    }
+
+    // ヘッダーレコード（identifier にビットレートを入れておく）
+    // 単独では書かず、最初のバッチの先頭に入れて一緒に書き出す
+    CaptureRecord& header = batch[0];
+    header = {};
+    header.timestampUs = esp_timer_get_time();
+    header.identifier = CAN_BITRATE;
+    header.flags = CAPTURE_FLAG_HEADER;
+    memcpy(header.data, CAPTURE_MAGIC, sizeof(header.data));
+    batchCount = 1;
+    batchLimit = CAPTURE_BATCH_RECORDS;
+    fileRecords = 0;
+
+    portENTER_CRITICAL(&statusMux);
+    status.fileSeq = seq;
+    status.fileBytes = 0;
+    portEXIT_CRITICAL(&statusMux);
+    return true;
+}
+
+// バッチをまとめて1回で追記する（ファイルは開いたまま）
+static void flushBatch() {
+    if (batchCount == 0) return;
+    if (!captureFile) {
+        batchCount = 0; // 開けなかったファイルの分は捨てる（バッファをあふれさせない）
+        return;
+    }
+    captureFile.write((const uint8_t*)batch, batchCount * sizeof(CaptureRecord));
+    uint32_t written = batchCount - (fileRecords == 0 ? 1 : 0); // ヘッダーは数えない
+    fileRecords += batchCount;
+    batchCount = 0;
+    // 定期同期で途中まで書いた後も、次のバッチは境界までにして揃え直す
+    batchLimit = CAPTURE_BATCH_RECORDS - fileRecords % CAPTURE_BATCH_RECORDS;
+    uint32_t size = captureFile.size();
+
+    portENTER_CRITICAL(&statusMux);
+    status.records += written;
+    status.fileBytes = size;
+    portEXIT_CRITICAL(&statusMux);
+
+    if (size >= CAPTURE_FILE_MAX_BYTES) {
+        captureFile.close();
+        portENTER_CRITICAL(&statusMux);
+        status.rotations++;
+        portEXIT_CRITICAL(&statusMux);
+        openNextFile();
+    }
+}
+
+static void appendRecord(const RxFrame& frame) {
+    CaptureRecord& rec = batch[batchCount++];
+    rec.timestampUs = frame.timestampUs;
+    rec.identifier = frame.identifier;
+    rec.flags = frame.flags;
+    rec.dlc = frame.dlc;
+    rec.reserved = 0;
+    memcpy(rec.data, frame.data, sizeof(rec.data));
+    if (batchCount == batchLimit) flushBatch();
+}
+
+static void captureTask(void*) {
+    uint32_t lastSync = millis();
+    for (;;) {
+        if (startRequested) {
+            startRequested = false;
+            if (!status.active && openNextFile()) {
+                lastSync = millis();
+                portENTER_CRITICAL(&statusMux);
+                status.active = true;
+                status.records = 0;
+                status.rotations = 0;
+                portEXIT_CRITICAL(&statusMux);
+                canRxSetConsumerEnabled(RX_CONSUMER_CAPTURE, true);
+                Serial.printf("Capture started: seq %u\n", status.fileSeq);
+            }
+        }
+
+        if (status.active) {
+            RxFrame frame;
+            while (canRxPop(RX_CONSUMER_CAPTURE, &frame)) appendRecord(frame);
+
+            if (stopRequested) {
+                canRxSetConsumerEnabled(RX_CONSUMER_CAPTURE, false);
+                while (canRxPop(RX_CONSUMER_CAPTURE, &frame)) appendRecord(frame);
+                flushBatch();
+                captureFile.close();
+                portENTER_CRITICAL(&statusMux);
+                status.active = false;
+                portEXIT_CRITICAL(&statusMux);
+                Serial.printf("Capture stopped: %u records\n", status.records);
+            } else if (millis() - lastSync >= CAPTURE_SYNC_MS) {
+                // 電源断で失う範囲を抑えるため、書きかけも定期的にコミットする
+                lastSync = millis();
+                flushBatch();
+                if (captureFile) captureFile.flush();
+            }
+        }
+        stopRequested = false;
+
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+}
+
+void setupCapture() {
+    if (!LittleFS.exists(CAPTURE_DIR)) LittleFS.mkdir(CAPTURE_DIR);
+    scanExistingFiles();
+    xTaskCreatePinnedToCore(captureTask, "capture", CAPTURE_TASK_STACK, nullptr, CAPTURE_TASK_PRIORITY, nullptr, NET_CORE);
+}
+
+void captureStart() {
+    startRequested = true;
+}
+
+void captureStop() {
+    stopRequested = true;
+}
+
+CaptureStatus getCaptureStatus() {
+    portENTER_CRITICAL(&statusMux);
+    CaptureStatus s = status;
+    portEXIT_CRITICAL(&statusMux);
+    s.ringDrops = canRxCounters().ringDrops[RX_CONSUMER_CAPTURE];
+    return s;
+}
+
+size_t captureFormatRecord(const CaptureRecord& rec, CaptureFormat format, uint64_t baseUs,
+                           char* out, size_t outSize) {
+    if (rec.flags & CAPTURE_FLAG_HEADER) return 0;
+    bool extd = rec.flags & RX_FLAG_EXTD;
+    bool rtr = rec.flags & RX_FLAG_RTR;
+    uint8_t dlc = rec.dlc > 8 ? 8 : rec.dlc;
+    int n = 0;
+
+    if (format == CAPTURE_FORMAT_CANDUMP) {
+        // (秒.µs) can0 123#11223344
+        n = snprintf(out, outSize, extd ? "(%llu.%06llu) can0 %08X#" : "(%llu.%06llu) can0 %03X#",
+                     rec.timestampUs / 1000000ULL, rec.timestampUs % 1000000ULL, rec.identifier);
+        if (rtr) {
+            n += snprintf(out + n, outSize - n, "R");
+        } else {
+            for (int i = 0; i < dlc; i++) n += snprintf(out + n, outSize - n, "%02X", rec.data[i]);
+        }
+    } else if (format == CAPTURE_FORMAT_ASC) {
+        //    0.001234 1  123             Rx   d 8 11 22 33 44 55 66 77 88
+        uint64_t rel = rec.timestampUs >= baseUs ? rec.timestampUs - baseUs : 0;
+        char id[12];
+        snprintf(id, sizeof(id), extd ? "%Xx" : "%X", rec.identifier);
+        n = snprintf(out, outSize, "%4llu.%06llu 1  %-15s Rx   %c %u",
+                     rel / 1000000ULL, rel % 1000000ULL, id, rtr ? 'r' : 'd', dlc);
+        if (!rtr) {
+            for (int i = 0; i < dlc; i++) n += snprintf(out + n, outSize - n, " %02X", rec.data[i]);
+        }
+    } else {
+        return 0;
+    }
+
+    if (n < (int)outSize - 1) out[n++] = '\n';
+    return n;
+}
+
+const char* captureAscHeader() {
+    return "date Thu Jan 1 00:00:00.000 1970\n"
+           "base hex  timestamps absolute\n"
+           "internal events logged\n"
+           "Begin Triggerblock\n";
+}
+
+const char* captureAscFooter() {
+    return "End TriggerBlock\n";
+}
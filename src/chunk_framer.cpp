@@ -0,0 +1,74 @@
+#include "chunk_framer.h"
+
+// CRC-8 SAE J1850 (多項式 0x1D, 初期値 0xFF, 最終XOR 0xFF)
+static uint8_t crc8J1850(const uint8_t* data, size_t len) {
+    uint8_t crc = 0xFF;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++) crc = (crc & 0x80) ? (crc << 1) ^ 0x1D : crc << 1;
+    }
+    return crc ^ 0xFF;
+}
+
+size_t buildChecksumFrame(const ChunkLayout& layout, uint8_t seq, const uint8_t* chunk, size_t len, ChunkFrame* out) {
+    out->id = layout.checksumId;
+    out->data[0] = seq;
+    out->data[1] = crc8J1850(chunk, len);
+    out->dlc = 2;
+    out->end = len;
+    return 1;
+}
+
+size_t buildChunkFrames(const ChunkLayout& layout, uint8_t seq, const uint8_t* chunk, size_t len, ChunkFrame* out) {
+    size_t perFrame = layout.seqCounter ? 7 : 8;
+    uint8_t idCount = layout.idCount > 0 ? layout.idCount : 1;
+    size_t count = 0;
+    for (size_t offset = 0; offset < len; offset += perFrame) {
+        size_t n = len - offset < perFrame ? len - offset : perFrame;
+        ChunkFrame& f = out[count];
+        f.id = layout.ids[count % idCount];
+        uint8_t* p = f.data;
+        if (layout.seqCounter) *p++ = seq;
+        memcpy(p, chunk + offset, n);
+        f.dlc = n + (layout.seqCounter ? 1 : 0);
+        f.end = offset + n;
+        count++;
+    }
+    if (layout.checksum && count > 0) count += buildChecksumFrame(layout, seq, chunk, len, out + count);
+    return count;
+}
+
+// よく使う構成 (1フレーム1IDで割り切れるもの) は展開済みの実装を使う
+struct FramerEntry {
+    uint8_t chunkSize;
+    uint8_t idCount;
+    bool seqCounter;
+    bool checksum;
+    ChunkFramerFn fn;
+};
+
+#define FRAMER_VARIANTS(size, ids) \
+    {size, ids, false, false, &ChunkFramer<size, ids, false, false>::build}, \
+    {size, ids, false, true,  &ChunkFramer<size, ids, false, true>::build},  \
+    {size, ids, true,  false, &ChunkFramer<size, ids, true,  false>::build}, \
+    {size, ids, true,  true,  &ChunkFramer<size, ids, true,  true>::build}
+
+static const FramerEntry FRAMERS[] = {
+    FRAMER_VARIANTS(8, 1),
+    FRAMER_VARIANTS(16, 2),
+    FRAMER_VARIANTS(24, 3),
+    FRAMER_VARIANTS(32, 4),
+    FRAMER_VARIANTS(64, 8),
+};
+
+#undef FRAMER_VARIANTS
+
+ChunkFramerFn selectChunkFramer(const ChunkLayout& layout) {
+    for (const FramerEntry& e : FRAMERS) {
+        if (e.chunkSize == layout.chunkSize && e.idCount == layout.idCount &&
+            e.seqCounter == layout.seqCounter && e.checksum == layout.checksum) {
+            return e.fn;
+        }
+    }
+    return buildChunkFrames;
+}
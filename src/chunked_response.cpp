@@ -0,0 +1,62 @@
+#include "chunked_response.h"
+#include <stdarg.h>
+
+void ChunkedResponse::begin(int code, const char* contentType) {
+    server_.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server_.send(code, contentType, "");
+    len_ = 0;
+    sent_ = 0;
+    minFreeHeap_ = ESP.getFreeHeap();
+    open_ = true;
+}
+
+void ChunkedResponse::write(const char* data, size_t len) {
+    while (len > 0) {
+        size_t n = BUF_SIZE - len_;
+        if (n > len) n = len;
+        memcpy(buf_ + len_, data, n);
+        len_ += n;
+        data += n;
+        len -= n;
+        if (len_ == BUF_SIZE) flush();
+    }
+}
+
+void ChunkedResponse::print(const char* text) {
+    write(text, strlen(text));
+}
+
+void ChunkedResponse::printf(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf_ + len_, BUF_SIZE - len_, fmt, args);
+    va_end(args);
+    if (n < 0) return;
+    if ((size_t)n < BUF_SIZE - len_) {
+        len_ += n;
+        return;
+    }
+
+    // 入りきらなかったので一度送ってから先頭に書き直す（1回の printf はバッファ長まで）
+    flush();
+    va_start(args, fmt);
+    n = vsnprintf(buf_, BUF_SIZE, fmt, args);
+    va_end(args);
+    if (n > 0) len_ = (size_t)n < BUF_SIZE ? n : BUF_SIZE - 1;
+}
+
+void ChunkedResponse::flush() {
+    if (len_ == 0) return;
+    server_.sendContent(buf_, len_);
+    sent_ += len_;
+    len_ = 0;
+    uint32_t freeHeap = ESP.getFreeHeap();
+    if (freeHeap < minFreeHeap_) minFreeHeap_ = freeHeap;
+}
+
+void ChunkedResponse::end() {
+    if (!open_) return;
+    flush();
+    server_.sendContent("");
+    open_ = false;
+}
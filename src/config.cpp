@@ -0,0 +1,217 @@
+#include "config.h"
+#include <ArduinoJson.h>
+#include <LittleFS.h>
+#include "can_tx.h"
+#include "async_log.h"
+
+static const char* CONFIG_PATH = "/config.json";
+static const char* CONFIG_TMP_PATH = "/config.json.tmp";
+
+// 設定スキーマ（キー・型・デフォルト・範囲の唯一の定義）
+// フォーム表示・デフォルト生成・読み込み時の検証はすべてこの表から行う
+static constexpr ConfigField CONFIG_SCHEMA[] = {
+    {"packet_gap",         CFG_UINT,   100,   0, 60000,      &Config::packetGap,        nullptr},
+    {"chunk_interval",     CFG_UINT,   100,   0, 60000,      &Config::chunkInterval,    nullptr},
+    {"packet_gap_us",      CFG_UINT,   0,     0, 999999,     &Config::packetGapUs,      nullptr},
+    {"chunk_interval_us",  CFG_UINT,   0,     0, 999999,     &Config::chunkIntervalUs,  nullptr},
+    {"bus_load_pct",       CFG_UINT,   0,     0, 100,        &Config::busLoadPct,       nullptr},
+    {"id1_hex",            CFG_HEX,    0x123, 0, 0x7FF,      &Config::sendId1,          nullptr},
+    {"id2_hex",            CFG_HEX,    0x124, 0, 0x7FF,      &Config::sendId2,          nullptr},
+    {"id3_hex",            CFG_HEX,    0x125, 0, 0x7FF,      &Config::sendId3,          nullptr},
+    {"id4_hex",            CFG_HEX,    0x126, 0, 0x7FF,      &Config::sendId4,          nullptr},
+    {"id5_hex",            CFG_HEX,    0x127, 0, 0x7FF,      &Config::sendId5,          nullptr},
+    {"id6_hex",            CFG_HEX,    0x128, 0, 0x7FF,      &Config::sendId6,          nullptr},
+    {"id7_hex",            CFG_HEX,    0x129, 0, 0x7FF,      &Config::sendId7,          nullptr},
+    {"id8_hex",            CFG_HEX,    0x12A, 0, 0x7FF,      &Config::sendId8,          nullptr},
+    {"id_count",           CFG_UINT,   2,     1, 8,          &Config::idCount,          nullptr},
+    {"chunk_size",         CFG_UINT,   16,    1, 64,         &Config::chunkSize,        nullptr},
+    {"seq_counter",        CFG_CHOICE, 0,     0, 1,          &Config::seqCounter,       "off|on"},
+    {"chunk_checksum",     CFG_CHOICE, 0,     0, 1,          &Config::chunkChecksum,    "off|on"},
+    {"checksum_id_hex",    CFG_HEX,    0x12F, 0, 0x7FF,      &Config::checksumId,       nullptr},
+    {"transport",          CFG_CHOICE, 0,     0, 1,          &Config::transport,        "raw|isotp"},
+    {"isotp_tx_id_hex",    CFG_HEX,    0x7E0, 0, 0x7FF,      &Config::isotpTxId,        nullptr},
+    {"isotp_rx_id_hex",    CFG_HEX,    0x7E8, 0, 0x7FF,      &Config::isotpRxId,        nullptr},
+    {"isotp_payload_size", CFG_UINT,   4095,  8, 4095,       &Config::isotpPayloadSize, nullptr},
+    {"rate_control",       CFG_CHOICE, 0,     0, 1,          &Config::rateControl,      "fixed|adaptive"},
+    {"job_schedule",       CFG_CHOICE, 0,     0, 1,          &Config::jobSchedule,      "sequential|interleave"},
+    {"monitor_id_count",   CFG_UINT,   3,     0, 4,          &Config::monitorIdCount,   nullptr},
+    {"monitor_id1_hex",    CFG_HEX,    0x123, 0, 0x7FF,      &Config::monitorId1,       nullptr},
+    {"monitor_id2_hex",    CFG_HEX,    0x124, 0, 0x7FF,      &Config::monitorId2,       nullptr},
+    {"monitor_id3_hex",    CFG_HEX,    0x100, 0, 0x7FF,      &Config::monitorId3,       nullptr},
+    {"monitor_id4_hex",    CFG_HEX,    0x101, 0, 0x7FF,      &Config::monitorId4,       nullptr},
+    {"log_level",          CFG_CHOICE, 3,     0, 3,          &Config::logLevel,         "error|warn|info|debug"},
+    {"log_tx",             CFG_CHOICE, 1,     0, 1,          &Config::logTx,            "off|on"},
+    {"log_rx",             CFG_CHOICE, 1,     0, 1,          &Config::logRx,            "off|on"},
+    {"log_isotp",          CFG_CHOICE, 1,     0, 1,          &Config::logIsotp,         "off|on"},
+};
+static constexpr size_t CONFIG_FIELD_COUNT = sizeof(CONFIG_SCHEMA) / sizeof(CONFIG_SCHEMA[0]);
+
+Config appConfig;
+
+size_t configFieldCount() {
+    return CONFIG_FIELD_COUNT;
+}
+
+const ConfigField& configField(size_t index) {
+    return CONFIG_SCHEMA[index];
+}
+
+const ConfigField* findConfigField(const char* key) {
+    for (const ConfigField& f : CONFIG_SCHEMA) {
+        if (strcmp(f.key, key) == 0) return &f;
+    }
+    return nullptr;
+}
+
+bool configChoiceName(const ConfigField& field, uint32_t index, char* out, size_t outSize) {
+    const char* p = field.choices;
+    if (!p) return false;
+    for (uint32_t i = 0; ; i++) {
+        const char* end = strchr(p, '|');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (i == index) {
+            if (len >= outSize) len = outSize - 1;
+            memcpy(out, p, len);
+            out[len] = '\0';
+            return true;
+        }
+        if (!end) return false;
+        p = end + 1;
+    }
+}
+
+// 選択肢名から番号を探す
+static bool choiceIndex(const ConfigField& field, const char* name, uint32_t* index) {
+    char buf[16];
+    for (uint32_t i = 0; configChoiceName(field, i, buf, sizeof(buf)); i++) {
+        if (strcmp(buf, name) == 0) {
+            *index = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool configSetFromString(Config* c, const ConfigField& field, const char* value) {
+    uint32_t v;
+    char* end = nullptr;
+    if (field.type == CFG_CHOICE) {
+        if (!choiceIndex(field, value, &v)) return false;
+    } else {
+        v = strtoul(value, &end, field.type == CFG_HEX ? 16 : 10);
+        if (end == value || *end != '\0') return false;
+    }
+    if (v < field.minValue || v > field.maxValue) return false;
+    c->*field.member = v;
+    return true;
+}
+
+void configFormatValue(const Config& c, const ConfigField& field, char* out, size_t outSize) {
+    uint32_t v = c.*field.member;
+    switch (field.type) {
+        case CFG_HEX:    snprintf(out, outSize, "%X", v); break;
+        case CFG_CHOICE: if (!configChoiceName(field, v, out, outSize)) snprintf(out, outSize, "%u", v); break;
+        default:         snprintf(out, outSize, "%u", v); break;
+    }
+}
+
+static void applyDefaults(Config* c) {
+    for (const ConfigField& f : CONFIG_SCHEMA) c->*f.member = f.defaultValue;
+}
+
+static void printConfig(const Config& c) {
+    Serial.printf("Params updated: GAP=%u, Interval=%u, ID1=0x%X, ID2=0x%X\n",
+                  c.packetGap, c.chunkInterval, c.sendId1, c.sendId2);
+    Serial.printf("Chunk: %u bytes over %u IDs, Seq=%u, Checksum=%u\n",
+                  c.chunkSize, c.idCount, c.seqCounter, c.chunkChecksum);
+    if (c.packetGapUs || c.chunkIntervalUs || c.busLoadPct) {
+        Serial.printf("Timing: GAP+%uus, Interval+%uus, BusLoad=%u%%\n",
+                      c.packetGapUs, c.chunkIntervalUs, c.busLoadPct);
+    }
+    if (c.transport == TRANSPORT_ISOTP) {
+        Serial.printf("ISO-TP: TX=0x%X, RX=0x%X, Payload=%u\n", c.isotpTxId, c.isotpRxId, c.isotpPayloadSize);
+    }
+}
+
+// RAM上の設定を置き換え、実行中に切り替わる項目を反映する
+static void applyConfig(const Config& c) {
+    appConfig = c;
+    uint32_t mask = (c.logTx ? 1u << LOG_CAT_TX : 0) |
+                    (c.logRx ? 1u << LOG_CAT_RX : 0) |
+                    (c.logIsotp ? 1u << LOG_CAT_ISOTP : 0);
+    logConfigure((LogLevel)c.logLevel, mask);
+    canTxSetInterleave(c.jobSchedule != 0);
+    printConfig(appConfig);
+}
+
+bool saveConfig(const Config& c) {
+    JsonDocument doc;
+    char buf[16];
+    for (const ConfigField& f : CONFIG_SCHEMA) {
+        if (f.type == CFG_UINT) {
+            doc[f.key] = c.*f.member;
+        } else {
+            configFormatValue(c, f, buf, sizeof(buf));
+            doc[f.key] = buf;
+        }
+    }
+
+    // 書き込み途中の電源断で壊れないよう、一時ファイルに書いてから置き換える
+    File f = LittleFS.open(CONFIG_TMP_PATH, "w");
+    if (!f) return false;
+    size_t written = serializeJson(doc, f);
+    f.close();
+    if (written == 0 || !LittleFS.rename(CONFIG_TMP_PATH, CONFIG_PATH)) {
+        Serial.println("Failed to save config");
+        return false;
+    }
+
+    applyConfig(c);
+    return true;
+}
+
+void resetConfig() {
+    Config c;
+    applyDefaults(&c);
+    if (saveConfig(c)) Serial.println("Config has been reset to default.");
+}
+
+void loadConfig() {
+    Config c;
+    applyDefaults(&c);
+
+    File f = LittleFS.open(CONFIG_PATH, "r");
+    if (!f) {
+        resetConfig();
+        return;
+    }
+    JsonDocument doc;
+    DeserializationError error = deserializeJson(doc, f);
+    f.close();
+    if (error) {
+        Serial.println("Failed to read config, resetting...");
+        resetConfig(); // パース失敗時は初期化
+        return;
+    }
+
+    // 数値・文字列どちらで書かれていてもスキーマで検証する。不正な項目はデフォルトのまま
+    bool missing = false;
+    for (const ConfigField& field : CONFIG_SCHEMA) {
+        JsonVariant v = doc[field.key];
+        if (v.isNull()) {
+            missing = true;
+            continue;
+        }
+        String s = v.as<String>();
+        if (!configSetFromString(&c, field, s.c_str())) {
+            Serial.printf("Config: invalid %s=%s, using default\n", field.key, s.c_str());
+        }
+    }
+
+    // 古いファイルに新しいキーがなければ補って書き戻す（フォームに表示されるように）
+    if (missing) {
+        saveConfig(c);
+    } else {
+        applyConfig(c);
+    }
+}
@@ -0,0 +1,71 @@
+#include "frame_scheduler.h"
+
+// これより短い待ちは esp_timer を使わずビジーウェイトする（タイマー起床の遅延対策）
+static const int64_t SPIN_THRESHOLD_US = 100;
+
+uint32_t canFrameBits(uint8_t dlc) {
+    if (dlc > 8) dlc = 8;
+    // SOF〜CRCまでがスタッフィング対象: 1+11+1+1+1+4+8n+15 = 34+8n
+    uint32_t stuffed = 34 + 8 * dlc;
+    uint32_t stuffBits = (stuffed - 1) / 4;
+    // CRCデリミタ1 + ACK2 + EOF7 + IFS3 = 13
+    return stuffed + stuffBits + 13;
+}
+
+uint32_t canFrameTimeUs(uint8_t dlc, uint32_t bitrate) {
+    return (canFrameBits(dlc) * 1000000UL + bitrate - 1) / bitrate;
+}
+
+uint32_t busLoadIntervalUs(uint8_t dlc, uint8_t loadPct, uint32_t bitrate) {
+    if (loadPct == 0) return 0;
+    if (loadPct > 100) loadPct = 100;
+    return canFrameTimeUs(dlc, bitrate) * 100 / loadPct;
+}
+
+void FrameScheduler::onTimer(void* arg) {
+    FrameScheduler* self = static_cast<FrameScheduler*>(arg);
+    xTaskNotifyGive(self->task);
+}
+
+bool FrameScheduler::begin() {
+    task = xTaskGetCurrentTaskHandle();
+    esp_timer_create_args_t args = {};
+    args.callback = &FrameScheduler::onTimer;
+    args.arg = this;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "canTxSlot";
+    if (esp_timer_create(&args, &timer) != ESP_OK) {
+        Serial.println("FrameScheduler: esp_timer_create failed");
+        timer = nullptr;
+        return false;
+    }
+    reset();
+    return true;
+}
+
+void FrameScheduler::reset() {
+    nextSlotUs = esp_timer_get_time();
+}
+
+int64_t FrameScheduler::waitForSlot() {
+    int64_t remaining = nextSlotUs - esp_timer_get_time();
+    if (timer && remaining > SPIN_THRESHOLD_US) {
+        esp_timer_start_once(timer, remaining - SPIN_THRESHOLD_US);
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+    int64_t now;
+    while ((now = esp_timer_get_time()) < nextSlotUs) {
+        // 残りわずかなのでスピン
+    }
+    return now;
+}
+
+void FrameScheduler::scheduleNext(int64_t sentAtUs, uint32_t intervalUs) {
+    int64_t slot = (sentAtUs > nextSlotUs ? nextSlotUs : sentAtUs) + intervalUs;
+    int64_t now = esp_timer_get_time();
+    nextSlotUs = slot > now ? slot : now;
+}
+
+void FrameScheduler::scheduleAt(int64_t slotUs) {
+    nextSlotUs = slotUs;
+}
@@ -0,0 +1,135 @@
+#include "inflate_reader.h"
+#include "esp_rom_crc.h"
+
+// gzip ヘッダーのフラグ
+static const uint8_t GZIP_FHCRC = 0x02;
+static const uint8_t GZIP_FEXTRA = 0x04;
+static const uint8_t GZIP_FNAME = 0x08;
+static const uint8_t GZIP_FCOMMENT = 0x10;
+
+bool InflateReader::open(const char* path) {
+    close();
+
+    // 末尾8byte (CRC32, ISIZE) から展開後のサイズを知る
+    File f = LittleFS.open(path, "r");
+    if (!f) return false;
+    compressedSize_ = f.size();
+    uint8_t trailer[8];
+    bool ok = compressedSize_ >= 18 && f.seek(compressedSize_ - 8) && f.read(trailer, 8) == 8;
+    f.close();
+    if (!ok) return false;
+    expectedCrc_ = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((uint32_t)trailer[3] << 24);
+    size_ = trailer[4] | (trailer[5] << 8) | (trailer[6] << 16) | ((uint32_t)trailer[7] << 24);
+
+    inflator_ = (tinfl_decompressor*)malloc(sizeof(tinfl_decompressor));
+    dict_ = (uint8_t*)malloc(TINFL_LZ_DICT_SIZE);
+    if (!inflator_ || !dict_ || !in_.open(path) || !skipHeader()) {
+        close();
+        return false;
+    }
+    tinfl_init(inflator_);
+    return true;
+}
+
+void InflateReader::close() {
+    in_.close();
+    free(inflator_);
+    free(dict_);
+    inflator_ = nullptr;
+    dict_ = nullptr;
+    inLen_ = inPos_ = 0;
+    dictOfs_ = pending_ = 0;
+    size_ = pos_ = 0;
+    crc_ = 0;
+    done_ = false;
+    failed_ = false;
+}
+
+// 入力から len byte をそのまま読む（ヘッダー解析用）
+bool InflateReader::readInput(uint8_t* out, size_t len) {
+    while (len > 0) {
+        if (inPos_ == inLen_) {
+            inLen_ = in_.read(inBuf_, sizeof(inBuf_));
+            inPos_ = 0;
+            if (inLen_ == 0) return false;
+        }
+        *out++ = inBuf_[inPos_++];
+        len--;
+    }
+    return true;
+}
+
+bool InflateReader::skipHeader() {
+    uint8_t h[10];
+    if (!readInput(h, sizeof(h))) return false;
+    if (h[0] != 0x1F || h[1] != 0x8B || h[2] != 8) return false; // gzip + deflate のみ
+    uint8_t flags = h[3];
+    uint8_t b[2];
+    if (flags & GZIP_FEXTRA) {
+        if (!readInput(b, 2)) return false;
+        for (uint16_t n = b[0] | (b[1] << 8); n > 0; n--) {
+            if (!readInput(b, 1)) return false;
+        }
+    }
+    // ファイル名・コメントは 0 終端
+    for (uint8_t flag : {GZIP_FNAME, GZIP_FCOMMENT}) {
+        if (!(flags & flag)) continue;
+        do {
+            if (!readInput(b, 1)) return false;
+        } while (b[0] != 0);
+    }
+    if ((flags & GZIP_FHCRC) && !readInput(b, 2)) return false;
+    return true;
+}
+
+// 読み出しが追いついたら (pending_ == 0) 辞書の続きに展開する
+void InflateReader::inflateMore() {
+    if (inPos_ == inLen_ && in_.available()) {
+        inLen_ = in_.read(inBuf_, sizeof(inBuf_));
+        inPos_ = 0;
+    }
+    size_t inSize = inLen_ - inPos_;
+    size_t outSize = TINFL_LZ_DICT_SIZE - dictOfs_;
+    mz_uint32 flags = in_.available() ? TINFL_FLAG_HAS_MORE_INPUT : 0;
+    tinfl_status status = tinfl_decompress(inflator_, inBuf_ + inPos_, &inSize,
+                                           dict_, dict_ + dictOfs_, &outSize, flags);
+    inPos_ += inSize;
+    pending_ = outSize;
+
+    if (status == TINFL_STATUS_DONE) {
+        done_ = true;
+    } else if (status < 0 || (status == TINFL_STATUS_NEEDS_MORE_INPUT && !in_.available() && inPos_ == inLen_)) {
+        // 壊れたデータ・途中で切れたファイルは、展開できたところまでで終わりにする (failed() で分かる)
+        Serial.printf("Inflate: failed (%d) at %u bytes\n", (int)status, (unsigned)(pos_ + pending_));
+        done_ = true;
+        failed_ = true;
+    }
+}
+
+size_t InflateReader::read(uint8_t* out, size_t len) {
+    size_t copied = 0;
+    while (copied < len) {
+        if (pending_ == 0) {
+            if (done_) break;
+            inflateMore();
+            continue;
+        }
+        size_t n = pending_ < len - copied ? pending_ : len - copied;
+        memcpy(out + copied, dict_ + dictOfs_, n);
+        crc_ = esp_rom_crc32_le(crc_, dict_ + dictOfs_, n);
+        dictOfs_ = (dictOfs_ + n) & (TINFL_LZ_DICT_SIZE - 1);
+        pending_ -= n;
+        copied += n;
+    }
+    pos_ += copied;
+
+    if (copied < len || pos_ >= size_) {
+        if (pos_ != size_ || crc_ != expectedCrc_) {
+            Serial.printf("Inflate: size/CRC mismatch (%u/%u bytes, CRC %08X/%08X)\n",
+                          (unsigned)pos_, (unsigned)size_, crc_, expectedCrc_);
+            failed_ = true;
+        }
+        size_ = pos_; // ここで終わりにする
+    }
+    return copied;
+}
@@ -0,0 +1,45 @@
+#include "isotp.h"
+#include <string.h>
+
+// 残りを埋め値で埋めて常に8byteフレームにする（DLC<8を受け付けないECU対策）
+static uint8_t padFrame(uint8_t* out, uint8_t used) {
+    memset(out + used, ISOTP_PAD_BYTE, 8 - used);
+    return 8;
+}
+
+uint8_t isotpBuildSingleFrame(uint8_t* out, const uint8_t* data, uint8_t len) {
+    if (len > ISOTP_SF_MAX_DATA) len = ISOTP_SF_MAX_DATA;
+    out[0] = (ISOTP_PCI_SF << 4) | len;
+    memcpy(out + 1, data, len);
+    return padFrame(out, 1 + len);
+}
+
+uint8_t isotpBuildFirstFrame(uint8_t* out, uint16_t totalLen, const uint8_t* data) {
+    out[0] = (ISOTP_PCI_FF << 4) | ((totalLen >> 8) & 0x0F);
+    out[1] = totalLen & 0xFF;
+    memcpy(out + 2, data, ISOTP_FF_DATA);
+    return 8;
+}
+
+uint8_t isotpBuildConsecutiveFrame(uint8_t* out, uint8_t sn, const uint8_t* data, uint8_t len) {
+    if (len > ISOTP_CF_MAX_DATA) len = ISOTP_CF_MAX_DATA;
+    out[0] = (ISOTP_PCI_CF << 4) | (sn & 0x0F);
+    memcpy(out + 1, data, len);
+    return padFrame(out, 1 + len);
+}
+
+bool isotpParseFlowControl(const uint8_t* data, uint8_t len, IsoTpFlowControl* fc) {
+    if (len < 3 || (data[0] >> 4) != ISOTP_PCI_FC) return false;
+    uint8_t fs = data[0] & 0x0F;
+    if (fs > ISOTP_FC_OVERFLOW) return false;
+    fc->status = (IsoTpFlowStatus)fs;
+    fc->blockSize = data[1];
+    fc->stMinUs = isotpStMinToUs(data[2]);
+    return true;
+}
+
+uint32_t isotpStMinToUs(uint8_t raw) {
+    if (raw <= 0x7F) return (uint32_t)raw * 1000;            // 0-127 ms
+    if (raw >= 0xF1 && raw <= 0xF9) return (raw - 0xF0) * 100; // 100-900 µs
+    return 127000;
+}
@@ -0,0 +1,201 @@
+#ifdef USE_LCD
+#include "lcd_view.h"
+#include <M5StickC.h>
+#include <stdarg.h>
+#include "task_config.h"
+
+static const int LCD_WIDTH = 160;
+static const int LCD_HEIGHT = 80;
+static const int CHART_START_X = 40; // IDラベル用の余白
+static const int LCD_TEXT_MAX = 96;
+static const int LCD_QUEUE_LEN = 16;
+
+enum LcdCommandType : uint8_t {
+    LCD_CMD_MESSAGE = 0,
+    LCD_CMD_PROGRESS,
+    LCD_CMD_RESULT,
+    LCD_CMD_CHART
+};
+
+struct LcdCommand {
+    LcdCommandType type;
+    uint8_t count;        // CHART: ID数
+    uint16_t color;
+    int16_t value;        // PROGRESS: 進捗率
+    int16_t barY;
+    uint32_t received;    // CHART: 受信ありのビット
+    uint16_t ids[LCD_MONITOR_MAX];
+    char text[LCD_TEXT_MAX];
+};
+
+static QueueHandle_t lcdQueue = nullptr;
+static TFT_eSprite* sprite = nullptr;
+
+// 描画タスクだけが触る状態
+static int dirtyTop = LCD_HEIGHT;
+static int dirtyBottom = -1;
+static int scanX = 0;
+static int heartBeatStep = 0;
+
+static void markDirty(int top, int bottom) {
+    if (top < dirtyTop) dirtyTop = top;
+    if (bottom > dirtyBottom) dirtyBottom = bottom;
+}
+
+static void postCommand(const LcdCommand& cmd) {
+    // いっぱいなら捨てる（次のコマンドで描き直される）
+    if (lcdQueue) xQueueSend(lcdQueue, &cmd, 0);
+}
+
+void lcdShowMessage(const char* fmt, ...) {
+    LcdCommand cmd = {};
+    cmd.type = LCD_CMD_MESSAGE;
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(cmd.text, sizeof(cmd.text), fmt, args);
+    va_end(args);
+    postCommand(cmd);
+}
+
+void lcdShowProgress(int percent, uint16_t barColor, int barY, const char* fmt, ...) {
+    LcdCommand cmd = {};
+    cmd.type = LCD_CMD_PROGRESS;
+    cmd.value = percent;
+    cmd.color = barColor;
+    cmd.barY = barY;
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(cmd.text, sizeof(cmd.text), fmt, args);
+    va_end(args);
+    postCommand(cmd);
+}
+
+void lcdShowResult(const char* text, uint16_t color) {
+    LcdCommand cmd = {};
+    cmd.type = LCD_CMD_RESULT;
+    cmd.color = color;
+    strlcpy(cmd.text, text, sizeof(cmd.text));
+    postCommand(cmd);
+}
+
+void lcdChartStep(const uint32_t* ids, int count, uint32_t received) {
+    LcdCommand cmd = {};
+    cmd.type = LCD_CMD_CHART;
+    if (count > LCD_MONITOR_MAX) count = LCD_MONITOR_MAX;
+    cmd.count = count;
+    for (int i = 0; i < count; i++) cmd.ids[i] = ids[i];
+    cmd.received = received;
+    postCommand(cmd);
+}
+
+static void drawChartStep(const LcdCommand& cmd) {
+    // --- 生存確認インジケータ (右下の隅 y=70付近に配置) ---
+    const char* hb_chars = "|/-\\";
+    sprite->setTextColor(DARKGREY, BLACK);
+    sprite->setCursor(152, 72);
+    sprite->printf("%c", hb_chars[heartBeatStep % 4]);
+    heartBeatStep++;
+
+    int currentX = CHART_START_X + scanX;
+    int eraserX = CHART_START_X + ((scanX + 1) % (LCD_WIDTH - CHART_START_X));
+    sprite->fillRect(eraserX, 40, 2, 40, BLACK);
+
+    // ID数に合わせて行の間隔を詰める（3つまでは12px）
+    int pitch = cmd.count > 3 ? 38 / cmd.count : 12;
+    for (int i = 0; i < cmd.count; i++) {
+        int yPos = 42 + (i * pitch);
+
+        // 左端(scanX=0)でIDラベルを描画
+        if (scanX == 0) {
+            sprite->setTextColor(WHITE, BLACK);
+            sprite->setCursor(2, yPos);
+            sprite->printf("%03X:", cmd.ids[i]);
+        }
+
+        // 受信あり：シアンの2px幅の線、受信なし：中間グレーの点
+        bool received = cmd.received & (1u << i);
+        uint16_t color = received ? CYAN : 0x7BEF;
+        if (received) {
+            sprite->drawFastVLine(currentX, yPos, pitch - 2, color);
+            if (currentX < LCD_WIDTH - 1) sprite->drawFastVLine(currentX + 1, yPos, pitch - 2, color);
+        } else {
+            sprite->drawPixel(currentX, yPos + pitch / 2 - 1, color);
+        }
+    }
+    markDirty(40, LCD_HEIGHT - 1);
+
+    scanX++;
+    if (scanX >= LCD_WIDTH - CHART_START_X) scanX = 0;
+}
+
+static void drawCommand(const LcdCommand& cmd) {
+    switch (cmd.type) {
+        case LCD_CMD_MESSAGE:
+            sprite->fillScreen(BLACK);
+            sprite->setTextColor(WHITE, BLACK);
+            sprite->setCursor(0, 0);
+            sprite->print(cmd.text);
+            markDirty(0, LCD_HEIGHT - 1);
+            break;
+        case LCD_CMD_PROGRESS:
+            sprite->fillRect(0, 40, LCD_WIDTH, 40, BLACK);
+            sprite->setTextColor(WHITE, BLACK);
+            sprite->setCursor(0, 40);
+            sprite->printf("Progress: %d%%", cmd.value);
+            sprite->setCursor(0, 50);
+            sprite->print(cmd.text);
+            sprite->fillRect(0, cmd.barY, cmd.value * LCD_WIDTH / 100, 10, cmd.color);
+            markDirty(40, LCD_HEIGHT - 1);
+            break;
+        case LCD_CMD_RESULT:
+            sprite->fillRect(0, 40, LCD_WIDTH, 40, BLACK);
+            sprite->setCursor(0, 40);
+            sprite->setTextColor(cmd.color, BLACK);
+            sprite->print(cmd.text);
+            sprite->setTextColor(WHITE, BLACK);
+            markDirty(40, LCD_HEIGHT - 1);
+            break;
+        case LCD_CMD_CHART:
+            drawChartStep(cmd);
+            break;
+    }
+}
+
+// 変更のあった行の帯をまとめて送る
+// スプライトのバッファはパネルのバイト順で持っているので、そのまま1つの窓に流し込める
+static void pushDirty() {
+    if (dirtyBottom < dirtyTop) return;
+    uint16_t* pixels = (uint16_t*)sprite->getPointer();
+    M5.Lcd.startWrite();
+    M5.Lcd.pushImage(0, dirtyTop, LCD_WIDTH, dirtyBottom - dirtyTop + 1, pixels + dirtyTop * LCD_WIDTH);
+    M5.Lcd.endWrite();
+    dirtyTop = LCD_HEIGHT;
+    dirtyBottom = -1;
+}
+
+static void lcdTask(void*) {
+    LcdCommand cmd;
+    for (;;) {
+        if (xQueueReceive(lcdQueue, &cmd, portMAX_DELAY) != pdTRUE) continue;
+        // 溜まっているコマンドをすべて描いてから1回だけ転送する
+        do {
+            drawCommand(cmd);
+        } while (xQueueReceive(lcdQueue, &cmd, 0) == pdTRUE);
+        pushDirty();
+    }
+}
+
+void setupLcdView() {
+    sprite = new TFT_eSprite(&M5.Lcd);
+    sprite->setColorDepth(16);
+    if (!sprite->createSprite(LCD_WIDTH, LCD_HEIGHT)) {
+        Serial.println("LCD: cannot allocate sprite");
+        delete sprite;
+        sprite = nullptr;
+        return;
+    }
+    sprite->fillScreen(BLACK);
+    lcdQueue = xQueueCreate(LCD_QUEUE_LEN, sizeof(LcdCommand));
+    xTaskCreatePinnedToCore(lcdTask, "lcd", LCD_TASK_STACK, nullptr, LCD_TASK_PRIORITY, nullptr, NET_CORE);
+}
+#endif
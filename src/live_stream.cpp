@@ -0,0 +1,169 @@
+#include "live_stream.h"
+#include <ArduinoJson.h>
+#include "mbedtls/base64.h"
+
+static WiFiClient liveClient;
+static bool liveActive = false;
+static RxIdFilter liveFilter;
+static bool liveFilterAll = true;
+
+static uint8_t batch[LIVE_BATCH_FRAMES * LIVE_RECORD_SIZE];
+static size_t batchFrames = 0;
+static uint32_t batchStartedAt = 0;
+static uint32_t lastRatesAt = 0;
+// base64 は 4/3 倍 + 終端
+static uint8_t encoded[(sizeof(batch) + 2) / 3 * 4 + 1];
+
+static int hexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// 16進数を読み、読んだ位置を返す（数字がなければ nullptr）
+static const char* parseHex(const char* p, uint32_t* value) {
+    uint32_t v = 0;
+    const char* start = p;
+    for (int d; (d = hexDigit(*p)) >= 0; p++) v = (v << 4) | d;
+    if (p == start) return nullptr;
+    *value = v;
+    return p;
+}
+
+bool liveParseFilter(const char* spec, RxIdFilter* filter, bool* all) {
+    memset(filter, 0, sizeof(*filter));
+    *all = (spec[0] == '\0' || strcmp(spec, "*") == 0);
+    if (*all) return true;
+
+    const char* p = spec;
+    while (*p) {
+        while (*p == ' ' || *p == ',') p++;
+        if (*p == '\0') break;
+        if (strncmp(p, "ext", 3) == 0) {
+            filter->extended = true;
+            p += 3;
+            continue;
+        }
+        uint32_t from, to;
+        p = parseHex(p, &from);
+        if (!p) return false;
+        to = from;
+        if (*p == '-') {
+            p = parseHex(p + 1, &to);
+            if (!p) return false;
+        }
+        if (from > to || to >= CAN_STD_ID_COUNT) return false;
+        for (uint32_t id = from; id <= to; id++) filter->stdIds[id / 32] |= 1UL << (id % 32);
+        if (*p != '\0' && *p != ',' && *p != ' ') return false;
+    }
+    return true;
+}
+
+static void stopStream() {
+    liveActive = false;
+    canRxSetConsumerEnabled(RX_CONSUMER_LIVE, false);
+    liveClient.stop();
+    batchFrames = 0;
+}
+
+void liveStreamSetFilter(const RxIdFilter* filter) {
+    liveFilterAll = (filter == nullptr);
+    if (filter) liveFilter = *filter;
+    canRxSetConsumerFilter(RX_CONSUMER_LIVE, filter);
+}
+
+void liveStreamStart(WiFiClient client, const RxIdFilter* filter) {
+    if (liveActive) stopStream();
+
+    // WebServer の応答は使わず、SSE のヘッダーを直接書いて接続を持ち続ける
+    liveClient = client;
+    liveClient.setNoDelay(true);
+    liveClient.print("HTTP/1.1 200 OK\r\n"
+                     "Content-Type: text/event-stream\r\n"
+                     "Cache-Control: no-cache\r\n"
+                     "Connection: keep-alive\r\n"
+                     "Access-Control-Allow-Origin: *\r\n\r\n");
+
+    // 開始前に溜まっていた分は捨てる
+    RxFrame rx;
+    while (canRxPop(RX_CONSUMER_LIVE, &rx)) {}
+    liveStreamSetFilter(filter);
+    canRxSetConsumerEnabled(RX_CONSUMER_LIVE, true);
+    batchFrames = 0;
+    batchStartedAt = millis();
+    lastRatesAt = millis();
+    liveActive = true;
+}
+
+bool liveStreamActive() {
+    return liveActive;
+}
+
+// イベントを1つ書く。書けなければ切断とみなす
+static bool sendEvent(const char* name, const uint8_t* data, size_t len) {
+    char head[32];
+    int n = snprintf(head, sizeof(head), "event: %s\ndata: ", name);
+    if (liveClient.write((const uint8_t*)head, n) != (size_t)n ||
+        liveClient.write(data, len) != len ||
+        liveClient.write((const uint8_t*)"\n\n", 2) != 2) {
+        stopStream();
+        return false;
+    }
+    return true;
+}
+
+static void flushBatch() {
+    if (batchFrames == 0) return;
+    size_t olen = 0;
+    mbedtls_base64_encode(encoded, sizeof(encoded), &olen, batch, batchFrames * LIVE_RECORD_SIZE);
+    batchFrames = 0;
+    sendEvent("frames", encoded, olen);
+}
+
+static void sendRates() {
+    JsonDocument doc;
+    RxCounters c = canRxCounters();
+    doc["frames"] = c.frames;
+    doc["drops"] = c.ringDrops[RX_CONSUMER_LIVE];
+    JsonObject fps = doc["fps"].to<JsonObject>();
+    char key[9]; // int の16進 (最大8桁) + 終端
+    for (int id = canRxNextActiveId(0); id >= 0; id = canRxNextActiveId(id + 1)) {
+        if (!liveFilterAll && !((liveFilter.stdIds[id / 32] >> (id % 32)) & 1)) continue;
+        snprintf(key, sizeof(key), "%03X", id);
+        fps[key] = canRxStats(id)->rateFps;
+    }
+    String body;
+    serializeJson(doc, body);
+    sendEvent("rates", (const uint8_t*)body.c_str(), body.length());
+}
+
+void liveStreamPoll() {
+    if (!liveActive) return;
+    if (!liveClient.connected()) {
+        stopStream();
+        return;
+    }
+
+    RxFrame rx;
+    while (batchFrames < LIVE_BATCH_FRAMES && canRxPop(RX_CONSUMER_LIVE, &rx)) {
+        if (batchFrames == 0) batchStartedAt = millis();
+        uint8_t* r = batch + batchFrames * LIVE_RECORD_SIZE;
+        uint32_t ts = (uint32_t)rx.timestampUs;
+        uint32_t id = rx.identifier | ((rx.flags & RX_FLAG_EXTD) ? 0x80000000UL : 0) |
+                      ((rx.flags & RX_FLAG_RTR) ? 0x40000000UL : 0);
+        memcpy(r, &ts, 4);       // ESP32 はリトルエンディアン
+        memcpy(r + 4, &id, 4);
+        r[8] = rx.dlc;
+        memset(r + 9, 0, 8);
+        memcpy(r + 9, rx.data, rx.dlc);
+        batchFrames++;
+    }
+    if (batchFrames >= LIVE_BATCH_FRAMES || (batchFrames > 0 && millis() - batchStartedAt >= LIVE_BATCH_MS)) {
+        flushBatch();
+    }
+    if (liveActive && millis() - lastRatesAt >= LIVE_RATES_MS) {
+        lastRatesAt = millis();
+        sendRates();
+    }
+}
@@ -0,0 +1,164 @@
+#include "loopback_test.h"
+#include "esp_timer.h"
+
+static const uint32_t PENDING_LEN = 128;     // 送信済みで受信待ちのフレーム（TWAIの送信キューより十分多く）
+static const int64_t SETTLE_US = 200 * 1000; // ジョブ終了後に受信を待つ時間
+
+struct PendingFrame {
+    uint32_t identifier;
+    uint8_t dlc;
+    uint8_t data[8];
+    int64_t enqueueUs;
+};
+
+// 送信タスクと受信タスク（どちらもCAN側のコア）と loop() から触るので、すべて loopMux で守る
+static portMUX_TYPE loopMux = portMUX_INITIALIZER_UNLOCKED;
+static PendingFrame pending[PENDING_LEN];
+static uint32_t pendingHead = 0; // 次に積む位置（通し番号）
+static uint32_t pendingTail = 0; // 次に照合する位置
+static LoopbackResult result = {};
+static uint64_t latencySumUs = 0;
+static int64_t firstEnqueueUs = 0;
+static int64_t lastRxUs = 0;
+static int64_t endedAtUs = 0; // 0 ならジョブ実行中
+
+static bool sameFrame(const PendingFrame& p, const twai_message_t& msg) {
+    uint8_t dlc = msg.data_length_code > 8 ? 8 : msg.data_length_code;
+    return p.identifier == msg.identifier && p.dlc == dlc && memcmp(p.data, msg.data, dlc) == 0;
+}
+
+static void observeLatency(uint32_t us) {
+    size_t i = 0;
+    while (i < LOOPBACK_BUCKET_COUNT && us > LOOPBACK_BUCKETS_US[i]) i++;
+    result.buckets[i]++;
+    if (result.framesReceived == 0 || us < result.latencyMinUs) result.latencyMinUs = us;
+    if (us > result.latencyMaxUs) result.latencyMaxUs = us;
+    latencySumUs += us;
+    result.framesReceived++;
+}
+
+void loopbackBegin() {
+    portENTER_CRITICAL(&loopMux);
+    result = {};
+    result.state = LOOPBACK_RUNNING;
+    pendingHead = pendingTail = 0;
+    latencySumUs = 0;
+    firstEnqueueUs = lastRxUs = endedAtUs = 0;
+    portEXIT_CRITICAL(&loopMux);
+}
+
+void loopbackAbort() {
+    portENTER_CRITICAL(&loopMux);
+    result.state = LOOPBACK_IDLE;
+    portEXIT_CRITICAL(&loopMux);
+}
+
+void loopbackJobStarted(uint32_t jobId) {
+    portENTER_CRITICAL(&loopMux);
+    if (result.state == LOOPBACK_RUNNING) result.jobId = jobId;
+    portEXIT_CRITICAL(&loopMux);
+}
+
+void loopbackOnTransmit(const twai_message_t& msg, int64_t enqueueUs) {
+    portENTER_CRITICAL(&loopMux);
+    if (result.state == LOOPBACK_RUNNING) {
+        if (pendingHead - pendingTail >= PENDING_LEN) {
+            // 受信が追いつかないほど溜まった古いものは欠落とみなす
+            pendingTail++;
+            result.framesLost++;
+        }
+        PendingFrame& p = pending[pendingHead++ % PENDING_LEN];
+        p.identifier = msg.identifier;
+        p.dlc = msg.data_length_code > 8 ? 8 : msg.data_length_code;
+        memcpy(p.data, msg.data, p.dlc);
+        p.enqueueUs = enqueueUs;
+        if (result.framesSent == 0) firstEnqueueUs = enqueueUs;
+        result.framesSent++;
+    }
+    portEXIT_CRITICAL(&loopMux);
+}
+
+void loopbackOnTransmitFailed() {
+    // 直前に積んだものは受信されないので取り除く
+    portENTER_CRITICAL(&loopMux);
+    if (result.state == LOOPBACK_RUNNING && pendingHead != pendingTail) {
+        pendingHead--;
+        result.framesSent--;
+        result.txFailed++;
+    }
+    portEXIT_CRITICAL(&loopMux);
+}
+
+void loopbackJobEnded() {
+    portENTER_CRITICAL(&loopMux);
+    if (result.state == LOOPBACK_RUNNING) endedAtUs = esp_timer_get_time();
+    portEXIT_CRITICAL(&loopMux);
+}
+
+void loopbackOnReceive(const twai_message_t& msg, int64_t rxUs) {
+    portENTER_CRITICAL(&loopMux);
+    if (result.state == LOOPBACK_RUNNING) {
+        // 送った順に届くので先頭から探し、飛ばしたものは欠落として数える
+        uint32_t match = pendingTail;
+        while (match != pendingHead && !sameFrame(pending[match % PENDING_LEN], msg)) match++;
+        if (match == pendingHead) {
+            result.unmatched++;
+        } else {
+            result.framesLost += match - pendingTail;
+            int64_t latency = rxUs - pending[match % PENDING_LEN].enqueueUs;
+            observeLatency(latency > 0 ? (uint32_t)latency : 0);
+            pendingTail = match + 1;
+            lastRxUs = rxUs;
+        }
+    }
+    portEXIT_CRITICAL(&loopMux);
+}
+
+static void printResult(const LoopbackResult& r) {
+    Serial.printf("--- Loopback test (job %u) ---\n", r.jobId);
+    Serial.printf("Sent=%u, Received=%u, Lost=%u, TxFailed=%u, Unmatched=%u\n",
+                  r.framesSent, r.framesReceived, r.framesLost, r.txFailed, r.unmatched);
+    Serial.printf("Latency: min=%uus, avg=%uus, max=%uus, Rate=%u frames/s\n",
+                  r.latencyMinUs, r.latencyAvgUs, r.latencyMaxUs, r.framesPerSec);
+    for (size_t i = 0; i <= LOOPBACK_BUCKET_COUNT; i++) {
+        if (r.buckets[i] == 0) continue;
+        if (i < LOOPBACK_BUCKET_COUNT) Serial.printf("  <=%6uus: %u\n", LOOPBACK_BUCKETS_US[i], r.buckets[i]);
+        else Serial.printf("  > %6uus: %u\n", LOOPBACK_BUCKETS_US[LOOPBACK_BUCKET_COUNT - 1], r.buckets[i]);
+    }
+}
+
+void loopbackPoll() {
+    portENTER_CRITICAL(&loopMux);
+    bool settled = result.state == LOOPBACK_RUNNING && endedAtUs != 0 &&
+                   esp_timer_get_time() - endedAtUs >= SETTLE_US;
+    if (settled) {
+        // 待っても届かなかったものは欠落
+        result.framesLost += pendingHead - pendingTail;
+        pendingTail = pendingHead;
+        if (result.framesReceived > 0) {
+            result.latencyAvgUs = latencySumUs / result.framesReceived;
+            int64_t elapsed = lastRxUs - firstEnqueueUs;
+            if (elapsed > 0) result.framesPerSec = (uint64_t)result.framesReceived * 1000000ULL / elapsed;
+        }
+        result.state = LOOPBACK_DONE;
+    }
+    LoopbackResult r = result;
+    portEXIT_CRITICAL(&loopMux);
+
+    if (settled) printResult(r);
+}
+
+bool loopbackActive() {
+    portENTER_CRITICAL(&loopMux);
+    bool active = result.state == LOOPBACK_RUNNING;
+    portEXIT_CRITICAL(&loopMux);
+    return active;
+}
+
+LoopbackResult loopbackResult() {
+    portENTER_CRITICAL(&loopMux);
+    LoopbackResult r = result;
+    if (r.state == LOOPBACK_RUNNING && r.framesReceived > 0) r.latencyAvgUs = latencySumUs / r.framesReceived;
+    portEXIT_CRITICAL(&loopMux);
+    return r;
+}
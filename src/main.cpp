@@ -8,6 +8,19 @@
 #include <ArduinoJson.h>
 #include <LittleFS.h>
 #include "driver/twai.h" // ESP32のCAN(TWAI)ドライバ
+#include "esp_timer.h"
+#include "can_tx.h"
+#include "can_rx.h"
+#include "capture_log.h"
+#include "config.h"
+#include "chunked_response.h"
+#include "upload_writer.h"
+#include "metrics.h"
+#include "live_stream.h"
+#include "async_log.h"
+#include "lcd_view.h"
+#include "block_upload.h"
+#include "loopback_test.h"
 
 #ifdef USE_LCD
   const char *ssid = "M5StickC-Server";
@@ -16,15 +29,10 @@
 #endif
 const char *password = "12345678";
 const char *filename = "/uploaded.bin";
-const size_t CHUNK_SIZE = 16; 
-
-const char* config_path = "/config.json";
-
-// CAN送信タイミング設定
-uint32_t CAN_PACKET_GAP = 100;
-uint32_t CAN_CHUNK_INTERVAL = 100;
-uint32_t CAN_SEND_ID1 = 0x123;
-uint32_t CAN_SEND_ID2 = 0x124;
+const char *gzip_filename = "/uploaded.gz"; // .gz でアップロードされた場合は圧縮のまま保存し、送信時に展開する
+const char *PAYLOAD_DIR = "/payloads";      // 名前付きでアップロードしたファイル（ジョブごとに指定して送る）
+const size_t PAYLOAD_NAME_MAX = 32;
+const char *trace_filename = "/trace.dat"; // リプレイ用トレース (バイナリキャプチャ / candumpログ)
 
 // CANピン設定
 // platformio.iniから渡されたピン番号を使用
@@ -34,13 +42,25 @@ const gpio_num_t CAN_RX_PIN = (gpio_num_t)CAN_RX;
 WebServer server(80);
 size_t total_file_size = 0;
 size_t lastPercent = 0;
-bool isUploading = false; // アップロード中フラグ
+bool isUploading = false; // アップロード中フラグ（受信チャートの描画を止める）
+UploadWriter uploadWriter;
+BlockWriter blockWriter;                     // /blocks/put で受信中のブロック
+BlockResult blockPutResult = BLOCK_NO_SESSION;
+uint32_t uploadDoneShownAt = 0; // 完了表示を出した時刻 (0なら表示なし)
+const uint32_t UPLOAD_DONE_HOLD_MS = 1000;
+
+// 保存済みの送信ファイル（圧縮・非圧縮のどちらか一方だけが残っている）
+const char* storedImagePath() {
+    return LittleFS.exists(gzip_filename) ? gzip_filename : filename;
+}
 
 // CANの初期化
 void setupCAN() {
     // モードを TWAI_MODE_NO_ACK に変更
     twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT(CAN_TX_PIN, CAN_RX_PIN, TWAI_MODE_NO_ACK);
-    twai_timing_config_t t_config = TWAI_TIMING_CONFIG_500KBITS(); // 500kbps
+    g_config.tx_queue_len = 16; // µs間隔で送るとき送信タスクが待たされないよう深めにする
+    g_config.rx_queue_len = 64; // 受信タスクが起きるまでの取りこぼし防止
+    twai_timing_config_t t_config = TWAI_TIMING_CONFIG_500KBITS(); // 500kbps (CAN_BITRATE と合わせる)
     twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
 
     if (twai_driver_install(&g_config, &t_config, &f_config) == ESP_OK) {
@@ -49,244 +69,536 @@ void setupCAN() {
     }
 }
 
-// CAN送信処理 (8byteずつ送信) (ノーアック・モード対応)
-void sendCAN(uint32_t id, uint8_t* data, uint8_t len) {
-    twai_message_t message;
-    message.identifier = id;
-    message.extd = 0;           // 標準ID(11bit)
-    message.rtr = 0;            // データフレーム
-    message.ss = 1;             // Single Shot送信 (再送しない設定: NO_ACK時推奨)
-    message.self = 0;           
-    message.dlc_non_comp = 0;
-    message.data_length_code = len;
-    
-    // フラグに「ACKを期待しない」設定を明示（ドライバ内部でNO_ACKモードと連動します）
-    message.flags = TWAI_MSG_FLAG_NONE; 
+// --- Web画面のテンプレート (フラッシュ上に置き、そのまま送る) ---
+static const char PAGE_HEAD[] PROGMEM =
+    "<html><head><meta charset='UTF-8'><meta name='viewport' content='width=device-width, initial-scale=1'></head><body>";
 
-    for (int i = 0; i < len; i++) {
-        message.data[i] = data[i];
-    }
+static const char PAGE_FILE_BOX_OPEN[] PROGMEM =
+    "<div style='background:#f0f0f0; padding:10px; border-radius:5px; margin-bottom:10px;'>";
 
-    // 第2引数のタイムアウトを少し長めに取るか、即時送信(0)にします
-    if (twai_transmit(&message, pdMS_TO_TICKS(10)) != ESP_OK) {
-        Serial.println("CAN Transmit failed (Check if driver is started)");
-    } else {
-        // Serial.printf("Sent ID: 0x%03X\n", id); // デバッグ用
-    }
-}
+static const char PAGE_UPLOAD_AND_SEND[] PROGMEM =
+    "</div>"
+    "<form method='POST' action='/upload' enctype='multipart/form-data'>"
+    "<input type='file' name='upload'><br>"
+    "<span style='font-size:small;'>.gz (gzip) は圧縮したまま保存し、送信時に展開します</span><br><br>"
+    "<input type='submit' value='アップロード' style='width:100px; height:30px;'>"
+    "</form>"
+    "<hr>"
+    "<button style='background:#e1ff00; width:200px; height:50px;' onclick=\"fetch('/process').then(r=>r.json()).then(j=>alert(j.job_id ? '送信ジョブ ' + j.job_id + ' を開始しました' : '送信を開始できませんでした'))\">ファイルを16byteずつ処理</button>"
+    "<div id='txStatus' style='margin-top:10px;'></div>"
+    "<script>setInterval(()=>fetch('/status').then(r=>r.json()).then(s=>{"
+    "document.getElementById('txStatus').textContent='Job '+s.job_id+': '+s.state+' '+s.progress+'% ('+s.sent_bytes+'/'+s.total_bytes+' bytes)';}),1000);</script>";
+
+// ブロック単位のアップロード: 4KiB ごとに CRC32 を付けて2本並列で送り、足りないブロックだけ送り直す
+static const char PAGE_BLOCK_UPLOAD[] PROGMEM =
+    "<hr><h3>再開できるアップロード</h3>"
+    "<input type='file' id='buFile'> 保存先: <input id='buName' value='image' style='width:100px;'> "
+    "<button onclick='blockUpload()'>送信</button> <span id='buStatus'></span>"
+    "<p style='font-size:small;'>保存先: image / image.gz / trace / ペイロード名。途中で切れても同じファイルで再送すれば続きから送ります</p>"
+    "<script>"
+    "function crc32(b){let t=crc32.t,c;if(!t){t=crc32.t=[];for(let n=0;n<256;n++){c=n;for(let k=0;k<8;k++)c=c&1?0xEDB88320^(c>>>1):c>>>1;t[n]=c>>>0;}}"
+    "c=-1;for(let i=0;i<b.length;i++)c=t[(c^b[i])&255]^(c>>>8);return(c^-1)>>>0;}"
+    "async function blockUpload(){const f=buFile.files[0];if(!f)return;const n=encodeURIComponent(buName.value),bs=4096;"
+    "const get=u=>fetch(u).then(r=>r.json());"
+    "let s=await get('/blocks/begin?name='+n+'&size='+f.size+'&block_size='+bs),stalls=0;"
+    "while(s.result=='ok'&&s.received<s.blocks&&stalls<5){const q=s.missing.slice(),before=s.received;"
+    "const w=async()=>{while(q.length){const i=q.shift(),b=new Uint8Array(await f.slice(i*bs,(i+1)*bs).arrayBuffer()),d=new FormData();"
+    "d.append('block',new Blob([b]),'block');"
+    "await fetch('/blocks/put?name='+n+'&index='+i+'&crc='+crc32(b).toString(16),{method:'POST',body:d}).catch(()=>0);}};"
+    "await Promise.all([w(),w()]);s=await get('/blocks/status?name='+n);stalls=s.received>before?0:stalls+1;"
+    "buStatus.textContent=s.received+'/'+s.blocks+' blocks';}"
+    "if(s.result=='ok'&&s.received==s.blocks)s=await get('/blocks/commit?name='+n);"
+    "buStatus.textContent=s.result=='ok'&&s.crc32?'完了 CRC32: '+s.crc32:'失敗: '+s.result;}"
+    "</script>";
+
+static const char PAGE_JOBS[] PROGMEM =
+    "<hr><h3>ペイロードと送信ジョブ</h3>"
+    "<form method='POST' action='/payloads/upload' enctype='multipart/form-data'>"
+    "<input type='file' name='upload'> <input type='submit' value='ペイロードを追加'>"
+    "</form><br>"
+    "名前: <input id='jbFile' style='width:120px;'> "
+    "優先度: <input id='jbPrio' type='number' value='0' min='0' max='7' style='width:40px;'> "
+    "<button onclick=\"fetch('/jobs/enqueue?file='+encodeURIComponent(jbFile.value)+'&priority='+jbPrio.value).then(r=>r.json())"
+    ".then(j=>alert(j.job_id ? '送信ジョブ ' + j.job_id + ' を追加しました' : j.error))\">ジョブ追加</button> "
+    "<a href='/payloads'>ペイロード一覧</a> <a href='/jobs'>ジョブ一覧</a>"
+    "<p style='font-size:small;'>取り消し: /jobs/cancel?id=番号　ジョブごとの設定: /jobs/enqueue?file=名前&amp;id1_hex=7E0&amp;chunk_size=8 など</p>";
+
+static const char PAGE_SELFTEST[] PROGMEM =
+    "<hr><h3>自己受信試験</h3>"
+    "<button onclick=\"fetch('/selftest').then(r=>r.json()).then(j=>alert(j.job_id ? '試験ジョブ ' + j.job_id + ' を開始しました' : j.error))\">保存済みファイルで試験</button> "
+    "<a href='/selftest/result'>結果 (JSON)</a>"
+    "<p style='font-size:small;'>現在の設定で送ったフレームを自分で受信し、遅延・欠落・実効フレームレートを計測します (ISO-TP設定でもチャンク方式で送ります)。ペイロードで試すには /selftest?file=名前</p>";
+
+static const char PAGE_REPLAY_AND_CAPTURE[] PROGMEM =
+    "<hr><h3>トレース再生</h3>"
+    "<form method='POST' action='/upload_trace' enctype='multipart/form-data'>"
+    "<input type='file' name='upload'> <input type='submit' value='トレースをアップロード'>"
+    "</form><br>"
+    "速度: <select id='rpSpeed'><option value='0.5'>0.5x</option><option value='1' selected>1x</option>"
+    "<option value='10'>10x</option><option value='0'>最速</option></select> "
+    "回数: <input id='rpLoops' type='number' value='1' min='1' style='width:60px;'> "
+    "<button onclick=\"fetch('/replay?speed='+rpSpeed.value+'&loops='+rpLoops.value).then(r=>r.json())"
+    ".then(j=>alert(j.job_id ? 'リプレイジョブ ' + j.job_id + ' を開始しました' : j.error))\">再生</button>"
+    "<hr><h3>受信キャプチャ</h3>"
+    "<button onclick=\"fetch('/capture/start')\">キャプチャ開始</button> "
+    "<button onclick=\"fetch('/capture/stop')\">キャプチャ停止</button> "
+    "<a href='/capture'>ファイル一覧</a>"
+    "<p style='font-size:small;'>ダウンロード: /capture/download?seq=番号&amp;format=bin|candump|asc</p>";
+
+static const char PAGE_LIVE_AND_CONFIG_START[] PROGMEM =
+    "<hr><h3>ライブモニター</h3>"
+    "ID: <input id='lvIds' placeholder='123,7E0-7EF,ext (空欄で全て)' style='width:220px;'> "
+    "<button onclick='liveStart()'>開始</button> <button onclick='liveFilter()'>フィルタ変更</button> "
+    "<button onclick='if(window.es)es.close()'>停止</button>"
+    "<div id='lvRates' style='font-size:small;'></div>"
+    "<pre id='lvLog' style='height:200px; overflow:auto; background:#222; color:#0f0; font-size:small;'></pre>"
+    "<script>"
+    "function liveStart(){if(window.es)es.close();"
+    "es=new EventSource('/live?ids='+encodeURIComponent(lvIds.value));"
+    "es.addEventListener('frames',e=>{const b=Uint8Array.from(atob(e.data),c=>c.charCodeAt(0));const v=new DataView(b.buffer);let s='';"
+    "for(let o=0;o+17<=b.length;o+=17){const id=v.getUint32(o+4,true),n=v.getUint8(o+8);let d='';"
+    "for(let i=0;i<n;i++)d+=b[o+9+i].toString(16).padStart(2,'0')+' ';"
+    "s=(v.getUint32(o,true)/1e6).toFixed(6)+' '+(id&0x1FFFFFFF).toString(16).toUpperCase()+' ['+n+'] '+d+'\\n'+s;}"
+    "lvLog.textContent=(s+lvLog.textContent).slice(0,8000);});"
+    "es.addEventListener('rates',e=>{const r=JSON.parse(e.data);"
+    "lvRates.textContent=Object.entries(r.fps).map(([k,v])=>k+': '+v+'/s').join('  ')+'  (drops '+r.drops+')';});}"
+    "function liveFilter(){fetch('/live/filter?ids='+encodeURIComponent(lvIds.value));}"
+    "</script>"
+    "<hr><h3>設定変更</h3><form method='POST' action='/save_config'>";
+
+static const char PAGE_CONFIG_END_AND_FOOTER[] PROGMEM =
+    "<input type='submit' value='設定を更新' style='background:#007bff; color:white; padding:10px 20px; border:none; border-radius:5px;'>"
+    "</form>"
+    // 設定更新フォームの後にリセットボタンを配置
+    "<hr>"
+    "<h3>メンテナンス</h3>"
+    "<button style='background:#ff4444; color:white; padding:10px; border:none; border-radius:5px;' "
+    "onclick=\"if(confirm('設定を初期状態に戻しますか？')){location.href='/reset_config';}\">"
+    "設定を初期化する</button>"
+    "</body></html>";
+
+size_t rootPageBytes = 0;      // 直近に送ったトップページのサイズ
+uint32_t rootPageHeapUsed = 0; // その描画中に減ったヒープの最大量
 
 // Web画面の表示
+// ページ全体を String で組み立てず、固定バッファ経由で少しずつ送る
 void handleRoot() {
-    
+    uint32_t heapBeforeRoot = ESP.getFreeHeap();
+    ChunkedResponse page(server);
+    page.begin(200, "text/html");
+    page.print(PAGE_HEAD);
+    page.printf("<h2>%s File Server / CAN Transmission</h2>", ssid);
+
     // uploadされたファイルの情報を表示
-    String fileStatus = "ファイルはありません";
-    if (LittleFS.exists(filename)) {
-        File f = LittleFS.open(filename, "r");
-        if (f) {
-            size_t s = f.size();
-            fileStatus = "<b>保存済みファイル:</b> " + String(filename) + "<br>" +
-                         "<b>サイズ:</b> " + String(s) + " bytes";
-            f.close();
+    page.print(PAGE_FILE_BOX_OPEN);
+    const char* imagePath = storedImagePath();
+    File f = LittleFS.open(imagePath, "r");
+    if (f) {
+        page.printf("<b>保存済みファイル:</b> %s<br><b>サイズ:</b> %u bytes", imagePath, (unsigned)f.size());
+        f.close();
+        if (imagePath == gzip_filename) page.print(" (gzip、送信時に展開)");
+        // 送信前に確認できるよう、アップロード時に計算したダイジェストを出す
+        UploadDigest digest;
+        if (loadUploadDigest(imagePath, &digest)) {
+            char sha[65];
+            formatSha256(digest, sha, sizeof(sha));
+            page.printf("<br><b>CRC32:</b> %08X<br><b>SHA-256:</b> <code style='word-break:break-all;'>%s</code>",
+                        digest.crc32, sha);
         }
+    } else {
+        page.print("ファイルはありません");
     }
+    page.print(PAGE_UPLOAD_AND_SEND);
+    page.print(PAGE_BLOCK_UPLOAD);
+    page.print(PAGE_JOBS);
+    page.print(PAGE_SELFTEST);
+    LoopbackResult lb = loopbackResult();
+    if (lb.state == LOOPBACK_DONE) {
+        page.printf("<div>Job %u: 送信 %u / 受信 %u / 欠落 %u / 送信失敗 %u<br>"
+                    "遅延 min %u / avg %u / max %u µs、%u frames/s</div>",
+                    lb.jobId, lb.framesSent, lb.framesReceived, lb.framesLost, lb.txFailed,
+                    lb.latencyMinUs, lb.latencyAvgUs, lb.latencyMaxUs, lb.framesPerSec);
+    } else if (lb.state == LOOPBACK_RUNNING) {
+        page.print("<div>試験中...</div>");
+    }
+    page.print(PAGE_REPLAY_AND_CAPTURE);
+    page.print(PAGE_LIVE_AND_CONFIG_START);
 
-    // 設定変更フォームの生成
-    String configHtml = "";
-     if (LittleFS.exists(config_path)) {
-        File f = LittleFS.open(config_path, "r");
-        JsonDocument doc;
-        DeserializationError error = deserializeJson(doc, f);
-        f.close();
-        if (error) {
-            // パース失敗時はエラーメッセージを表示
-            configHtml = "<p style='color:red;'>設定の読み込みに失敗しました。初期状態にリセットしてください。</p>";
-        } else {
-            configHtml += "<h3>設定変更</h3><form method='POST' action='/save_config'>";
-            
-            // JSONの全要素をループで取り出し
-            JsonObject obj = doc.as<JsonObject>();
-            for (JsonPair p : obj) {
-                String key = p.key().c_str();
-                String value = p.value().as<String>();
-                String note = key.indexOf("hex") != -1 ? " (16進数)" : ""; // キー名にhexが含まれば注釈
-                
-                configHtml += "<div>" + key + note + ": <br>";
-                configHtml += "<input type='text' name='" + key + "' value='" + value + "'></div>";
+    // 設定変更フォームの生成（スキーマ表から生成）
+    char value[16];
+    char choice[16];
+    for (size_t i = 0; i < configFieldCount(); i++) {
+        const ConfigField& field = configField(i);
+        configFormatValue(appConfig, field, value, sizeof(value));
+        if (field.type == CFG_CHOICE) {
+            page.printf("<div>%s: <br><select name='%s'>", field.key, field.key);
+            for (uint32_t c = 0; configChoiceName(field, c, choice, sizeof(choice)); c++) {
+                page.printf("<option%s>%s</option>", strcmp(choice, value) == 0 ? " selected" : "", choice);
             }
-            configHtml += "<input type='submit' value='設定を更新' style='background:#007bff; color:white; padding:10px 20px; border:none; border-radius:5px;'>";
-            configHtml += "</form>";
+            page.print("</select></div>");
+            continue;
         }
+        // 16進数で入力する項目には注釈と16進の範囲を付ける
+        if (field.type == CFG_HEX) {
+            page.printf("<div>%s (16進数) [%X-%X]: <br>", field.key, field.minValue, field.maxValue);
+        } else {
+            page.printf("<div>%s [%u-%u]: <br>", field.key, field.minValue, field.maxValue);
+        }
+        page.printf("<input type='text' name='%s' value='%s'></div>", field.key, value);
+    }
+    page.print(PAGE_CONFIG_END_AND_FOOTER);
+    page.end();
 
-        // 設定更新フォームの後にリセットボタンを配置
-        configHtml += "<hr>";
-        configHtml += "<h3>メンテナンス</h3>";
-        configHtml += "<button style='background:#ff4444; color:white; padding:10px; border:none; border-radius:5px;' "
-                      "onclick=\"if(confirm('設定を初期状態に戻しますか？')){location.href='/reset_config';}\">"
-                      "設定を初期化する</button>";
-    }
-   
-    String html = "<html><head><meta charset='UTF-8'><meta name='viewport' content='width=device-width, initial-scale=1'></head><body>"
-                  "<h2>" + String(ssid) + " File Server / CAN Transmission</h2>"
-                  "<div style='background:#f0f0f0; padding:10px; border-radius:5px; margin-bottom:10px;'>" + fileStatus + "</div>"
-                  "<form method='POST' action='/upload' enctype='multipart/form-data'>"
-                  "<input type='file' name='upload'><br><br>"
-                  "<input type='submit' value='アップロード' style='width:100px; height:30px;'>"
-                  "</form>"
-                  "<hr>"
-                  "<button style='background:#e1ff00; width:200px; height:50px;' onclick=\"fetch('/process').then(()=>alert('処理を開始しました（シリアルを確認してください）'))\">ファイルを16byteずつ処理</button>";
-    html += "<hr>" + configHtml;
-    html += "</body></html>";
-    
-    server.send(200, "text/html", html);
+    // ベンチマーク (test/test_bench) で見るため、直近の描画のサイズとヒープ使用量を残す
+    rootPageBytes = page.bytesSent();
+    rootPageHeapUsed = heapBeforeRoot > page.minFreeHeap() ? heapBeforeRoot - page.minFreeHeap() : 0;
 }
 
 // ファイルアップロード処理（進捗表示付き）
-void handleFileUpload() {
+void handleUploadTo(const char* path) {
     HTTPUpload& upload = server.upload();
     
     if (upload.status == UPLOAD_FILE_START) {
         isUploading = true; // 受信表示停止
+        uploadDoneShownAt = 0;
         lastPercent = 0;
         // ヘッダーからファイルサイズを取得（文字列を整数に変換）
         total_file_size = server.header("Content-Length").toInt();
         
-        if (LittleFS.exists(filename)) LittleFS.remove(filename);
+        if (!uploadWriter.begin(path)) {
+            Serial.printf("Upload Start: cannot open %s\n", path);
+        }
         
-        Serial.printf("Upload Start: %s (Total: %d bytes)\n", upload.filename.c_str(), total_file_size);
+        Serial.printf("Upload Start: %s (Total: %u bytes)\n", upload.filename.c_str(), (unsigned)total_file_size);
         #ifdef USE_LCD
-        M5.Lcd.fillScreen(BLACK);
-        M5.Lcd.setCursor(0, 0);
-        M5.Lcd.printf("Uploading...\n%s", upload.filename.c_str());
+        lcdShowMessage("Uploading...\n%s", upload.filename.c_str());
         #endif
     } else if (upload.status == UPLOAD_FILE_WRITE) {
-        File f = LittleFS.open(filename, "a");
-        if (f) {
-            f.write(upload.buf, upload.currentSize);
-            f.close();
-        }
+        // ファイルは開いたまま。書き込みはブロック単位にまとめられる
+        uploadWriter.write(upload.buf, upload.currentSize);
+        metricsAddUploadBytes(upload.currentSize);
 
         // 進捗計算
         if (total_file_size > 0) {
             size_t progress = (upload.totalSize * 100) / total_file_size;
             if (progress != lastPercent) {
                 lastPercent = progress;
-                Serial.printf("Progress: %d%%\n", progress);
+                uint32_t kbps = uploadWriter.kbPerSec();
+                metricsSetUploadRate(kbps);
+                Serial.printf("Progress: %u%% (%u KB/s)\n", (unsigned)progress, kbps);
                 #ifdef USE_LCD
-                M5.Lcd.fillRect(0, 40, 160, 40, BLACK); // 表示エリアをクリア
-                M5.Lcd.setCursor(0, 40);
-                M5.Lcd.printf("Progress: %d%%", progress);
-                M5.Lcd.fillRect(0, 60, (progress * 160 / 100), 10, GREEN); // プログレスバー
+                lcdShowProgress(progress, GREEN, 60, "%u KB/s", kbps); // プログレスバーは y=60
                 #endif
             }
         }
 
     } else if (upload.status == UPLOAD_FILE_END) {
-        Serial.printf("Upload Finished: %u bytes\n", upload.totalSize);
+        uint32_t kbps = uploadWriter.kbPerSec();
+        metricsSetUploadRate(kbps);
+        UploadDigest digest = {};
+        bool ok = uploadWriter.finish(&digest);
+        char sha[65];
+        formatSha256(digest, sha, sizeof(sha));
+        if (ok) {
+            Serial.printf("Upload Finished: %u bytes, %u KB/s\n", (unsigned)upload.totalSize, kbps);
+            Serial.printf("CRC32: %08X\nSHA-256: %s\n", digest.crc32, sha);
+        } else {
+            Serial.println("Upload Failed: write error");
+        }
         #ifdef USE_LCD
-        M5.Lcd.fillScreen(BLACK);
-        M5.Lcd.setCursor(0, 0);
-        M5.Lcd.println("Upload Done!");
-        M5.Lcd.printf("Final Size: %u", upload.totalSize);
+        lcdShowMessage("%s\nFinal Size: %u\n%u KB/s\nCRC32: %08X", ok ? "Upload Done!" : "Upload Failed!",
+                       (unsigned)upload.totalSize, kbps, digest.crc32);
         #endif
         
-        delay(1000);
-        isUploading = false; // 受信表示再開
+        // delay() せずに完了表示を残し、loop() 側で受信表示を再開する
+        uploadDoneShownAt = millis();
         server.sendHeader("Location", "/");
         server.send(303);
+    } else if (upload.status == UPLOAD_FILE_ABORTED) {
+        Serial.println("Upload Aborted");
+        uploadWriter.abort();
+        isUploading = false;
     }
 }
 
-// 設定をデフォルトに戻す関数
-void resetConfig() {
-    File f = LittleFS.open(config_path, "w");
-    if (f) {
-        // ここにデフォルトのJSON構造を定義
-        f.println("{\"packet_gap\": 100, \"chunk_interval\": 100, \"id1_hex\": \"123\", \"id2_hex\": \"124\"}");
-        f.close();
-        Serial.println("Config has been reset to default.");
+void handleFileUpload() {
+    HTTPUpload& upload = server.upload();
+    bool compressed = upload.filename.endsWith(".gz");
+    if (upload.status == UPLOAD_FILE_START) {
+        // 前回の（もう一方の形式の）ファイルは消す
+        const char* other = compressed ? filename : gzip_filename;
+        LittleFS.remove(other);
+        LittleFS.remove(String(other) + ".sum");
     }
+    handleUploadTo(compressed ? gzip_filename : filename);
 }
 
-// 設定保存処理
-void handleSaveConfig() {
-    if (LittleFS.exists(config_path)) {
-        // 現在のJSONを読み込み
-        File f_read = LittleFS.open(config_path, "r");
-        JsonDocument doc;
-        DeserializationError error = deserializeJson(doc, f_read);
-        f_read.close();
-
-        if (!error) {
-            // server.args() で POST された全パラメータをループ処理
-            for (int i = 0; i < server.args(); i++) {
-                String key = server.argName(i);
-                String val = server.arg(i);
-
-                // ArduinoJson V7: キーが存在するか(nullでないか)を確認
-                if (!doc[key].isNull()) {
-                    // 元の型に合わせて保存（数値型への自動変換）
-                    if (doc[key].is<int>()) {
-                        doc[key] = val.toInt();
-                    } else if (doc[key].is<float>()) {
-                        doc[key] = val.toFloat();
-                    } else {
-                        doc[key] = val; // 文字列として保存
-                    }
-                }
-            }
+void handleTraceUpload() {
+    handleUploadTo(trace_filename);
+}
+
+// ペイロード名を /payloads 以下のパスにする
+// 使える文字は英数字と . _ - のみ（先頭の . とディレクトリ区切りは不可）
+bool payloadPath(const char* name, char* out, size_t outSize) {
+    size_t len = strlen(name);
+    if (len == 0 || len > PAYLOAD_NAME_MAX || name[0] == '.') return false;
+    for (size_t i = 0; i < len; i++) {
+        char c = name[i];
+        if (!isalnum((unsigned char)c) && c != '.' && c != '_' && c != '-') return false;
+    }
+    snprintf(out, outSize, "%s/%s", PAYLOAD_DIR, name);
+    return true;
+}
 
-            // ファイルに保存
-            File f_write = LittleFS.open(config_path, "w");
-            serializeJson(doc, f_write);
-            f_write.close();
-            
-            Serial.println("Config Updated via Web");
+// 名前付きペイロードのアップロード（ファイル名をそのまま名前にする）
+void handlePayloadUpload() {
+    HTTPUpload& upload = server.upload();
+    char path[sizeof(TxJob::path)];
+    if (!payloadPath(upload.filename.c_str(), path, sizeof(path))) {
+        if (upload.status == UPLOAD_FILE_START) {
+            Serial.printf("Payload upload: invalid name %s\n", upload.filename.c_str());
+        } else if (upload.status == UPLOAD_FILE_END) {
+            server.send(400, "text/plain", "invalid payload name (A-Z a-z 0-9 . _ -, up to 32 chars)");
         }
+        return;
     }
+    handleUploadTo(path);
+}
 
-    // ルートに戻す
-    server.sendHeader("Location", "/");
-    server.send(303);
+// ペイロード一覧をJSONで返す（サイズとアップロード時のCRC32）
+void handlePayloads() {
+    JsonDocument doc;
+    JsonArray files = doc["payloads"].to<JsonArray>();
+    File dir = LittleFS.open(PAYLOAD_DIR);
+    if (dir) {
+        for (File f = dir.openNextFile(); f; f = dir.openNextFile()) {
+            String name = f.name();
+            size_t size = f.size();
+            f.close();
+            if (name.endsWith(".sum")) continue;
+            JsonObject o = files.add<JsonObject>();
+            o["name"] = name;
+            o["size"] = size;
+            char path[sizeof(TxJob::path)];
+            UploadDigest digest;
+            if (payloadPath(name.c_str(), path, sizeof(path)) && loadUploadDigest(path, &digest)) {
+                char crc[9];
+                snprintf(crc, sizeof(crc), "%08X", digest.crc32);
+                o["crc32"] = crc;
+            }
+        }
+        dir.close();
+    }
+
+    String body;
+    serializeJson(doc, body);
+    server.send(200, "application/json", body);
 }
 
-// JSONからグローバル変数に設定を反映する関数
-void updateParamsFromJson() {
-    if (!LittleFS.exists(config_path)) {
-        resetConfig();
+// /payloads/delete?name=
+void handlePayloadDelete() {
+    char path[sizeof(TxJob::path)];
+    if (!payloadPath(server.arg("name").c_str(), path, sizeof(path))) {
+        server.send(400, "application/json", "{\"error\":\"invalid name\"}");
         return;
     }
+    if (!LittleFS.remove(path)) {
+        server.send(404, "application/json", "{\"error\":\"no such payload\"}");
+        return;
+    }
+    LittleFS.remove(String(path) + ".sum");
+    server.send(200, "application/json", "{\"deleted\":true}");
+}
+
+// ブロックアップロードの保存先
+// image / image.gz は送信用イメージ、trace はリプレイ用トレース、それ以外はペイロード名
+bool blockTargetPath(const char* name, char* out, size_t outSize) {
+    if (strcmp(name, "image") == 0) strlcpy(out, filename, outSize);
+    else if (strcmp(name, "image.gz") == 0) strlcpy(out, gzip_filename, outSize);
+    else if (strcmp(name, "trace") == 0) strlcpy(out, trace_filename, outSize);
+    else return payloadPath(name, out, outSize);
+    return true;
+}
 
-    File f = LittleFS.open(config_path, "r");
+int blockHttpCode(BlockResult result) {
+    switch (result) {
+        case BLOCK_OK:              return 200;
+        case BLOCK_NO_SESSION:      return 404;
+        case BLOCK_INCOMPLETE:      return 409;
+        case BLOCK_CRC_MISMATCH:
+        case BLOCK_DIGEST_MISMATCH: return 422;
+        case BLOCK_NO_SPACE:        return 507;
+        case BLOCK_IO_ERROR:        return 500;
+        default:                    return 400;
+    }
+}
+
+// 結果とセッションの状態（未受信のブロック番号は先頭から64個まで）を返す
+void sendBlockStatus(BlockResult result, const char* path) {
     JsonDocument doc;
-    DeserializationError error = deserializeJson(doc, f);
-    f.close();
+    BlockSession session;
+    uint32_t missing[64];
+    size_t missingCount = 0;
+    if (result == BLOCK_OK || result == BLOCK_CRC_MISMATCH || result == BLOCK_BAD_LENGTH) {
+        BlockResult state = path ? blockUploadStatus(path, &session, missing, 64, &missingCount) : BLOCK_NO_SESSION;
+        // 確定・破棄の後など、セッションがなければ ok ではなく no session を返す
+        if (state != BLOCK_OK && result == BLOCK_OK) result = state;
+        if (state == BLOCK_OK) {
+            doc["size"] = session.size;
+            doc["block_size"] = session.blockSize;
+            doc["blocks"] = session.blocks;
+            doc["received"] = session.received;
+            JsonArray list = doc["missing"].to<JsonArray>();
+            for (size_t i = 0; i < missingCount && i < 64; i++) list.add(missing[i]);
+        }
+    }
+    doc["result"] = blockResultName(result);
 
-    if (error) {
-        Serial.println("Failed to read config, resetting...");
-        resetConfig(); // パース失敗時は初期化
+    String body;
+    serializeJson(doc, body);
+    server.send(blockHttpCode(result), "application/json", body);
+}
+
+// /blocks/begin?name=&size=&block_size=4096 （同じ条件なら続きから）
+void handleBlockBegin() {
+    char path[UPLOAD_PATH_MAX];
+    if (!blockTargetPath(server.arg("name").c_str(), path, sizeof(path))) {
+        sendBlockStatus(BLOCK_BAD_PARAMS, nullptr);
         return;
     }
+    uint32_t size = strtoul(server.arg("size").c_str(), nullptr, 10);
+    uint32_t blockSize = server.hasArg("block_size") ? strtoul(server.arg("block_size").c_str(), nullptr, 10) : 4096;
+    BlockSession session;
+    BlockResult result = blockUploadBegin(path, size, blockSize, &session);
+    if (result == BLOCK_OK) Serial.printf("Block upload: %s, %u bytes, %u/%u blocks received\n",
+                                          path, size, session.received, session.blocks);
+    sendBlockStatus(result, path);
+}
 
-    // JSONの値をグローバル変数に反映 (V7推奨の is<T>() による存在確認)
-    if (doc["packet_gap"].is<uint32_t>()) {
-        CAN_PACKET_GAP = doc["packet_gap"];
+void handleBlockStatus() {
+    char path[UPLOAD_PATH_MAX];
+    if (!blockTargetPath(server.arg("name").c_str(), path, sizeof(path))) {
+        sendBlockStatus(BLOCK_BAD_PARAMS, nullptr);
+        return;
     }
-    
-    if (doc["chunk_interval"].is<uint32_t>()) {
-        CAN_CHUNK_INTERVAL = doc["chunk_interval"];
+    sendBlockStatus(BLOCK_OK, path);
+}
+
+// /blocks/put?name=&index=N&crc=16進数 (multipart でブロックのデータを1つ送る)
+void handleBlockPut() {
+    HTTPUpload& upload = server.upload();
+    if (upload.status == UPLOAD_FILE_START) {
+        char path[UPLOAD_PATH_MAX];
+        char* end = nullptr;
+        String index = server.arg("index");
+        uint32_t i = strtoul(index.c_str(), &end, 10);
+        if (!blockTargetPath(server.arg("name").c_str(), path, sizeof(path)) || end == index.c_str() || *end != '\0') {
+            blockPutResult = BLOCK_BAD_PARAMS;
+            return;
+        }
+        blockPutResult = blockWriter.begin(path, i);
+    } else if (upload.status == UPLOAD_FILE_WRITE) {
+        blockWriter.write(upload.buf, upload.currentSize);
+        metricsAddUploadBytes(upload.currentSize);
+    } else if (upload.status == UPLOAD_FILE_END) {
+        if (blockPutResult != BLOCK_OK) return;
+        char* end = nullptr;
+        String crc = server.arg("crc");
+        uint32_t expected = strtoul(crc.c_str(), &end, 16);
+        if (end == crc.c_str() || *end != '\0') {
+            blockWriter.abort();
+            blockPutResult = BLOCK_BAD_PARAMS;
+            return;
+        }
+        blockPutResult = blockWriter.finish(expected);
+    } else if (upload.status == UPLOAD_FILE_ABORTED) {
+        blockWriter.abort();
+        blockPutResult = BLOCK_IO_ERROR;
     }
-    
-    // IDはWebから16進数文字列で入力されることを想定
-    if (doc["id1_hex"].is<const char*>()) {
-        CAN_SEND_ID1 = strtoul(doc["id1_hex"], NULL, 16);
+}
+
+void handleBlockPutDone() {
+    char path[UPLOAD_PATH_MAX];
+    bool valid = blockTargetPath(server.arg("name").c_str(), path, sizeof(path));
+    sendBlockStatus(blockPutResult, valid ? path : nullptr);
+    blockPutResult = BLOCK_NO_SESSION;
+}
+
+// /blocks/commit?name=[&crc32=16進数] 全ブロックがそろっていれば置き換える
+void handleBlockCommit() {
+    char path[UPLOAD_PATH_MAX];
+    if (!blockTargetPath(server.arg("name").c_str(), path, sizeof(path))) {
+        sendBlockStatus(BLOCK_BAD_PARAMS, nullptr);
+        return;
     }
-    
-    if (doc["id2_hex"].is<const char*>()) {
-        CAN_SEND_ID2 = strtoul(doc["id2_hex"], NULL, 16);
+    uint32_t expected = 0;
+    bool checkCrc = server.hasArg("crc32");
+    if (checkCrc) expected = strtoul(server.arg("crc32").c_str(), nullptr, 16);
+
+    UploadDigest digest;
+    BlockResult result = blockUploadCommit(path, checkCrc ? &expected : nullptr, &digest);
+    if (result != BLOCK_OK) {
+        sendBlockStatus(result, path);
+        return;
+    }
+    // 送信用イメージは、もう一方の形式のファイルを消す（handleFileUpload と同じ）
+    if (strcmp(path, filename) == 0 || strcmp(path, gzip_filename) == 0) {
+        const char* other = strcmp(path, filename) == 0 ? gzip_filename : filename;
+        LittleFS.remove(other);
+        LittleFS.remove(String(other) + ".sum");
+    }
+
+    char crc[9];
+    char sha[65];
+    snprintf(crc, sizeof(crc), "%08X", digest.crc32);
+    formatSha256(digest, sha, sizeof(sha));
+    Serial.printf("Block upload committed: %s, %u bytes, CRC32: %s\n", path, digest.size, crc);
+    JsonDocument doc;
+    doc["result"] = blockResultName(result);
+    doc["size"] = digest.size;
+    doc["crc32"] = crc;
+    doc["sha256"] = sha;
+    String body;
+    serializeJson(doc, body);
+    server.send(200, "application/json", body);
+}
+
+void handleBlockAbort() {
+    char path[UPLOAD_PATH_MAX];
+    if (!blockTargetPath(server.arg("name").c_str(), path, sizeof(path))) {
+        sendBlockStatus(BLOCK_BAD_PARAMS, nullptr);
+        return;
+    }
+    blockUploadAbort(path);
+    server.send(200, "application/json", "{\"result\":\"ok\"}");
+}
+
+// 設定保存処理
+// POST された値をすべてスキーマで検証し、1つでも不正なら保存しない
+void handleSaveConfig() {
+    Config next = appConfig;
+    String errors;
+    for (int i = 0; i < server.args(); i++) {
+        const ConfigField* field = findConfigField(server.argName(i).c_str());
+        if (!field) continue;
+        if (!configSetFromString(&next, *field, server.arg(i).c_str())) {
+            errors += String(field->key) + "=" + server.arg(i) + "\n";
+        }
     }
 
-    Serial.printf("Params updated: GAP=%u, Interval=%u, ID1=0x%X, ID2=0x%X\n", 
-                  CAN_PACKET_GAP, CAN_CHUNK_INTERVAL, CAN_SEND_ID1, CAN_SEND_ID2);
+    if (errors.length() > 0) {
+        server.send(400, "text/plain", "Invalid config values:\n" + errors);
+        return;
+    }
+    if (!saveConfig(next)) {
+        server.send(500, "text/plain", "Failed to save config");
+        return;
+    }
+    Serial.println("Config Updated via Web");
+
+    // ルートに戻す
+    server.sendHeader("Location", "/");
+    server.send(303);
 }
 
 // Webエンドポイント用ハンドラ
@@ -296,98 +608,395 @@ void handleResetConfig() {
     server.send(303);
 }
 
-// 分割処理用
-void processFile() {
-    // 送信前に最新の設定を読み込む
-    updateParamsFromJson();
+// 設定から送信ジョブを組み立てる（.gz のファイルは送信しながら展開する）
+TxJob buildTxJob(const Config& c, const char* path) {
+    TxJob job = {};
+    strlcpy(job.path, path, sizeof(job.path));
+    size_t len = strlen(path);
+    job.compressed = len > 3 && strcmp(path + len - 3, ".gz") == 0;
+    job.packetGap = c.packetGap;
+    job.chunkInterval = c.chunkInterval;
+    job.packetGapUs = c.packetGapUs;
+    job.chunkIntervalUs = c.chunkIntervalUs;
+    job.busLoadPct = c.busLoadPct;
+    job.adaptiveRate = c.rateControl != 0;
+    job.layout.chunkSize = c.chunkSize;
+    job.layout.idCount = c.idCount;
+    job.layout.seqCounter = c.seqCounter != 0;
+    job.layout.checksum = c.chunkChecksum != 0;
+    const uint32_t ids[CHUNK_MAX_IDS] = {c.sendId1, c.sendId2, c.sendId3, c.sendId4,
+                                         c.sendId5, c.sendId6, c.sendId7, c.sendId8};
+    memcpy(job.layout.ids, ids, sizeof(ids));
+    job.layout.checksumId = c.checksumId;
+    job.transport = (TxTransport)c.transport;
+    job.isotpTxId = c.isotpTxId;
+    job.isotpRxId = c.isotpRxId;
+    job.isotpPayloadSize = c.isotpPayloadSize;
+    return job;
+}
 
-    File f = LittleFS.open(filename, "r");
-    if (!f) {
+// 送信ジョブを投入する（送信自体はcan_txのタスクで行うので即座に戻る）
+// 戻り値はジョブID。ファイルがない・キューが満杯の場合は0
+uint32_t startTransmit() {
+    const char* path = storedImagePath();
+    if (!LittleFS.exists(path)) {
         #ifndef USE_LCD
             // ファイルがない場合は警告として一瞬黄色に
             M5.dis.drawpix(0, 0xffff00);
             delay(500);
             M5.dis.drawpix(0, 0x000000);
         #endif
+        return 0;
+    }
+
+    uint32_t jobId = enqueueTxJob(buildTxJob(appConfig, path));
+    if (jobId == 0) {
+        Serial.println("TX job queue is full");
+    } else {
+        Serial.printf("TX job %u queued\n", jobId);
+    }
+    return jobId;
+}
+
+// トレースのリプレイジョブを投入する
+// /replay?speed=0.5|1|10|0(最速)&loops=N
+void handleReplay() {
+    if (!LittleFS.exists(trace_filename)) {
+        server.send(404, "application/json", "{\"error\":\"no trace uploaded\"}");
         return;
     }
 
-    size_t totalSize = f.size();
-    int lastPercent = -1; // 前回の進捗を保持（描画のチラつき防止）
+    float speed = 1.0f;
+    if (server.hasArg("speed")) {
+        String s = server.arg("speed");
+        char* end = nullptr;
+        speed = strtof(s.c_str(), &end);
+        if (end == s.c_str() || *end != '\0' || !(speed >= 0)) {
+            server.send(400, "application/json", "{\"error\":\"invalid speed\"}");
+            return;
+        }
+    }
+    long loops = server.hasArg("loops") ? server.arg("loops").toInt() : 1;
+    loops = constrain(loops, 1L, 65535L);
+    // 進捗は全周回の合計byte数で数えるので、32bitに収まらない組み合わせは受け付けない
+    File trace = LittleFS.open(trace_filename, "r");
+    uint64_t traceBytes = trace ? trace.size() : 0;
+    trace.close();
+    if (traceBytes * (uint64_t)loops > TX_JOB_BYTES_MAX) {
+        server.send(400, "application/json", "{\"error\":\"trace size x loops too large\"}");
+        return;
+    }
 
-    #ifdef USE_LCD
-        M5.Lcd.fillScreen(BLACK);
-        M5.Lcd.setCursor(0, 0);
-        M5.Lcd.println("CAN Transmitting...");
-        M5.Lcd.printf("File: %s\nSize: %u", filename, totalSize);
-    #endif
+    TxJob job = {};
+    strlcpy(job.path, trace_filename, sizeof(job.path));
+    job.transport = TRANSPORT_REPLAY;
+    job.busLoadPct = appConfig.busLoadPct;
+    job.replaySpeedPct = speed <= 0 ? 0 : (uint16_t)constrain(speed * 100.0f + 0.5f, 1.0f, 65535.0f);
+    job.replayLoops = (uint16_t)loops;
+    uint32_t jobId = enqueueTxJob(job);
+    if (jobId == 0) {
+        server.send(503, "application/json", "{\"error\":\"queue full\"}");
+        return;
+    }
+    server.send(202, "application/json", "{\"job_id\":" + String(jobId) + "}");
+}
 
-    Serial.println("--- CAN Transmission Start ---");
-    Serial.printf("Settings: ID1=0x%X, ID2=0x%X, Gap=%d, Interval=%d\n", 
-                  CAN_SEND_ID1, CAN_SEND_ID2, CAN_PACKET_GAP, CAN_CHUNK_INTERVAL);
-    uint8_t buffer[CHUNK_SIZE];
-    while (f.available()) {
-        int bytesRead = f.read(buffer, CHUNK_SIZE);
-        size_t currentPos = f.position();
+// ジョブ一覧をJSONで返す（待ち・実行中と、直近に終わったもの）
+void handleJobs() {
+    TxJobInfo jobs[TX_JOB_TABLE_LEN];
+    size_t count = listTxJobs(jobs, TX_JOB_TABLE_LEN);
+    JsonDocument doc;
+    doc["schedule"] = appConfig.jobSchedule ? "interleave" : "sequential";
+    JsonArray list = doc["jobs"].to<JsonArray>();
+    for (size_t i = 0; i < count; i++) {
+        const TxJobInfo& j = jobs[i];
+        JsonObject o = list.add<JsonObject>();
+        o["job_id"] = j.jobId;
+        o["path"] = j.path;
+        o["priority"] = j.priority;
+        o["state"] = txStateName(j.state);
+        o["total_bytes"] = j.totalBytes;
+        o["sent_bytes"] = j.bytesSent;
+        o["frames_sent"] = j.framesSent;
+        o["frames_failed"] = j.framesFailed;
+    }
 
-        // --- デバッグ用シリアル出力 ---
-        Serial.printf("[%04X]: ", currentPos - bytesRead);
-        for (int i = 0; i < bytesRead; i++) Serial.printf("%02X ", buffer[i]);
-        Serial.println();
+    String body;
+    serializeJson(doc, body);
+    server.send(200, "application/json", body);
+}
 
-        // --- 進捗計算と画面表示 ---
-        int progress = (currentPos * 100) / totalSize;
+// ペイロードの送信ジョブを投入する
+// /jobs/enqueue?file=名前&priority=0-7 に、設定と同じキー (id1_hex, chunk_size, packet_gap, transport 等) を
+// 付けるとこのジョブだけその値で送る。付けなかった項目は現在の設定のまま
+void handleJobEnqueue() {
+    char path[sizeof(TxJob::path)];
+    if (!payloadPath(server.arg("file").c_str(), path, sizeof(path))) {
+        server.send(400, "application/json", "{\"error\":\"invalid file\"}");
+        return;
+    }
+    if (!LittleFS.exists(path)) {
+        server.send(404, "application/json", "{\"error\":\"no such payload\"}");
+        return;
+    }
 
-        #ifdef USE_LCD
-            if (progress != lastPercent) {
-                lastPercent = progress;
-                // テキスト表示エリアのクリアと更新
-                M5.Lcd.fillRect(0, 40, 160, 40, BLACK); 
-                M5.Lcd.setCursor(0, 40);
-                M5.Lcd.printf("Progress: %d%%", progress);
-                M5.Lcd.setCursor(0, 50);
-                M5.Lcd.printf("%u / %u bytes", currentPos, totalSize);
-                
-                // プログレスバー描画 (y=65, 高さ10px, 色は送信中と判別しやすいよう CYAN)
-                M5.Lcd.fillRect(0, 65, (progress * 160 / 100), 10, CYAN); 
-            }
-        #else
-            // LED点灯（Atom LiteはLEDを一瞬青に）
-            // 間隔を設けられないので、時々消灯を入れることにより点滅を演出
-            if (f.position() % (CHUNK_SIZE * 10) == 0) { // 10回ごとに消灯
-                M5.dis.drawpix(0, 0x000000); // 消灯
-            } else {
-                M5.dis.drawpix(0, 0x0000ff); // 青点灯
-            }
-        #endif
+    Config c = appConfig;
+    for (int i = 0; i < server.args(); i++) {
+        const ConfigField* field = findConfigField(server.argName(i).c_str());
+        if (!field) continue;
+        if (!configSetFromString(&c, *field, server.arg(i).c_str())) {
+            server.send(400, "application/json", "{\"error\":\"invalid " + String(field->key) + "\"}");
+            return;
+        }
+    }
+    long priority = server.hasArg("priority") ? server.arg("priority").toInt() : 0;
+    if (priority < 0 || priority > TX_PRIORITY_MAX) {
+        server.send(400, "application/json", "{\"error\":\"invalid priority\"}");
+        return;
+    }
 
-        // --- CAN送信処理 ---
-        // CANは最大8byteなので16byteを2回に分けて送信
-        if (bytesRead > 0) {
-            // 1パケット目 (最大8byte) 送信
-            uint8_t firstLen = (bytesRead > 8) ? 8 : bytesRead;
-            sendCAN(CAN_SEND_ID1, buffer, firstLen);
-            // 8byteを超えるデータがある場合、2パケット目を送信
-            if (bytesRead > 8) {
-                delay(CAN_PACKET_GAP); // パケット間の衝突防止
-                sendCAN(CAN_SEND_ID2, buffer + 8, bytesRead - 8);
-            }
+    TxJob job = buildTxJob(c, path);
+    job.priority = priority;
+    uint32_t jobId = enqueueTxJob(job);
+    if (jobId == 0) {
+        server.send(503, "application/json", "{\"error\":\"job table full\"}");
+        return;
+    }
+    Serial.printf("TX job %u queued: %s (priority %ld)\n", jobId, path, priority);
+    server.send(202, "application/json", "{\"job_id\":" + String(jobId) + "}");
+}
+
+// /jobs/cancel?id=N
+void handleJobCancel() {
+    uint32_t jobId = strtoul(server.arg("id").c_str(), nullptr, 10);
+    if (jobId == 0 || !cancelTxJob(jobId)) {
+        server.send(404, "application/json", "{\"error\":\"no such job\"}");
+        return;
+    }
+    server.send(202, "application/json", "{\"cancelling\":" + String(jobId) + "}");
+}
+
+// 自己受信試験を開始する。/selftest[?file=ペイロード名] （省略時は保存済みのファイル）
+void handleSelfTest() {
+    if (loopbackActive()) {
+        server.send(409, "application/json", "{\"error\":\"self test already running\"}");
+        return;
+    }
+    char path[sizeof(TxJob::path)];
+    if (server.hasArg("file")) {
+        if (!payloadPath(server.arg("file").c_str(), path, sizeof(path))) {
+            server.send(400, "application/json", "{\"error\":\"invalid file\"}");
+            return;
+        }
+    } else {
+        strlcpy(path, storedImagePath(), sizeof(path));
+    }
+    if (!LittleFS.exists(path)) {
+        server.send(404, "application/json", "{\"error\":\"no file\"}");
+        return;
+    }
+
+    TxJob job = buildTxJob(appConfig, path);
+    // ISO-TP は相手の Flow Control がないと FF の後で止まるので、チャンク方式で送る
+    if (job.transport == TRANSPORT_ISOTP) job.transport = TRANSPORT_RAW;
+    job.loopback = true;
+    loopbackBegin();
+    uint32_t jobId = enqueueTxJob(job);
+    if (jobId == 0) {
+        loopbackAbort();
+        server.send(503, "application/json", "{\"error\":\"job table full\"}");
+        return;
+    }
+    Serial.printf("Loopback test: job %u, %s\n", jobId, path);
+    server.send(202, "application/json", "{\"job_id\":" + String(jobId) + "}");
+}
+
+// 自己受信試験の結果を JSON に入れる（/status と /selftest/result 用）
+void writeLoopbackResult(JsonObject o, bool withHistogram) {
+    LoopbackResult r = loopbackResult();
+    o["job_id"] = r.jobId;
+    o["state"] = r.state == LOOPBACK_DONE ? "done" : r.state == LOOPBACK_RUNNING ? "running" : "idle";
+    o["frames_sent"] = r.framesSent;
+    o["frames_received"] = r.framesReceived;
+    o["frames_lost"] = r.framesLost;
+    o["tx_failed"] = r.txFailed;
+    o["unmatched"] = r.unmatched;
+    o["latency_min_us"] = r.latencyMinUs;
+    o["latency_avg_us"] = r.latencyAvgUs;
+    o["latency_max_us"] = r.latencyMaxUs;
+    o["frames_per_sec"] = r.framesPerSec;
+    if (!withHistogram) return;
+    JsonArray hist = o["latency_histogram"].to<JsonArray>();
+    for (size_t i = 0; i <= LOOPBACK_BUCKET_COUNT; i++) {
+        JsonObject b = hist.add<JsonObject>();
+        if (i < LOOPBACK_BUCKET_COUNT) b["le_us"] = LOOPBACK_BUCKETS_US[i];
+        else b["le_us"] = "inf";
+        b["count"] = r.buckets[i];
+    }
+}
+
+void handleSelfTestResult() {
+    JsonDocument doc;
+    writeLoopbackResult(doc.to<JsonObject>(), true);
+    String body;
+    serializeJson(doc, body);
+    server.send(200, "application/json", body);
+}
+
+// 送信状況をJSONで返す
+void handleStatus() {
+    TxStatus st = getTxStatus();
+    JsonDocument doc;
+    doc["job_id"] = st.jobId;
+    doc["state"] = txStateName(st.state);
+    doc["total_bytes"] = st.totalBytes;
+    doc["sent_bytes"] = st.bytesSent;
+    doc["progress"] = st.totalBytes > 0 ? (st.bytesSent * 100) / st.totalBytes : 0;
+    doc["frames_sent"] = st.framesSent;
+    doc["frames_failed"] = st.framesFailed;
+    doc["frames_resent"] = st.framesResent;
+    doc["bus_off_recoveries"] = st.busOffRecoveries;
+    doc["rate_gap_us"] = st.rateGapUs;
+    doc["pending_jobs"] = st.pendingJobs;
+    doc["pending_frames"] = st.pendingFrames;
+    writeLoopbackResult(doc["loopback"].to<JsonObject>(), false);
+
+    String body;
+    serializeJson(doc, body);
+    server.send(200, "application/json", body);
+}
+
+// 受信フレームのライブ配信 (SSE)。?ids= でIDを絞る
+void handleLive() {
+    RxIdFilter filter;
+    bool all;
+    if (!liveParseFilter(server.arg("ids").c_str(), &filter, &all)) {
+        server.send(400, "text/plain", "invalid ids");
+        return;
+    }
+    liveStreamStart(server.client(), all ? nullptr : &filter);
+}
+
+// 配信中のIDフィルタを変更する
+void handleLiveFilter() {
+    RxIdFilter filter;
+    bool all;
+    if (!liveParseFilter(server.arg("ids").c_str(), &filter, &all)) {
+        server.send(400, "text/plain", "invalid ids");
+        return;
+    }
+    liveStreamSetFilter(all ? nullptr : &filter);
+    server.send(200, "text/plain", liveStreamActive() ? "ok" : "not streaming");
+}
+
+// 稼働状況を Prometheus のテキスト形式で返す
+void handleMetrics() {
+    ChunkedResponse out(server);
+    out.begin(200, "text/plain; version=0.0.4");
+    metricsWrite(out);
+    out.end();
+}
+
+// 受信統計をJSONで返す（受信したことのある標準IDのみ）
+void handleRxStats() {
+    JsonDocument doc;
+    RxCounters c = canRxCounters();
+    doc["frames"] = c.frames;
+    doc["extended"] = c.extended;
+    doc["ring_drops"] = c.ringDrops[RX_CONSUMER_MONITOR];
+    doc["capture_ring_drops"] = c.ringDrops[RX_CONSUMER_CAPTURE];
+    doc["live_ring_drops"] = c.ringDrops[RX_CONSUMER_LIVE];
+    uint32_t now = (uint32_t)esp_timer_get_time();
+    JsonArray ids = doc["ids"].to<JsonArray>();
+    for (int id = canRxNextActiveId(0); id >= 0; id = canRxNextActiveId(id + 1)) {
+        const RxIdStats* st = canRxStats(id);
+        JsonObject o = ids.add<JsonObject>();
+        o["id"] = id;
+        o["count"] = st->count;
+        o["rate_fps"] = st->rateFps;
+        o["last_us_ago"] = now - st->lastUs;
+        o["min_gap_us"] = st->count > 1 ? st->minGapUs : 0;
+        o["max_gap_us"] = st->maxGapUs;
+    }
+
+    String body;
+    serializeJson(doc, body);
+    server.send(200, "application/json", body);
+}
+
+// キャプチャの状態とファイル一覧をJSONで返す
+void handleCaptureStatus() {
+    CaptureStatus st = getCaptureStatus();
+    JsonDocument doc;
+    doc["active"] = st.active;
+    doc["file_seq"] = st.fileSeq;
+    doc["file_bytes"] = st.fileBytes;
+    doc["records"] = st.records;
+    doc["rotations"] = st.rotations;
+    doc["ring_drops"] = st.ringDrops;
+
+    JsonArray files = doc["files"].to<JsonArray>();
+    File dir = LittleFS.open(CAPTURE_DIR);
+    if (dir) {
+        for (File f = dir.openNextFile(); f; f = dir.openNextFile()) {
+            JsonObject o = files.add<JsonObject>();
+            o["name"] = String(f.name());
+            o["size"] = f.size();
+            f.close();
+        }
+        dir.close();
+    }
+
+    String body;
+    serializeJson(doc, body);
+    server.send(200, "application/json", body);
+}
+
+// キャプチャファイルのダウンロード
+// /capture/download?seq=N&format=bin|candump|asc （candump/ascはその場で変換）
+void handleCaptureDownload() {
+    char path[32];
+    captureFilePath(server.arg("seq").toInt(), path, sizeof(path));
+    File f = LittleFS.open(path, "r");
+    if (!f) {
+        server.send(404, "text/plain", "capture file not found");
+        return;
+    }
+
+    String fmt = server.arg("format");
+    CaptureFormat format = fmt == "candump" ? CAPTURE_FORMAT_CANDUMP
+                         : fmt == "asc" ? CAPTURE_FORMAT_ASC : CAPTURE_FORMAT_BIN;
+    String name = String(path + strlen(CAPTURE_DIR) + 1);
+    if (format == CAPTURE_FORMAT_BIN) {
+        server.sendHeader("Content-Disposition", "attachment; filename=" + name);
+        server.streamFile(f, "application/octet-stream");
+        f.close();
+        return;
+    }
+
+    name.replace(".bin", format == CAPTURE_FORMAT_ASC ? ".asc" : ".log");
+    server.sendHeader("Content-Disposition", "attachment; filename=" + name);
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(200, "text/plain", "");
+    if (format == CAPTURE_FORMAT_ASC) server.sendContent(captureAscHeader());
+
+    // レコードをまとめて読み、テキストもまとめて送る
+    CaptureRecord recs[32];
+    char out[3072]; // 1行最大 ~75byte * 32件
+    uint64_t baseUs = 0;
+    size_t n;
+    while ((n = f.read((uint8_t*)recs, sizeof(recs)) / sizeof(CaptureRecord)) > 0) {
+        size_t len = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (recs[i].flags & CAPTURE_FLAG_HEADER) baseUs = recs[i].timestampUs;
+            len += captureFormatRecord(recs[i], format, baseUs, out + len, sizeof(out) - len);
         }
-        delay(CAN_CHUNK_INTERVAL); // 次の16byteセットまでの間隔
+        server.sendContent(out, len);
     }
     f.close();
 
-    #ifdef USE_LCD
-        M5.Lcd.fillRect(0, 40, 160, 40, BLACK);
-        M5.Lcd.setCursor(0, 40);
-        M5.Lcd.setTextColor(GREEN);
-        M5.Lcd.println("Send Complete!");
-        M5.Lcd.setTextColor(WHITE);
-        delay(1500); // 完了メッセージ確認用
-    #else
-        M5.dis.drawpix(0, 0x000000); // 終了後に完全に消灯
-    #endif
-    Serial.println("--- CAN Transmission End ---");
+    if (format == CAPTURE_FORMAT_ASC) server.sendContent(captureAscFooter());
+    server.sendContent("");
 }
 
 void setup() {
@@ -395,15 +1004,22 @@ void setup() {
     #ifdef USE_LCD
         M5.begin();
         M5.Lcd.setRotation(3);
+        setupLcdView();
     #else
         M5.begin(true, false, true); // Serial, I2C, LED
     #endif
 
+    setupLog();
     LittleFS.begin(true);
-    // 起動時に設定を読み込む
-    updateParamsFromJson();
+    if (!LittleFS.exists(PAYLOAD_DIR)) LittleFS.mkdir(PAYLOAD_DIR);
+    setupBlockUpload();
+    // 起動時に設定を読み込む（以降はRAM上の appConfig を使う）
+    loadConfig();
 
     setupCAN();
+    setupCANTx();
+    setupCANRx();
+    setupCapture();
     WiFi.softAP(ssid, password);
 
     // Content-Lengthヘッダーを取得可能にする
@@ -412,35 +1028,155 @@ void setup() {
 
     server.on("/", HTTP_GET, handleRoot);
     server.on("/upload", HTTP_POST, []() { server.send(200); }, handleFileUpload);
+    server.on("/upload_trace", HTTP_POST, []() { server.send(200); }, handleTraceUpload);
+    server.on("/replay", HTTP_GET, handleReplay);
+    server.on("/payloads", HTTP_GET, handlePayloads);
+    server.on("/payloads/upload", HTTP_POST, []() { server.send(200); }, handlePayloadUpload);
+    server.on("/payloads/delete", HTTP_GET, handlePayloadDelete);
+    server.on("/blocks/begin", HTTP_GET, handleBlockBegin);
+    server.on("/blocks/status", HTTP_GET, handleBlockStatus);
+    server.on("/blocks/put", HTTP_POST, handleBlockPutDone, handleBlockPut);
+    server.on("/blocks/commit", HTTP_GET, handleBlockCommit);
+    server.on("/blocks/abort", HTTP_GET, handleBlockAbort);
+    server.on("/selftest", HTTP_GET, handleSelfTest);
+    server.on("/selftest/result", HTTP_GET, handleSelfTestResult);
+    server.on("/jobs", HTTP_GET, handleJobs);
+    server.on("/jobs/enqueue", HTTP_GET, handleJobEnqueue);
+    server.on("/jobs/cancel", HTTP_GET, handleJobCancel);
     server.on("/process", HTTP_GET, []() {
-        processFile();
-        server.send(200, "text/plain", "OK");
+        uint32_t jobId = startTransmit();
+        if (jobId == 0) {
+            server.send(503, "application/json", "{\"error\":\"no file or queue full\"}");
+            return;
+        }
+        server.send(202, "application/json", "{\"job_id\":" + String(jobId) + "}");
+    });
+    server.on("/status", HTTP_GET, handleStatus);
+    server.on("/rx_stats", HTTP_GET, handleRxStats);
+    server.on("/metrics", HTTP_GET, handleMetrics);
+    server.on("/live", HTTP_GET, handleLive);
+    server.on("/live/filter", HTTP_GET, handleLiveFilter);
+    server.on("/capture", HTTP_GET, handleCaptureStatus);
+    server.on("/capture/start", HTTP_GET, []() {
+        captureStart();
+        server.send(202, "application/json", "{\"capture\":\"starting\"}");
+    });
+    server.on("/capture/stop", HTTP_GET, []() {
+        captureStop();
+        server.send(202, "application/json", "{\"capture\":\"stopping\"}");
     });
+    server.on("/capture/download", HTTP_GET, handleCaptureDownload);
     server.on("/save_config", HTTP_POST, handleSaveConfig);
     server.on("/reset_config", HTTP_GET, handleResetConfig);
 
     server.begin();
     #ifdef USE_LCD
-    M5.Lcd.fillScreen(BLACK);
-    M5.Lcd.setCursor(0, 0);
-    M5.Lcd.println("AP Mode OK");
-    M5.Lcd.println(WiFi.softAPIP().toString());
-    M5.Lcd.println("Ready: CAN Monitor");
+    lcdShowMessage("AP Mode OK\n%s\nReady: CAN Monitor\n", WiFi.softAPIP().toString().c_str());
     #endif
 }
 
 // --- 受信モニター用設定 ---
 bool DEBUG_DUMMY_CAN = false; // trueにするとランダムで受信マークが出る
 const uint32_t SCAN_INTERVAL_MS = 100; // 1コマの時間
-const int MONITOR_ID_COUNT = 3; 
-const uint32_t MONITOR_IDS[MONITOR_ID_COUNT] = {0x123, 0x124, 0x100};
-bool idReceivedFlags[MONITOR_ID_COUNT] = {false};
+uint32_t monitorIds[LCD_MONITOR_MAX];  // 受信チャートに並べるID (config.json の monitor_id*)
+int monitorIdCount = 0;
+bool idReceivedFlags[LCD_MONITOR_MAX] = {false};
+uint32_t monitorSeenCounts[LCD_MONITOR_MAX] = {0}; // 前回描画時点の受信数
+uint32_t lastRateUpdate = 0;
 
-int scanX = 0;           
 uint32_t lastScanTime = 0;
-int heartBeatStep = 0;
 
-void loop() {
+// 設定からモニター対象IDを読み直す（保存で変わっても次のコマから反映される）
+void loadMonitorIds() {
+    const uint32_t ids[LCD_MONITOR_MAX] = {appConfig.monitorId1, appConfig.monitorId2,
+                                           appConfig.monitorId3, appConfig.monitorId4};
+    monitorIdCount = appConfig.monitorIdCount > LCD_MONITOR_MAX ? LCD_MONITOR_MAX : appConfig.monitorIdCount;
+    for (int i = 0; i < monitorIdCount; i++) {
+        if (monitorIds[i] != ids[i]) {
+            monitorIds[i] = ids[i];
+            const RxIdStats* st = canRxStats(ids[i]);
+            monitorSeenCounts[i] = st ? st->count : 0;
+        }
+    }
+}
+
+// 受信統計テーブルから、前回の描画以降に受信したモニター対象IDにフラグを立てる
+void updateMonitorFlags() {
+    loadMonitorIds();
+    for (int i = 0; i < monitorIdCount; i++) {
+        const RxIdStats* st = canRxStats(monitorIds[i]);
+        if (st && st->count != monitorSeenCounts[i]) {
+            monitorSeenCounts[i] = st->count;
+            idReceivedFlags[i] = true;
+        }
+    }
+}
+
+// --- 送信進捗表示用 ---
+bool txDisplayActive = false; // 送信中の進捗表示を出しているか
+uint32_t shownTxJobId = 0;
+int shownTxPercent = -1;      // 前回の進捗を保持（描画のチラつき防止）
+uint32_t txDoneShownAt = 0;   // 完了メッセージを出した時刻 (0なら表示なし)
+const uint32_t TX_DONE_HOLD_MS = 1500; // 完了メッセージ確認用
+
+// 送信タスクの進捗を画面/LEDに反映する
+// 進捗または完了メッセージを表示している間は true を返す（受信チャートの描画を止める）
+bool updateTxDisplay() {
+    TxStatus st = getTxStatus();
+    if (st.state == TX_RUNNING) {
+        if (!txDisplayActive || st.jobId != shownTxJobId) {
+            txDisplayActive = true;
+            shownTxJobId = st.jobId;
+            shownTxPercent = -1;
+            txDoneShownAt = 0;
+            #ifdef USE_LCD
+                lcdShowMessage("CAN Transmitting...\nJob: %u\nSize: %u", st.jobId, st.totalBytes);
+            #endif
+        }
+
+        // --- 進捗計算と画面表示 ---
+        #ifdef USE_LCD
+            int progress = st.totalBytes > 0 ? (st.bytesSent * 100) / st.totalBytes : 0;
+            if (progress != shownTxPercent) {
+                shownTxPercent = progress;
+                // プログレスバーは y=65、色は送信中と判別しやすいよう CYAN
+                lcdShowProgress(progress, CYAN, 65, "%u / %u bytes", st.bytesSent, st.totalBytes);
+            }
+        #else
+            // LED点灯（Atom LiteはLEDを青に）
+            // 時々消灯を入れることにより点滅を演出
+            if ((st.bytesSent / 16) % 10 == 0) { // 10チャンクごとに消灯
+                M5.dis.drawpix(0, 0x000000); // 消灯
+            } else {
+                M5.dis.drawpix(0, 0x0000ff); // 青点灯
+            }
+        #endif
+        return true;
+    }
+
+    if (txDisplayActive) {
+        // 送信中 → 完了/失敗 に変わった
+        txDisplayActive = false;
+        #ifdef USE_LCD
+            if (st.state == TX_FAILED) lcdShowResult("Send Failed!", RED);
+            else if (st.state == TX_CANCELLED) lcdShowResult("Send Cancelled", YELLOW);
+            else lcdShowResult("Send Complete!", GREEN);
+            txDoneShownAt = millis();
+        #else
+            M5.dis.drawpix(0, 0x000000); // 終了後に完全に消灯
+        #endif
+    }
+
+    // delay() せずに完了メッセージを一定時間残す
+    if (txDoneShownAt != 0) {
+        if (millis() - txDoneShownAt < TX_DONE_HOLD_MS) return true;
+        txDoneShownAt = 0;
+    }
+    return false;
+}
+
+// loop() の中身（処理時間を計るため分けている）
+void loopBody() {
     M5.update(); // ボタン状態更新
     server.handleClient();
 
@@ -459,95 +1195,79 @@ void loop() {
             delay(100); // 視認用の一瞬のウェイト
         #endif
 
-        Serial.println("Button A Pressed: Starting processFile...");
-        processFile();
+        Serial.println("Button A Pressed: Starting transmission...");
+        startTransmit();
+    }
+
+    // 送信中は進捗表示を優先し、受信チャートの描画だけを止める
+    bool txDisplayBusy = updateTxDisplay();
+
+    // ライブ配信（まとめて送る）
+    liveStreamPoll();
+
+    // 自己受信試験の集計（送信が終わって受信を待ち終えたら確定する）
+    loopbackPoll();
+
+    // 受信レートの更新（受信自体は受信タスクが行い、統計はアップロード中も更新される）
+    if (millis() - lastRateUpdate >= 1000) {
+        lastRateUpdate = millis();
+        canRxUpdateRates();
+    }
+
+    // アップロード完了表示を一定時間残してから受信表示を再開する
+    if (uploadDoneShownAt != 0 && millis() - uploadDoneShownAt >= UPLOAD_DONE_HOLD_MS) {
+        uploadDoneShownAt = 0;
+        isUploading = false;
+    }
+
+    // 1. 受信リングから取り出してログに積む（アップロード中も止めない）
+    // CAN ID と受信したデータを16進数で表示（書式化と Serial 出力はログタスクが行う）
+    RxFrame rx;
+    while (canRxPop(RX_CONSUMER_MONITOR, &rx)) {
+        logWriteHex(LOG_CAT_RX, LOG_DEBUG, LOG_FMT_RX_FRAME, rx.identifier, rx.data, rx.dlc);
+        #ifndef USE_LCD
+            M5.dis.drawpix(0, 0x00ff00); // Atom Liteなら受信時にLEDを一瞬緑に
+        #endif
     }
 
+    // アップロード中は進捗表示を優先し、受信チャートの描画だけを止める
     if (!isUploading) {
-        // 1. CAN受信チェック
-        twai_message_t rx_msg;
-        if (twai_receive(&rx_msg, 0) == ESP_OK) {
-            // シリアル出力（詳細はシリアルで確認）
-            // CAN ID と受信したデータを16進数で表示
-            Serial.printf("RX ID: 0x%03X", rx_msg.identifier);
-            Serial.print(", Data: ");
-            for (int i = 0; i < rx_msg.data_length_code; i++) {
-                Serial.printf("%02X ", rx_msg.data[i]);
-            }
-            Serial.println();
-            // 受信したIDがモニター対象のIDリストにあるかチェックしてフラグを立てる
-            for (int i = 0; i < MONITOR_ID_COUNT; i++) {
-                if (rx_msg.identifier == MONITOR_IDS[i]) idReceivedFlags[i] = true;
-            }
-            #ifndef USE_LCD
-                M5.dis.drawpix(0, 0x00ff00); // Atom Liteなら受信時にLEDを一瞬緑に
-            #endif
-        }
 
         // 2. デバッグ用ダミーデータ生成 (0.2%の確率で受信を偽装)
         if (DEBUG_DUMMY_CAN) {
             if (random(1000) < 2) { // 確率0.2%
-                idReceivedFlags[random(MONITOR_ID_COUNT)] = true;
+                if (monitorIdCount > 0) idReceivedFlags[random(monitorIdCount)] = true;
             }
         }
 
         // 3. 描画更新処理 (LCDがある機種のみ)
         #ifdef USE_LCD
-        if (millis() - lastScanTime >= SCAN_INTERVAL_MS) {
+        if (!txDisplayBusy && millis() - lastScanTime >= SCAN_INTERVAL_MS) {
             lastScanTime = millis();
+            updateMonitorFlags();
 
-            // --- 生存確認インジケータ (右下の隅 y=70付近に配置) ---
-            const char* hb_chars = "|/-\\";
-            M5.Lcd.setTextColor(DARKGREY, BLACK); // 文字は標準的なグレー
-            M5.Lcd.setCursor(152, 72);
-            M5.Lcd.printf("%c", hb_chars[heartBeatStep % 4]);
-            heartBeatStep++;
-
-            // --- チャート描画レイアウト ---
-            int chartStartX = 40; // IDラベル用の余白
-            int currentX = chartStartX + scanX;
-            int eraserX = chartStartX + ((scanX + 1) % (160 - chartStartX));
-
-            // チャートエリア(y=40-80)のみを消去
-            M5.Lcd.fillRect(eraserX, 40, 2, 40, BLACK); 
-
-            for (int i = 0; i < MONITOR_ID_COUNT; i++) {
-                int yPos = 42 + (i * 12); // 下半分に収まるよう調整
-                
-                // 左端(scanX=0)でIDラベルを描画
-                if (scanX == 0) {
-                    M5.Lcd.setTextColor(WHITE, BLACK); // ID文字は白でハッキリ
-                    M5.Lcd.setCursor(2, yPos);
-                    M5.Lcd.printf("%03X:", MONITOR_IDS[i]);
-                }
-
-                // 受信状況の描画
-                // 受信あり：シアン(CYAN) - 明るく見やすい
-                // 受信なし：中間グレー(0x7BEF) - 背景よりは明るい
-                uint16_t color = idReceivedFlags[i] ? CYAN : 0x7BEF; 
-                
-                // 受信時は少し太めの線(2px幅)にして強調
-                if (idReceivedFlags[i]) {
-                    M5.Lcd.drawFastVLine(currentX, yPos, 10, color);
-                    if (currentX < 159) M5.Lcd.drawFastVLine(currentX + 1, yPos, 10, color);
-                } else {
-                    M5.Lcd.drawPixel(currentX, yPos + 5, color); // 未受信時は点(1px)のみ
-                }
-                
-                idReceivedFlags[i] = false; 
+            // 描画はLCDタスクがスプライトに行い、まとめて転送する
+            uint32_t received = 0;
+            for (int i = 0; i < monitorIdCount; i++) {
+                if (idReceivedFlags[i]) received |= 1u << i;
+                idReceivedFlags[i] = false;
             }
-
-            // 描画位置を進める
-            scanX++;
-            if (scanX >= (160 - chartStartX)) scanX = 0; 
+            lcdChartStep(monitorIds, monitorIdCount, received);
         }
         #else
         // LCDがない場合（Atom等）の処理、フラグだけ定期的にクリア
-        if (millis() - lastScanTime >= SCAN_INTERVAL_MS) {
+        if (!txDisplayBusy && millis() - lastScanTime >= SCAN_INTERVAL_MS) {
             lastScanTime = millis();
             M5.dis.drawpix(0, 0x000000); // LED消灯
-            for (int i = 0; i < MONITOR_ID_COUNT; i++) idReceivedFlags[i] = false;
+            updateMonitorFlags();
+            for (int i = 0; i < monitorIdCount; i++) idReceivedFlags[i] = false;
         }
         #endif
     }
 }
+
+void loop() {
+    int64_t loopStartUs = esp_timer_get_time();
+    loopBody();
+    metricsObserveLoopUs((uint32_t)(esp_timer_get_time() - loopStartUs));
+}
@@ -0,0 +1,182 @@
+#include "metrics.h"
+#include <atomic>
+#include <LittleFS.h>
+#include "driver/twai.h"
+#include "esp_heap_caps.h"
+#include "can_tx.h"
+#include "can_rx.h"
+#include "async_log.h"
+
+// 送信ID別カウンター。slot の値は id+1 (0 は空き) で、最初に来たIDが CAS で確保する
+struct TxIdCounter {
+    std::atomic<uint32_t> slot;
+    std::atomic<uint32_t> sent;
+    std::atomic<uint32_t> failed;
+};
+static TxIdCounter txIds[METRICS_TX_ID_SLOTS];
+static std::atomic<uint32_t> txOtherSent(0);
+static std::atomic<uint32_t> txOtherFailed(0);
+
+static std::atomic<uint32_t> uploadBytes(0);
+static std::atomic<uint32_t> uploadRate(0);
+
+// loop() 処理時間のヒストグラム（上限µs。最後の +Inf は別に数える）
+static const uint32_t LOOP_BUCKETS_US[] = {100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 1000000};
+static const size_t LOOP_BUCKET_COUNT = sizeof(LOOP_BUCKETS_US) / sizeof(LOOP_BUCKETS_US[0]);
+static std::atomic<uint32_t> loopBuckets[LOOP_BUCKET_COUNT + 1];
+// Xtensa では64bitのアトミックがロックフリーでないので32bitで数える（Prometheus のカウンタなので一周してよい）
+static std::atomic<uint32_t> loopSumUs(0);
+
+static TxIdCounter* findTxId(uint32_t id) {
+    uint32_t key = id + 1;
+    for (TxIdCounter& c : txIds) {
+        uint32_t v = c.slot.load(std::memory_order_relaxed);
+        if (v == key) return &c;
+        if (v == 0) {
+            uint32_t expected = 0;
+            if (c.slot.compare_exchange_strong(expected, key, std::memory_order_relaxed) || expected == key) {
+                return &c;
+            }
+        }
+    }
+    return nullptr;
+}
+
+void metricsCountTx(uint32_t id, bool ok) {
+    TxIdCounter* c = findTxId(id);
+    if (c) {
+        (ok ? c->sent : c->failed).fetch_add(1, std::memory_order_relaxed);
+    } else {
+        (ok ? txOtherSent : txOtherFailed).fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void metricsAddUploadBytes(uint32_t bytes) {
+    uploadBytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void metricsSetUploadRate(uint32_t kbPerSec) {
+    uploadRate.store(kbPerSec, std::memory_order_relaxed);
+}
+
+void metricsObserveLoopUs(uint32_t us) {
+    size_t i = 0;
+    while (i < LOOP_BUCKET_COUNT && us > LOOP_BUCKETS_US[i]) i++;
+    loopBuckets[i].fetch_add(1, std::memory_order_relaxed);
+    loopSumUs.fetch_add(us, std::memory_order_relaxed);
+}
+
+static const char* twaiStateName(twai_state_t state) {
+    switch (state) {
+        case TWAI_STATE_STOPPED:    return "stopped";
+        case TWAI_STATE_RUNNING:    return "running";
+        case TWAI_STATE_BUS_OFF:    return "bus_off";
+        case TWAI_STATE_RECOVERING: return "recovering";
+        default:                    return "unknown";
+    }
+}
+
+static void writeCan(ChunkedResponse& out) {
+    out.print("# TYPE can_tx_frames_total counter\n");
+    for (const TxIdCounter& c : txIds) {
+        uint32_t key = c.slot.load(std::memory_order_relaxed);
+        if (key == 0) continue;
+        out.printf("can_tx_frames_total{id=\"0x%X\"} %u\n", key - 1, c.sent.load(std::memory_order_relaxed));
+    }
+    out.printf("can_tx_frames_total{id=\"other\"} %u\n", txOtherSent.load(std::memory_order_relaxed));
+    out.print("# TYPE can_tx_failures_total counter\n");
+    for (const TxIdCounter& c : txIds) {
+        uint32_t key = c.slot.load(std::memory_order_relaxed);
+        if (key == 0) continue;
+        out.printf("can_tx_failures_total{id=\"0x%X\"} %u\n", key - 1, c.failed.load(std::memory_order_relaxed));
+    }
+    out.printf("can_tx_failures_total{id=\"other\"} %u\n", txOtherFailed.load(std::memory_order_relaxed));
+
+    TxStatus st = getTxStatus();
+    out.print("# TYPE can_tx_queue_frames gauge\n");
+    out.printf("can_tx_queue_frames %u\n", st.pendingFrames);
+    out.print("# TYPE can_tx_queue_jobs gauge\n");
+    out.printf("can_tx_queue_jobs %u\n", st.pendingJobs);
+    out.print("# TYPE can_tx_rate_gap_us gauge\n");
+    out.printf("can_tx_rate_gap_us %u\n", st.rateGapUs);
+    out.print("# TYPE can_bus_off_recoveries_total counter\n");
+    out.printf("can_bus_off_recoveries_total %u\n", st.busOffRecoveries);
+
+    twai_status_info_t info;
+    if (twai_get_status_info(&info) == ESP_OK) {
+        out.print("# TYPE twai_state gauge\n");
+        for (twai_state_t s : {TWAI_STATE_STOPPED, TWAI_STATE_RUNNING, TWAI_STATE_BUS_OFF, TWAI_STATE_RECOVERING}) {
+            out.printf("twai_state{state=\"%s\"} %d\n", twaiStateName(s), info.state == s ? 1 : 0);
+        }
+        out.print("# TYPE twai_tx_error_counter gauge\n");
+        out.printf("twai_tx_error_counter %u\n", info.tx_error_counter);
+        out.print("# TYPE twai_rx_error_counter gauge\n");
+        out.printf("twai_rx_error_counter %u\n", info.rx_error_counter);
+        out.print("# TYPE twai_tx_queue_frames gauge\n");
+        out.printf("twai_tx_queue_frames %u\n", info.msgs_to_tx);
+        out.print("# TYPE twai_tx_failed_total counter\n");
+        out.printf("twai_tx_failed_total %u\n", info.tx_failed_count);
+        out.print("# TYPE twai_rx_missed_total counter\n");
+        out.printf("twai_rx_missed_total %u\n", info.rx_missed_count);
+        out.print("# TYPE twai_rx_overrun_total counter\n");
+        out.printf("twai_rx_overrun_total %u\n", info.rx_overrun_count);
+        out.print("# TYPE twai_arbitration_lost_total counter\n");
+        out.printf("twai_arbitration_lost_total %u\n", info.arb_lost_count);
+        out.print("# TYPE twai_bus_error_total counter\n");
+        out.printf("twai_bus_error_total %u\n", info.bus_error_count);
+    }
+
+    RxCounters rx = canRxCounters();
+    out.print("# TYPE can_rx_frames_total counter\n");
+    out.printf("can_rx_frames_total %u\n", rx.frames);
+    out.print("# TYPE can_rx_extended_frames_total counter\n");
+    out.printf("can_rx_extended_frames_total %u\n", rx.extended);
+    out.print("# TYPE can_rx_ring_drops_total counter\n");
+    out.printf("can_rx_ring_drops_total{consumer=\"monitor\"} %u\n", rx.ringDrops[RX_CONSUMER_MONITOR]);
+    out.printf("can_rx_ring_drops_total{consumer=\"capture\"} %u\n", rx.ringDrops[RX_CONSUMER_CAPTURE]);
+    out.printf("can_rx_ring_drops_total{consumer=\"live\"} %u\n", rx.ringDrops[RX_CONSUMER_LIVE]);
+    out.print("# TYPE can_rx_id_frames_total counter\n");
+    for (int id = canRxNextActiveId(0); id >= 0; id = canRxNextActiveId(id + 1)) {
+        const RxIdStats* s = canRxStats(id);
+        out.printf("can_rx_id_frames_total{id=\"0x%03X\"} %u\n", id, s->count);
+    }
+}
+
+static void writeSystem(ChunkedResponse& out) {
+    out.print("# TYPE log_dropped_total counter\n");
+    out.printf("log_dropped_total %u\n", logDropped());
+
+    out.print("# TYPE upload_bytes_total counter\n");
+    out.printf("upload_bytes_total %u\n", uploadBytes.load(std::memory_order_relaxed));
+    out.print("# TYPE upload_rate_kbps gauge\n");
+    out.printf("upload_rate_kbps %u\n", uploadRate.load(std::memory_order_relaxed));
+
+    out.print("# TYPE littlefs_total_bytes gauge\n");
+    out.printf("littlefs_total_bytes %u\n", (uint32_t)LittleFS.totalBytes());
+    out.print("# TYPE littlefs_used_bytes gauge\n");
+    out.printf("littlefs_used_bytes %u\n", (uint32_t)LittleFS.usedBytes());
+
+    out.print("# TYPE heap_free_bytes gauge\n");
+    out.printf("heap_free_bytes %u\n", ESP.getFreeHeap());
+    out.print("# TYPE heap_min_free_bytes gauge\n");
+    out.printf("heap_min_free_bytes %u\n", ESP.getMinFreeHeap());
+    out.print("# TYPE heap_largest_free_block_bytes gauge\n");
+    out.printf("heap_largest_free_block_bytes %u\n", (uint32_t)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+
+    // Prometheus のヒストグラムは累積値で出す
+    out.print("# TYPE loop_duration_us histogram\n");
+    uint32_t cumulative = 0;
+    for (size_t i = 0; i < LOOP_BUCKET_COUNT; i++) {
+        cumulative += loopBuckets[i].load(std::memory_order_relaxed);
+        out.printf("loop_duration_us_bucket{le=\"%u\"} %u\n", LOOP_BUCKETS_US[i], cumulative);
+    }
+    cumulative += loopBuckets[LOOP_BUCKET_COUNT].load(std::memory_order_relaxed);
+    out.printf("loop_duration_us_bucket{le=\"+Inf\"} %u\n", cumulative);
+    out.printf("loop_duration_us_sum %u\n", loopSumUs.load(std::memory_order_relaxed));
+    out.printf("loop_duration_us_count %u\n", cumulative);
+}
+
+void metricsWrite(ChunkedResponse& out) {
+    writeCan(out);
+    writeSystem(out);
+}
@@ -0,0 +1,124 @@
+#include "prefetch_reader.h"
+#include "esp_heap_caps.h"
+#include "task_config.h"
+
+bool PrefetchReader::begin() {
+    if (started_) return true;
+    // 途中で失敗したら、確保できた分は残して次の呼び出しで続きから試す
+    for (uint8_t*& block : blocks_) {
+        if (!block) block = (uint8_t*)malloc(blockSize_);
+        if (!block) return false;
+    }
+    if (!emptyQueue_) emptyQueue_ = xQueueCreate(2, sizeof(uint8_t));
+    if (!fullQueue_) fullQueue_ = xQueueCreate(2, sizeof(uint8_t));
+    if (!emptyQueue_ || !fullQueue_) return false;
+    started_ = xTaskCreatePinnedToCore(fillTask, "prefetch", PREFETCH_TASK_STACK, this,
+                                       PREFETCH_TASK_PRIORITY, nullptr, NET_CORE) == pdPASS;
+    return started_;
+}
+
+// 空いたバッファを受け取ってファイルの続きを読み、読み込み済みとして返す
+void PrefetchReader::fillTask(void* arg) {
+    PrefetchReader* self = static_cast<PrefetchReader*>(arg);
+    uint8_t index;
+    for (;;) {
+        if (xQueueReceive(self->emptyQueue_, &index, portMAX_DELAY) != pdTRUE) continue;
+        self->blockLen_[index] = self->file_.read(self->blocks_[index], self->blockSize_);
+        xQueueSend(self->fullQueue_, &index, portMAX_DELAY);
+    }
+}
+
+// まだ依頼していない部分があれば、バッファを先読みタスクに渡す
+bool PrefetchReader::requestBlock(uint8_t index) {
+    if (requested_ >= size_) return false;
+    requested_ += blockSize_;
+    outstanding_++;
+    xQueueSend(emptyQueue_, &index, portMAX_DELAY);
+    return true;
+}
+
+bool PrefetchReader::open(const char* path) {
+    close();
+    file_ = LittleFS.open(path, "r");
+    if (!file_) return false;
+    size_ = file_.size();
+    pos_ = 0;
+
+    // PSRAM、なければ内部RAMに余裕があれば丸ごと読み込む
+    size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    if (size_ > 0 && heap_caps_get_free_size(MALLOC_CAP_SPIRAM) > size_) {
+        image_ = (uint8_t*)heap_caps_malloc(size_, MALLOC_CAP_SPIRAM);
+    } else if (size_ > 0 && size_ <= PREFETCH_RAM_MAX && largest > size_ + PREFETCH_HEAP_RESERVE) {
+        image_ = (uint8_t*)heap_caps_malloc(size_, MALLOC_CAP_8BIT);
+    }
+    if (image_) {
+        if (file_.read(image_, size_) == size_) {
+            file_.close();
+            return true;
+        }
+        // 読めなければダブルバッファで読み直す
+        free(image_);
+        image_ = nullptr;
+        file_.seek(0);
+    }
+
+    if (!begin()) {
+        file_.close();
+        return false;
+    }
+    requested_ = 0;
+    current_ = -1;
+    currentPos_ = 0;
+    requestBlock(0);
+    requestBlock(1);
+    return true;
+}
+
+void PrefetchReader::close() {
+    if (image_) {
+        free(image_);
+        image_ = nullptr;
+    }
+    // 先読みタスクが読んでいる途中なら、終わるのを待ってから閉じる
+    uint8_t index;
+    while (outstanding_ > 0) {
+        if (xQueueReceive(fullQueue_, &index, portMAX_DELAY) == pdTRUE) outstanding_--;
+    }
+    current_ = -1;
+    if (file_) file_.close();
+    size_ = 0;
+    pos_ = 0;
+}
+
+size_t PrefetchReader::read(uint8_t* out, size_t len) {
+    if (len > size_ - pos_) len = size_ - pos_;
+    if (image_) {
+        memcpy(out, image_ + pos_, len);
+        pos_ += len;
+        return len;
+    }
+
+    size_t copied = 0;
+    while (copied < len) {
+        if (current_ < 0 || currentPos_ >= blockLen_[current_]) {
+            // 読み終えたバッファは次の先読みに回し、もう一方を受け取る
+            if (current_ >= 0) requestBlock(current_);
+            if (outstanding_ == 0) break;
+            uint8_t index;
+            xQueueReceive(fullQueue_, &index, portMAX_DELAY);
+            outstanding_--;
+            current_ = index;
+            currentPos_ = 0;
+            if (blockLen_[current_] == 0) break;
+        }
+        size_t n = blockLen_[current_] - currentPos_;
+        if (n > len - copied) n = len - copied;
+        memcpy(out + copied, blocks_[current_] + currentPos_, n);
+        currentPos_ += n;
+        copied += n;
+    }
+    // 読み込みエラーで途切れたら、そこをファイルの終わりとして扱う
+    if (copied < len) size_ = pos_ + copied;
+    pos_ += copied;
+    return copied;
+}
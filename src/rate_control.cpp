@@ -0,0 +1,70 @@
+#include "rate_control.h"
+#include "frame_scheduler.h"
+
+void TxRateController::reset(uint32_t startGapUs) {
+    gap_ = startGapUs > RATE_MAX_GAP_US ? RATE_MAX_GAP_US : startGapUs;
+    healthyRun_ = 0;
+    unsent_ = 0;
+    twai_status_info_t info;
+    if (twai_get_status_info(&info) == ESP_OK) {
+        lastTec_ = info.tx_error_counter;
+        lastArbLost_ = info.arb_lost_count;
+    }
+}
+
+void TxRateController::backOff() {
+    // 0 から倍にしても広がらないので、最低でも 1 フレーム分は空ける
+    uint32_t next = gap_ < canFrameTimeUs(8) ? canFrameTimeUs(8) : gap_ * 2;
+    gap_ = next > RATE_MAX_GAP_US ? RATE_MAX_GAP_US : next;
+    healthyRun_ = 0;
+}
+
+TxBusHealth TxRateController::sample(bool sent) {
+    twai_status_info_t info;
+    if (twai_get_status_info(&info) != ESP_OK) return sent ? BUS_HEALTHY : BUS_STRESSED;
+    unsent_ = info.msgs_to_tx;
+    if (info.state == TWAI_STATE_BUS_OFF || info.state == TWAI_STATE_RECOVERING) {
+        backOff();
+        return BUS_OFF;
+    }
+
+    bool stressed = !sent ||
+                    info.tx_error_counter > lastTec_ ||
+                    info.tx_error_counter >= RATE_TEC_WARNING ||
+                    info.arb_lost_count != lastArbLost_ ||
+                    info.msgs_to_tx >= RATE_TX_QUEUE_HIGH;
+    lastTec_ = info.tx_error_counter;
+    lastArbLost_ = info.arb_lost_count;
+    if (stressed) {
+        backOff();
+        return BUS_STRESSED;
+    }
+
+    if (++healthyRun_ >= RATE_HEALTHY_FRAMES) {
+        healthyRun_ = 0;
+        uint32_t step = gap_ / 16;
+        gap_ -= step > 0 ? step : (gap_ > 0 ? 1 : 0);
+    }
+    return BUS_HEALTHY;
+}
+
+uint32_t TxRateController::gapUs(uint8_t dlc) const {
+    uint32_t floorUs = canFrameTimeUs(dlc);
+    return gap_ > floorUs ? gap_ : floorUs;
+}
+
+bool twaiRecoverBusOff() {
+    twai_status_info_t info;
+    if (twai_get_status_info(&info) != ESP_OK) return false;
+    if (info.state == TWAI_STATE_BUS_OFF && twai_initiate_recovery() != ESP_OK) return false;
+
+    // 復帰 (11 recessive bit × 128 回の検出) が終わると STOPPED になる
+    uint32_t start = millis();
+    while (millis() - start < BUS_OFF_RECOVERY_TIMEOUT_MS) {
+        if (twai_get_status_info(&info) != ESP_OK) return false;
+        if (info.state == TWAI_STATE_STOPPED) return twai_start() == ESP_OK;
+        if (info.state == TWAI_STATE_RUNNING) return true;
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    return false;
+}
@@ -0,0 +1,166 @@
+#include "trace_reader.h"
+#include "capture_log.h"
+#include "can_rx.h"
+
+bool TraceReader::open(const char* path) {
+    close();
+    file_ = LittleFS.open(path, "r");
+    if (!file_) return false;
+    size_ = file_.size();
+
+    // 先頭レコードのマジックで形式を判定
+    CaptureRecord header;
+    if (file_.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+        (header.flags & CAPTURE_FLAG_HEADER) &&
+        memcmp(header.data, CAPTURE_MAGIC, 6) == 0) {
+        format_ = TRACE_FORMAT_CAPTURE;
+    } else {
+        format_ = TRACE_FORMAT_CANDUMP;
+    }
+    rewind();
+    return true;
+}
+
+void TraceReader::close() {
+    if (file_) file_.close();
+    format_ = TRACE_FORMAT_UNKNOWN;
+}
+
+void TraceReader::rewind() {
+    file_.seek(0);
+    consumed_ = 0;
+    bufLen_ = 0;
+    bufPos_ = 0;
+}
+
+bool TraceReader::fill() {
+    // 未処理分を先頭に寄せて続きを読む
+    if (bufPos_ > 0) {
+        memmove(buf_, buf_ + bufPos_, bufLen_ - bufPos_);
+        bufLen_ -= bufPos_;
+        bufPos_ = 0;
+    }
+    size_t n = file_.read(buf_ + bufLen_, sizeof(buf_) - bufLen_);
+    bufLen_ += n;
+    return n > 0;
+}
+
+bool TraceReader::next(twai_message_t* msg, uint64_t* timestampUs) {
+    if (format_ == TRACE_FORMAT_CAPTURE) return nextCapture(msg, timestampUs);
+    if (format_ == TRACE_FORMAT_CANDUMP) return nextCandump(msg, timestampUs);
+    return false;
+}
+
+bool TraceReader::nextCapture(twai_message_t* msg, uint64_t* timestampUs) {
+    for (;;) {
+        if (bufLen_ - bufPos_ < sizeof(CaptureRecord) && !fill()) return false;
+        if (bufLen_ - bufPos_ < sizeof(CaptureRecord)) return false;
+
+        CaptureRecord rec;
+        memcpy(&rec, buf_ + bufPos_, sizeof(rec));
+        bufPos_ += sizeof(rec);
+        consumed_ += sizeof(rec);
+        if (rec.flags & CAPTURE_FLAG_HEADER) continue; // ローテーション後の連結ファイルにも対応
+
+        memset(msg, 0, sizeof(*msg));
+        msg->identifier = rec.identifier;
+        msg->extd = (rec.flags & RX_FLAG_EXTD) ? 1 : 0;
+        msg->rtr = (rec.flags & RX_FLAG_RTR) ? 1 : 0;
+        msg->data_length_code = rec.dlc > 8 ? 8 : rec.dlc;
+        memcpy(msg->data, rec.data, sizeof(msg->data));
+        *timestampUs = rec.timestampUs;
+        return true;
+    }
+}
+
+bool TraceReader::readLine(char* line, size_t lineSize) {
+    for (;;) {
+        size_t avail = bufLen_ - bufPos_;
+        uint8_t* start = buf_ + bufPos_;
+        uint8_t* nl = (uint8_t*)memchr(start, '\n', avail);
+        if (!nl && avail < sizeof(buf_)) {
+            // 行末が見つからないので続きを読む。読めなければ末尾の改行なし行として扱う
+            if (fill()) continue;
+            if (avail == 0) return false;
+        }
+
+        // バッファより長い行は切り詰める（解析に失敗して読み飛ばされる）
+        size_t len = nl ? (size_t)(nl - start) : avail;
+        size_t consumed = nl ? len + 1 : len;
+        if (len >= lineSize) len = lineSize - 1;
+        memcpy(line, start, len);
+        line[len] = '\0';
+        bufPos_ += consumed;
+        consumed_ += consumed;
+        return true;
+    }
+}
+
+bool TraceReader::nextCandump(twai_message_t* msg, uint64_t* timestampUs) {
+    char line[96];
+    while (readLine(line, sizeof(line))) {
+        if (parseCandumpLine(line, msg, timestampUs)) return true;
+    }
+    return false;
+}
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+bool parseCandumpLine(const char* line, twai_message_t* msg, uint64_t* timestampUs) {
+    // (1436509052.249713) can0 123#DEADBEEF
+    const char* p = strchr(line, '(');
+    if (!p) return false;
+    char* end;
+    uint64_t sec = strtoull(p + 1, &end, 10);
+    uint64_t usec = 0;
+    if (*end == '.') {
+        // 小数部は6桁に揃える
+        int digits = 0;
+        for (p = end + 1; *p >= '0' && *p <= '9'; p++) {
+            if (digits < 6) { usec = usec * 10 + (*p - '0'); digits++; }
+        }
+        for (; digits < 6; digits++) usec *= 10;
+        end = (char*)p;
+    }
+    if (*end != ')') return false;
+
+    // インターフェース名を飛ばしてIDへ
+    p = strchr(end, ' ');
+    if (!p) return false;
+    while (*p == ' ') p++;
+    p = strchr(p, ' ');
+    if (!p) return false;
+    while (*p == ' ') p++;
+
+    const char* hash = strchr(p, '#');
+    if (!hash) return false;
+    size_t idLen = hash - p;
+    uint32_t id = strtoul(p, nullptr, 16);
+
+    memset(msg, 0, sizeof(*msg));
+    msg->identifier = id;
+    msg->extd = (idLen > 3 || id > 0x7FF) ? 1 : 0;
+    p = hash + 1;
+    if (*p == 'R') {
+        msg->rtr = 1;
+        if (p[1] >= '0' && p[1] <= '8') msg->data_length_code = p[1] - '0';
+    } else {
+        uint8_t n = 0;
+        while (n < 8) {
+            int hi = hexValue(p[0]);
+            int lo = hi < 0 ? -1 : hexValue(p[1]);
+            if (hi < 0 || lo < 0) break;
+            msg->data[n++] = (hi << 4) | lo;
+            p += 2;
+            if (*p == '.') p++; // 区切り付き表記 (11.22.33) も許容
+        }
+        msg->data_length_code = n;
+    }
+    *timestampUs = sec * 1000000ULL + usec;
+    return true;
+}
@@ -0,0 +1,148 @@
+#include "upload_writer.h"
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
+
+// ダイジェストの保存先 (<path>.sum)
+static void digestPath(const char* path, char* out, size_t outSize) {
+    snprintf(out, outSize, "%s.sum", path);
+}
+
+bool UploadWriter::begin(const char* path) {
+    if (active_) abort();
+    strlcpy(path_, path, sizeof(path_));
+
+    char sumPath[UPLOAD_PATH_MAX + 8];
+    digestPath(path_, sumPath, sizeof(sumPath));
+    if (LittleFS.exists(sumPath)) LittleFS.remove(sumPath);
+
+    // "w" で開けば既存の内容は切り詰められる
+    file_ = LittleFS.open(path_, "w");
+    if (!file_) return false;
+
+    len_ = 0;
+    received_ = 0;
+    crc_ = 0;
+    failed_ = false;
+    mbedtls_sha256_init(&sha_);
+    mbedtls_sha256_starts(&sha_, 0);
+    startUs_ = esp_timer_get_time();
+    active_ = true;
+    return true;
+}
+
+bool UploadWriter::flushBlock() {
+    if (len_ == 0) return true;
+    if (file_.write(buf_, len_) != len_) failed_ = true;
+    len_ = 0;
+    return !failed_;
+}
+
+bool UploadWriter::write(const uint8_t* data, size_t len) {
+    if (!active_ || failed_) return false;
+
+    // ダイジェストは受信したデータそのものから計算する
+    crc_ = esp_rom_crc32_le(crc_, data, len);
+    mbedtls_sha256_update(&sha_, data, len);
+    received_ += len;
+
+    // ブロックがいっぱいになったときだけ書く（ネットワークの細切れの書き込みをまとめる）
+    while (len > 0) {
+        size_t n = BLOCK_SIZE - len_;
+        if (n > len) n = len;
+        memcpy(buf_ + len_, data, n);
+        len_ += n;
+        data += n;
+        len -= n;
+        if (len_ == BLOCK_SIZE && !flushBlock()) return false;
+    }
+    return true;
+}
+
+bool UploadWriter::finish(UploadDigest* digest) {
+    if (!active_) return false;
+    flushBlock();
+    file_.close();
+    active_ = false;
+
+    digest->size = received_;
+    digest->crc32 = crc_;
+    mbedtls_sha256_finish(&sha_, digest->sha256);
+    mbedtls_sha256_free(&sha_);
+    if (failed_) {
+        LittleFS.remove(path_);
+        return false;
+    }
+
+    saveUploadDigest(path_, *digest);
+    return true;
+}
+
+void UploadWriter::abort() {
+    if (!active_) return;
+    file_.close();
+    mbedtls_sha256_free(&sha_);
+    LittleFS.remove(path_);
+    active_ = false;
+}
+
+uint32_t UploadWriter::kbPerSec() const {
+    int64_t elapsedUs = esp_timer_get_time() - startUs_;
+    if (elapsedUs <= 0) return 0;
+    return (uint32_t)((uint64_t)received_ * 1000000ULL / 1024 / elapsedUs);
+}
+
+bool saveUploadDigest(const char* path, const UploadDigest& digest) {
+    char sumPath[UPLOAD_PATH_MAX + 8];
+    digestPath(path, sumPath, sizeof(sumPath));
+    File f = LittleFS.open(sumPath, "w");
+    if (!f) return false;
+    bool ok = f.write((const uint8_t*)&digest, sizeof(digest)) == sizeof(digest);
+    f.close();
+    return ok;
+}
+
+bool computeFileDigest(const char* path, UploadDigest* digest) {
+    File f = LittleFS.open(path, "r");
+    if (!f) return false;
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    uint8_t buf[1024];
+    uint32_t crc = 0;
+    size_t total = 0;
+    for (size_t n; (n = f.read(buf, sizeof(buf))) > 0; total += n) {
+        crc = esp_rom_crc32_le(crc, buf, n);
+        mbedtls_sha256_update(&sha, buf, n);
+    }
+    bool ok = total == f.size();
+    f.close();
+    digest->size = total;
+    digest->crc32 = crc;
+    mbedtls_sha256_finish(&sha, digest->sha256);
+    mbedtls_sha256_free(&sha);
+    return ok;
+}
+
+bool loadUploadDigest(const char* path, UploadDigest* digest) {
+    char sumPath[UPLOAD_PATH_MAX + 8];
+    digestPath(path, sumPath, sizeof(sumPath));
+    File f = LittleFS.open(sumPath, "r");
+    if (!f) return false;
+    bool ok = f.read((uint8_t*)digest, sizeof(*digest)) == sizeof(*digest);
+    f.close();
+
+    // ファイル本体のサイズと合わなければ古いダイジェストとみなす
+    File data = LittleFS.open(path, "r");
+    if (!data) return false;
+    ok = ok && data.size() == digest->size;
+    data.close();
+    return ok;
+}
+
+void formatSha256(const UploadDigest& digest, char* out, size_t outSize) {
+    size_t n = 0;
+    for (size_t i = 0; i < sizeof(digest.sha256) && n + 2 < outSize; i++) {
+        n += snprintf(out + n, outSize - n, "%02x", digest.sha256[i]);
+    }
+    out[n] = '\0';
+}
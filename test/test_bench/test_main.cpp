@@ -0,0 +1,216 @@
+// ホスト (native) でのスループット計測
+// pio test -e native で実行し、結果を "BENCH_JSON {...}" の1行で出す
+// 環境変数 BENCH_RESULTS があれば、同じJSONをそのファイルにも書く (CIで前回と比べる用)
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <LittleFS.h>
+#include <WebServer.h>
+#include <unity.h>
+#include "can_tx.h"
+#include "config.h"
+#include "esp_timer.h"
+#include "native_sim.h"
+
+// src/main.cpp
+extern WebServer server;
+extern size_t rootPageBytes;
+extern uint32_t rootPageHeapUsed;
+void setup();
+
+// 計測の大きさ
+static const size_t UPLOAD_BYTES = 1024 * 1024;
+static const size_t PROCESS_FILE_BYTES = 48 * 1024;
+static const uint32_t SEND_CAN_FRAMES = 2000;
+static const uint32_t CONFIG_PARSE_ROUNDS = 200;
+
+// 下回ったら (上回ったら) 失敗にする値。CIのマシン差を見込んで緩めにしてある
+// バス使用率は 500kbit/s の模擬バスに対する割合なので、マシンの速さにはあまり左右されない
+static const float MIN_UPLOAD_MB_PER_SEC = 2.0f;
+static const float MIN_PROCESS_BUS_UTIL_PCT = 80.0f;
+static const float MIN_SEND_CAN_BUS_UTIL_PCT = 80.0f;
+static const uint32_t MAX_CONFIG_PARSE_US = 2000;
+static const uint32_t MAX_ROOT_PAGE_HEAP_BYTES = 8 * 1024;
+
+static JsonDocument results;
+
+static int64_t elapsedSince(int64_t startUs) {
+    int64_t us = esp_timer_get_time() - startUs;
+    return us > 0 ? us : 1;
+}
+
+// 送信ジョブが終わるまで待つ
+static TxJobState waitJob(uint32_t jobId, uint32_t timeoutMs) {
+    uint32_t start = millis();
+    for (;;) {
+        TxStatus st = getTxStatus();
+        if (st.jobId == jobId && st.state != TX_QUEUED && st.state != TX_RUNNING) return st.state;
+        if (millis() - start > timeoutMs) return TX_RUNNING;
+        delay(1);
+    }
+}
+
+static void fillPattern(uint8_t* buf, size_t len) {
+    for (size_t i = 0; i < len; i++) buf[i] = (uint8_t)(i * 31 + (i >> 8));
+}
+
+// handleFileUpload() にブラウザと同じ大きさ (HTTP_UPLOAD_BUFLEN) ずつ流し込む
+static void test_upload_throughput() {
+    static uint8_t data[UPLOAD_BYTES];
+    fillPattern(data, sizeof(data));
+
+    nativeSimSetSerialEnabled(false);
+    int64_t start = esp_timer_get_time();
+    bool routed = server.simUpload("/upload", "bench.bin", data, sizeof(data));
+    int64_t elapsedUs = elapsedSince(start);
+    nativeSimSetSerialEnabled(true);
+
+    TEST_ASSERT_TRUE(routed);
+    File f = LittleFS.open("/uploaded.bin", "r");
+    TEST_ASSERT_TRUE((bool)f);
+    TEST_ASSERT_EQUAL(UPLOAD_BYTES, f.size());
+    f.close();
+
+    float mbPerSec = (float)UPLOAD_BYTES / elapsedUs; // byte/µs = MB/s
+    JsonObject o = results["upload"].to<JsonObject>();
+    o["bytes"] = UPLOAD_BYTES;
+    o["elapsed_us"] = elapsedUs;
+    o["mb_per_sec"] = mbPerSec;
+    TEST_ASSERT_GREATER_OR_EQUAL_FLOAT(MIN_UPLOAD_MB_PER_SEC, mbPerSec);
+}
+
+// 間隔0の設定で /process を投げ、processFile() がバスをどれだけ埋められるか
+static void test_process_file() {
+    static uint8_t data[PROCESS_FILE_BYTES];
+    fillPattern(data, sizeof(data));
+    nativeSimSetSerialEnabled(false);
+    TEST_ASSERT_TRUE(server.simUpload("/upload", "process.bin", data, sizeof(data)));
+
+    Config c = appConfig;
+    c.packetGap = 0;
+    c.packetGapUs = 0;
+    c.chunkInterval = 0;
+    c.chunkIntervalUs = 0;
+    c.busLoadPct = 0;
+    c.rateControl = 0;
+    c.transport = TRANSPORT_RAW;
+    TEST_ASSERT_TRUE(saveConfig(c));
+
+    TwaiSimStats before = twaiSimStats();
+    int64_t start = esp_timer_get_time();
+    server.simCaptureBody(true);
+    TEST_ASSERT_TRUE(server.simRequest(HTTP_GET, "/process"));
+    TEST_ASSERT_EQUAL(202, server.simResponse().code);
+    JsonDocument body;
+    TEST_ASSERT_FALSE(deserializeJson(body, server.simResponse().body));
+    TxJobState state = waitJob(body["job_id"] | 0u, 60000);
+    TEST_ASSERT_TRUE(twaiSimWaitIdle(5000));
+    int64_t elapsedUs = elapsedSince(start);
+    TwaiSimStats after = twaiSimStats();
+    nativeSimSetSerialEnabled(true);
+    TEST_ASSERT_EQUAL(TX_DONE, state);
+
+    TxStatus st = getTxStatus();
+    uint64_t frames = after.framesOnBus - before.framesOnBus;
+    float busUtil = (float)(after.busBusyUs - before.busBusyUs) * 100 / elapsedUs;
+    JsonObject o = results["process_file"].to<JsonObject>();
+    o["bytes"] = PROCESS_FILE_BYTES;
+    o["frames"] = frames;
+    o["frames_failed"] = st.framesFailed;
+    o["elapsed_us"] = elapsedUs;
+    o["frames_per_sec"] = (uint32_t)(frames * 1000000ULL / elapsedUs);
+    o["bus_util_pct"] = busUtil;
+    TEST_ASSERT_EQUAL(0, st.framesFailed);
+    TEST_ASSERT_GREATER_OR_EQUAL_FLOAT(MIN_PROCESS_BUS_UTIL_PCT, busUtil);
+}
+
+// sendCAN() を続けて呼び、バスに出し終わるまでの時間を測る
+static void test_send_can() {
+    uint8_t data[8] = {0};
+    uint32_t failed = 0;
+    TwaiSimStats before = twaiSimStats();
+    int64_t start = esp_timer_get_time();
+    for (uint32_t i = 0; i < SEND_CAN_FRAMES; i++) {
+        data[0] = (uint8_t)i;
+        if (!sendCAN(appConfig.sendId1, data, sizeof(data))) failed++;
+    }
+    TEST_ASSERT_TRUE(twaiSimWaitIdle(5000));
+    int64_t elapsedUs = elapsedSince(start);
+    TwaiSimStats after = twaiSimStats();
+
+    uint64_t frames = after.framesOnBus - before.framesOnBus;
+    float busUtil = (float)(after.busBusyUs - before.busBusyUs) * 100 / elapsedUs;
+    JsonObject o = results["send_can"].to<JsonObject>();
+    o["frames"] = frames;
+    o["failed"] = failed;
+    o["elapsed_us"] = elapsedUs;
+    o["frames_per_sec"] = (uint32_t)(frames * 1000000ULL / elapsedUs);
+    o["bus_util_pct"] = busUtil;
+    TEST_ASSERT_EQUAL(0, failed);
+    TEST_ASSERT_GREATER_OR_EQUAL_FLOAT(MIN_SEND_CAN_BUS_UTIL_PCT, busUtil);
+}
+
+// 起動時と同じ loadConfig() (読み込み・検証・反映) 1回あたりの時間
+static void test_config_parse() {
+    nativeSimSetSerialEnabled(false);
+    int64_t start = esp_timer_get_time();
+    for (uint32_t i = 0; i < CONFIG_PARSE_ROUNDS; i++) loadConfig();
+    int64_t elapsedUs = elapsedSince(start);
+    nativeSimSetSerialEnabled(true);
+
+    uint32_t usPerParse = (uint32_t)(elapsedUs / CONFIG_PARSE_ROUNDS);
+    JsonObject o = results["config_parse"].to<JsonObject>();
+    o["rounds"] = CONFIG_PARSE_ROUNDS;
+    o["us_per_parse"] = usPerParse;
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(MAX_CONFIG_PARSE_US, usPerParse);
+}
+
+// handleRoot() の送信サイズと、描画中に増えたヒープのピーク
+static void test_root_page() {
+    server.simCaptureBody(false); // 本文を溜めるとそのぶんヒープを使うので捨てる
+    size_t heapBefore = nativeSimHeapUsed();
+    nativeSimResetHeapPeak();
+    TEST_ASSERT_TRUE(server.simRequest(HTTP_GET, "/"));
+    size_t peak = nativeSimHeapPeak() - heapBefore;
+    TEST_ASSERT_EQUAL(200, server.simResponse().code);
+
+    JsonObject o = results["root_page"].to<JsonObject>();
+    o["bytes"] = server.simResponse().bytes;
+    o["peak_heap_bytes"] = peak;
+    o["heap_used"] = rootPageHeapUsed; // ESP.getFreeHeap() で見た量 (実機の /metrics と同じ計り方)
+    TEST_ASSERT_EQUAL(server.simResponse().bytes, rootPageBytes);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(MAX_ROOT_PAGE_HEAP_BYTES, peak);
+}
+
+static void writeResults() {
+    String json;
+    serializeJson(results, json);
+    printf("BENCH_JSON %s\n", json.c_str());
+    const char* path = getenv("BENCH_RESULTS");
+    if (path && *path) {
+        FILE* f = fopen(path, "w");
+        if (f) {
+            fprintf(f, "%s\n", json.c_str());
+            fclose(f);
+        }
+    }
+}
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+    setup();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_upload_throughput);
+    RUN_TEST(test_process_file);
+    RUN_TEST(test_send_can);
+    RUN_TEST(test_config_parse);
+    RUN_TEST(test_root_page);
+    writeResults();
+    int failures = UNITY_END();
+
+    // 送信・受信タスクは終わらないので、待たずにプロセスを終える
+    fflush(stdout);
+    _Exit(failures);
+}
@@ -0,0 +1,192 @@
+// ブロック単位のアップロード (/blocks/*) の結合テスト
+// 順不同・CRC違いのブロックを混ぜて送り、足りないブロックを送り直すまで確定できないことを確かめる
+// pio test -e native -f test_block_upload で実行する
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <LittleFS.h>
+#include <WebServer.h>
+#include <unity.h>
+#include <vector>
+#include <zlib.h>
+#include "block_upload.h"
+#include "mbedtls/sha256.h"
+#include "native_sim.h"
+#include "upload_writer.h"
+
+// src/main.cpp
+extern WebServer server;
+void setup();
+
+static const char* const TARGET = "/uploaded.bin"; // name=image の保存先
+static const uint32_t BLOCK = 1024;
+static const uint32_t BLOCKS = 5;
+static const size_t DATA_BYTES = (BLOCKS - 1) * BLOCK + 300; // 最後のブロックは短い
+
+static uint8_t data[DATA_BYTES];
+
+static void fillPattern(uint8_t* buf, size_t len, uint8_t seed) {
+    for (size_t i = 0; i < len; i++) buf[i] = (uint8_t)(i * 13 + (i >> 7) + seed);
+}
+
+static uint32_t blockCrc(const uint8_t* buf, size_t len) {
+    return (uint32_t)crc32(0, buf, len);
+}
+
+static size_t blockLen(uint32_t index) {
+    size_t left = DATA_BYTES - index * BLOCK;
+    return left < BLOCK ? left : BLOCK;
+}
+
+static JsonDocument responseJson() {
+    JsonDocument doc;
+    TEST_ASSERT_FALSE(deserializeJson(doc, server.simResponse().body));
+    return doc;
+}
+
+static int getBlocks(const char* uri, const std::vector<WebServer::SimArg>& args, JsonDocument* doc) {
+    TEST_ASSERT_TRUE(server.simRequest(HTTP_GET, uri, args));
+    *doc = responseJson();
+    return server.simResponse().code;
+}
+
+// index 番のブロックを送る。corrupt なら中身を1byte壊し、CRCは元のデータのまま送る（途中で化けた場合）
+static int putBlock(uint32_t index, bool corrupt, JsonDocument* doc) {
+    const uint8_t* block = data + index * BLOCK;
+    size_t len = blockLen(index);
+    uint32_t crc = blockCrc(block, len);
+    std::vector<uint8_t> body(block, block + len);
+    if (corrupt) body[len / 2] ^= 0x5A;
+
+    char crcHex[9];
+    snprintf(crcHex, sizeof(crcHex), "%x", crc);
+    TEST_ASSERT_TRUE(server.simUpload("/blocks/put", "block.bin", body.data(), body.size(),
+                                      {{"name", "image"}, {"index", String(index)}, {"crc", crcHex}}, 256));
+    *doc = responseJson();
+    return server.simResponse().code;
+}
+
+static void assertMissing(JsonDocument& doc, const std::vector<uint32_t>& expected) {
+    JsonArray missing = doc["missing"].as<JsonArray>();
+    TEST_ASSERT_EQUAL(expected.size(), missing.size());
+    for (size_t i = 0; i < expected.size(); i++) TEST_ASSERT_EQUAL(expected[i], missing[i].as<uint32_t>());
+    TEST_ASSERT_EQUAL(BLOCKS - expected.size(), doc["received"].as<uint32_t>());
+}
+
+static std::vector<uint8_t> readFile(const char* path) {
+    std::vector<uint8_t> out;
+    File f = LittleFS.open(path, "r");
+    if (!f) return out;
+    out.resize(f.size());
+    out.resize(f.read(out.data(), out.size()));
+    f.close();
+    return out;
+}
+
+// 順不同で送り、CRCの合わないブロックと送っていないブロックが残る間は確定しない
+static void test_out_of_order_with_bad_block() {
+    static uint8_t oldData[700];
+    fillPattern(oldData, sizeof(oldData), 0x42);
+    TEST_ASSERT_TRUE(server.simUpload("/upload", "old.bin", oldData, sizeof(oldData)));
+
+    JsonDocument doc;
+    TEST_ASSERT_EQUAL(200, getBlocks("/blocks/begin", {{"name", "image"}, {"size", String(DATA_BYTES)}, {"block_size", String(BLOCK)}}, &doc));
+    TEST_ASSERT_EQUAL(BLOCKS, doc["blocks"].as<uint32_t>());
+    assertMissing(doc, {0, 1, 2, 3, 4});
+
+    TEST_ASSERT_EQUAL(200, putBlock(3, false, &doc));
+    TEST_ASSERT_EQUAL(200, putBlock(4, false, &doc)); // 短い最後のブロック
+    TEST_ASSERT_EQUAL(422, putBlock(1, true, &doc));
+    TEST_ASSERT_EQUAL_STRING("crc mismatch", doc["result"] | "");
+    TEST_ASSERT_EQUAL(200, putBlock(0, false, &doc));
+
+    // CRC違いの 1 と送っていない 2 が未受信として残る
+    TEST_ASSERT_EQUAL(200, getBlocks("/blocks/status", {{"name", "image"}}, &doc));
+    assertMissing(doc, {1, 2});
+
+    TEST_ASSERT_EQUAL(409, getBlocks("/blocks/commit", {{"name", "image"}}, &doc));
+    TEST_ASSERT_EQUAL_STRING("incomplete", doc["result"] | "");
+    // 確定するまで元のファイルはそのまま
+    std::vector<uint8_t> current = readFile(TARGET);
+    TEST_ASSERT_EQUAL(sizeof(oldData), current.size());
+    TEST_ASSERT_EQUAL_MEMORY(oldData, current.data(), sizeof(oldData));
+
+    TEST_ASSERT_EQUAL(200, putBlock(2, false, &doc));
+    TEST_ASSERT_EQUAL(409, getBlocks("/blocks/commit", {{"name", "image"}}, &doc));
+    TEST_ASSERT_EQUAL(200, getBlocks("/blocks/status", {{"name", "image"}}, &doc));
+    assertMissing(doc, {1});
+
+    TEST_ASSERT_EQUAL(200, putBlock(1, false, &doc));
+    TEST_ASSERT_EQUAL(200, getBlocks("/blocks/status", {{"name", "image"}}, &doc));
+    assertMissing(doc, {});
+
+    // ファイル全体の CRC32 を付けて確定する
+    uint32_t fileCrc = blockCrc(data, DATA_BYTES);
+    char crcHex[9];
+    snprintf(crcHex, sizeof(crcHex), "%08X", fileCrc);
+    TEST_ASSERT_EQUAL(200, getBlocks("/blocks/commit", {{"name", "image"}, {"crc32", crcHex}}, &doc));
+    TEST_ASSERT_EQUAL(DATA_BYTES, doc["size"].as<uint32_t>());
+    TEST_ASSERT_EQUAL_STRING(crcHex, doc["crc32"] | "");
+
+    // 確定したファイルと .sum が送ったデータと一致する
+    current = readFile(TARGET);
+    TEST_ASSERT_EQUAL(DATA_BYTES, current.size());
+    TEST_ASSERT_EQUAL_MEMORY(data, current.data(), DATA_BYTES);
+
+    uint8_t sha[32];
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts(&ctx, 0);
+    mbedtls_sha256_update(&ctx, data, DATA_BYTES);
+    mbedtls_sha256_finish(&ctx, sha);
+    mbedtls_sha256_free(&ctx);
+
+    UploadDigest digest;
+    TEST_ASSERT_TRUE(loadUploadDigest(TARGET, &digest));
+    TEST_ASSERT_EQUAL(DATA_BYTES, digest.size);
+    TEST_ASSERT_EQUAL(fileCrc, digest.crc32);
+    TEST_ASSERT_EQUAL_MEMORY(sha, digest.sha256, sizeof(sha));
+    char shaHex[65];
+    formatSha256(digest, shaHex, sizeof(shaHex));
+    TEST_ASSERT_EQUAL_STRING(shaHex, doc["sha256"] | "");
+
+    // セッションは片付いている
+    TEST_ASSERT_EQUAL(404, getBlocks("/blocks/status", {{"name", "image"}}, &doc));
+}
+
+// ファイル全体の CRC32 が違えば、全ブロックがそろっていても置き換えない
+static void test_commit_rejects_wrong_file_crc() {
+    JsonDocument doc;
+    fillPattern(data, sizeof(data), 0x17);
+    TEST_ASSERT_EQUAL(200, getBlocks("/blocks/begin", {{"name", "image"}, {"size", String(DATA_BYTES)}, {"block_size", String(BLOCK)}}, &doc));
+    for (uint32_t i = BLOCKS; i-- > 0;) TEST_ASSERT_EQUAL(200, putBlock(i, false, &doc));
+
+    char crcHex[9];
+    snprintf(crcHex, sizeof(crcHex), "%08X", blockCrc(data, DATA_BYTES) ^ 1);
+    TEST_ASSERT_EQUAL(422, getBlocks("/blocks/commit", {{"name", "image"}, {"crc32", crcHex}}, &doc));
+    TEST_ASSERT_EQUAL_STRING("file crc mismatch", doc["result"] | "");
+    std::vector<uint8_t> current = readFile(TARGET);
+    TEST_ASSERT_FALSE(current.size() == DATA_BYTES && memcmp(current.data(), data, DATA_BYTES) == 0);
+
+    TEST_ASSERT_TRUE(server.simRequest(HTTP_GET, "/blocks/abort", {{"name", "image"}}));
+}
+
+void setUp() {
+    server.simCaptureBody(true);
+}
+
+void tearDown() {}
+
+int main() {
+    setup();
+    nativeSimSetSerialEnabled(false);
+    fillPattern(data, sizeof(data), 0);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_out_of_order_with_bad_block);
+    RUN_TEST(test_commit_rejects_wrong_file_crc);
+    int failures = UNITY_END();
+
+    // 送信・受信タスクは終わらないので、待たずにプロセスを終える
+    fflush(stdout);
+    _Exit(failures);
+}